@@ -0,0 +1,69 @@
+// Throughput of batch mode: expressions piped into lsp and results read back, in expressions per
+// second, with results framed by newlines and by NUL bytes
+//
+//     ./batch_bench [path to lsp] [expressions]
+//
+// Run it from the repository so that lsp finds prelude.img, if one was dumped
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void report(char* name, double seconds, int n, int results) {
+	printf("%-24s %10.0f expressions/s   (%d results)\n", name, n / seconds, results);
+}
+
+int run(char* command, char sep) {
+	// Run lsp over the script, returns how many results came back
+	FILE* p = popen(command, "r");
+	if (!p) {
+		perror("popen");
+		exit(1);
+	}
+	int results = 0, c;
+	while ((c = getc(p)) != EOF) {
+		if (c == sep) { results++; }
+	}
+	pclose(p);
+	return results;
+}
+
+int main(int argc, char** argv) {
+	char* lsp = argc >= 2 ? argv[1] : "./lsp";
+	int n = argc >= 3 ? atoi(argv[2]) : 100000;
+
+	// Short expressions, so that reading and writing them is most of the work
+	char script[] = "/tmp/batch_benchXXXXXX";
+	int fd = mkstemp(script);
+	FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!f) {
+		perror("mkstemp");
+		return 1;
+	}
+	for (int i = 0; i < n; i++) {
+		fprintf(f, i % 4 == 3 ? "(list %d (* %d 2))\n" : "(+ %d 1)\n", i, i);
+	}
+	fclose(f);
+
+	char command[512];
+	snprintf(command, sizeof(command), "%s - < %s", lsp, script);
+	double t = now();
+	int results = run(command, '\n');
+	report("newline framing", now() - t, n, results);
+
+	snprintf(command, sizeof(command), "%s -0 < %s", lsp, script);
+	t = now();
+	results = run(command, '\0');
+	report("NUL framing", now() - t, n, results);
+
+	remove(script);
+	return 0;
+}
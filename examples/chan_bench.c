@@ -0,0 +1,104 @@
+// Latency and throughput of channels between two interpreters, each running on a thread of its
+// own: round trips of one value through a pair of channels, then a stream of values through one
+//
+//     ./chan_bench [round trips] [messages]
+//
+// Recursion in Lsp gets slower the deeper it goes, both sides loop over short recursive calls
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lsp.h"
+
+#define CHUNK 100
+
+#define FUNCS \
+	"(fun {echo in out n} { if (== n 0) {()} {do (send out (recv in)) (echo in out (- n 1))} })" \
+	"(fun {ping in out n} { if (== n 0) {()} {do (send out n) (recv in) (ping in out (- n 1))} })" \
+	"(fun {flood out n} { if (== n 0) {()} {do (send out n) (flood out (- n 1))} })" \
+	"(fun {sink in n} { if (== n 0) {()} {do (recv in) (sink in (- n 1))} })"
+
+double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+typedef struct {
+	lsp_state* state;
+	char* func;
+	lval* in;
+	lval* out;
+	int n;
+} side;
+
+void run(side* s) {
+	// Call func over n values in chunks, with the channels it reads from and writes to if any
+	for (int done = 0; done < s->n; done += CHUNK) {
+		int k = s->n - done < CHUNK ? s->n - done : CHUNK;
+		lval* argv[3];
+		int argc = 0;
+		if (s->in)  { argv[argc++] = lval_copy(s->in); }
+		if (s->out) { argv[argc++] = lval_copy(s->out); }
+		argv[argc++] = lval_num(k);
+
+		lval* v = lsp_call(s->state, s->func, argc, argv);
+		if (lval_type(v) == LVAL_ERR) { lval_println(v); }
+		lval_del(v);
+	}
+}
+
+void* run_thread(void* arg) {
+	run(arg);
+	return NULL;
+}
+
+double pair(side* a, side* b) {
+	// Run a here and b on another thread, returns how long a took
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, run_thread, b) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+	double t = now();
+	run(a);
+	t = now() - t;
+	pthread_join(thread, NULL);
+	return t;
+}
+
+int main(int argc, char** argv) {
+	int trips = argc >= 2 ? atoi(argv[1]) : 10000;
+	int messages = argc >= 3 ? atoi(argv[2]) : 100000;
+
+	// Both interpreters are created here, they then only share the channels
+	lsp_state* a = lsp_new("prelude.img");
+	lsp_state* b = lsp_new("prelude.img");
+	lval_del(lsp_eval_string(a, "<bench>", FUNCS));
+	lval_del(lsp_eval_string(b, "<bench>", FUNCS));
+
+	lval* there = lsp_eval_string(a, "<bench>", "(chan 1)");
+	lval* back = lsp_eval_string(a, "<bench>", "(chan 1)");
+
+	side ping = { a, "ping", back, there, trips };
+	side echo = { b, "echo", there, back, trips };
+	double t = pair(&ping, &echo);
+	printf("%-24s %10.2f us/round trip\n", "ping-pong", t / trips * 1e6);
+
+	lval* stream = lsp_eval_string(a, "<bench>", "(chan 256)");
+	side flood = { a, "flood", NULL, stream, messages };
+	side sink = { b, "sink", stream, NULL, messages };
+	t = pair(&flood, &sink);
+	printf("%-24s %10.0f messages/s\n", "stream, capacity 256", messages / t);
+
+	lval_del(there);
+	lval_del(back);
+	lval_del(stream);
+	lsp_delete(a);
+	lsp_delete(b);
+	return 0;
+}
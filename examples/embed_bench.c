@@ -0,0 +1,108 @@
+// Latency of evaluating an expression inside the process through liblsp, against spawning the
+// lsp executable for it and reading its output, which is what shelling out per job costs
+//
+//     ./embed_bench [path to lsp] [iterations]
+//
+// Run it from the repository so that both sides find prelude.img, if one was dumped
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lsp.h"
+
+#define FACT "(fun {fact n} { if (== n 0) {1} {* n (fact (- n 1))} })"
+
+double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+lval* builtin_square(lenv* env, lval* args) {
+	// Native builtin "square", registered the same way as the interpreter's own
+	if (lval_count(args) != 1 || lval_type(lval_child(args, 0)) != LVAL_NUM) {
+		lval_del(args);
+		return lval_err("Function 'square' expects a single Number");
+	}
+	double x = lval_to_num(lval_child(args, 0));
+	lval_del(args);
+	return lval_num(x * x);
+}
+
+void report(char* name, double seconds, int n, double result) {
+	printf("%-24s %10.2f us/op   (result %g)\n", name, seconds / n * 1e6, result);
+}
+
+int main(int argc, char** argv) {
+	char* lsp = argc >= 2 ? argv[1] : "./lsp";
+	int n = argc >= 3 ? atoi(argv[2]) : 200;
+
+	// Start-up and standard library, once
+	double t = now();
+	lsp_state* state = lsp_new("prelude.img");
+	lsp_add_builtin(state, "square", builtin_square);
+	lval_del(lsp_eval_string(state, "<bench>", FACT));
+	report("lsp_new", now() - t, 1, 0);
+
+	// Whole expression from source, as a client sending text would
+	double result = 0;
+	t = now();
+	for (int i = 0; i < n; i++) {
+		lval* v = lsp_eval_string(state, "<bench>", "(square (fact 10))");
+		result = lval_to_num(v);
+		lval_del(v);
+	}
+	report("lsp_eval_string", now() - t, n, result);
+
+	// Direct call with C arguments, no parsing
+	t = now();
+	for (int i = 0; i < n; i++) {
+		lval* arg = lval_num(10);
+		lval* v = lsp_call(state, "fact", 1, &arg);
+		result = lval_to_num(v);
+		lval_del(v);
+	}
+	report("lsp_call", now() - t, n, result);
+
+	lsp_delete(state);
+
+	// The same job through a new process each time
+	char script[] = "/tmp/embed_benchXXXXXX";
+	int fd = mkstemp(script);
+	FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!f) {
+		perror("mkstemp");
+		return 1;
+	}
+	fputs(FACT "\n(print (* (fact 10) (fact 10)))\n", f);
+	fclose(f);
+
+	char command[512];
+	snprintf(command, sizeof(command), "%s %s", lsp, script);
+
+	int spawns = n < 50 ? n : 50;
+	t = now();
+	for (int i = 0; i < spawns; i++) {
+		FILE* p = popen(command, "r");
+		char line[256] = "";
+		if (!p || !fgets(line, sizeof(line), p)) {
+			fprintf(stderr, "Could not run %s\n", command);
+			if (p) { pclose(p); }
+			remove(script);
+			return 1;
+		}
+		result = strtod(line, NULL);
+		pclose(p);
+	}
+	report("process per expression", now() - t, spawns, result);
+
+	// lsp also left a compiled module next to the script
+	snprintf(command, sizeof(command), "%s.lspc", script);
+	remove(command);
+	remove(script);
+	return 0;
+}
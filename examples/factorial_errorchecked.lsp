@@ -5,16 +5,10 @@
 	{true}
 })
 
-; Generates a list of integers from 1 to n
-(fun {range n} {
-    if (<= n 1)
-        {list 1}
-        {join (range (- n 1)) (list n)}
-})
-
 ; Compute the factorial n! of a natural number n
+; Integers from 1 to n are generated one at a time instead of building a list of them
 (fun {fact n} {
     if (is_natural n)
-        {eval (cons * (range n))}
+        {gen-foldl * 1 (gen-range 1 (+ n 1))}
 	{error "Can't compute factorial of nonnatural number"}
 })
@@ -0,0 +1,71 @@
+// Time to load a script through liblsp, cold when it has to be parsed and its compiled module
+// written, and warm when that module is read instead
+//
+//     ./load_bench [definitions] [iterations]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lsp.h"
+
+double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void report(char* name, double seconds, int n, long size) {
+	printf("%-24s %10.2f ms/load   %8.1f MB/s\n", name, seconds / n * 1e3, size * n / seconds / 1e6);
+}
+
+int main(int argc, char** argv) {
+	int defs = argc >= 2 ? atoi(argv[1]) : 2000;
+	int n = argc >= 3 ? atoi(argv[2]) : 20;
+
+	// A script of function definitions with comments, strings and numbers in them
+	char script[] = "/tmp/load_benchXXXXXX";
+	int fd = mkstemp(script);
+	FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!f) {
+		perror("mkstemp");
+		return 1;
+	}
+	for (int i = 0; i < defs; i++) {
+		fprintf(f, "; Definition number %d of the benchmark\n", i);
+		fprintf(f, "(fun {f%d x y} {if (> x %d.5) {join {x y} {\"label %d\" -%d}} {head {y x}}})\n",
+			i, i, i, i);
+	}
+	long size = ftell(f);
+	fclose(f);
+
+	char module[sizeof(script) + 5];
+	snprintf(module, sizeof(module), "%s.lspc", script);
+
+	lsp_state* state = lsp_new(NULL);
+
+	// Parsed every time, the module removed before each load
+	double cold = 0;
+	for (int i = 0; i < n; i++) {
+		remove(module);
+		double t = now();
+		lval_del(lsp_eval_file(state, script));
+		cold += now() - t;
+	}
+	report("cold (parse)", cold, n, size);
+
+	// Read from the module the last cold load left
+	double t = now();
+	for (int i = 0; i < n; i++) { lval_del(lsp_eval_file(state, script)); }
+	double warm = now() - t;
+	report("warm (module)", warm, n, size);
+	printf("%-24s %10.1fx\n", "speedup", cold / warm);
+
+	lsp_delete(state);
+	remove(module);
+	remove(script);
+	return 0;
+}
@@ -0,0 +1,104 @@
+// Parser throughput over the Lsp grammar, in MB/s, on three kinds of data: long strings and
+// comments, which are scanned in bulk, code mixing every kind of literal, and small records
+//
+//     ./parse_bench [MB per kind]
+//
+// Build it with -DMPC_NO_SIMD as well to compare bulk scans without SIMD
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpc.h"
+
+#define GRAMMAR \
+	"number  : /-?[0-9]+(\\.[0-9]*)?/ ;" \
+	"symbol  : /[a-zA-Z0-9_+\\-*\\/%\\\\=<>!|&]+/ ;" \
+	"string  : /\"(\\\\.|[^\"\\\\])*\"/s ;" \
+	"comment : /;[^\\r\\n]*/ ;" \
+	"sexpr   : '(' <expr>* ')' ;" \
+	"qexpr   : '{' <expr>* '}' ;" \
+	"expr    : <number> | <symbol> | <string> | <comment> | <sexpr> | <qexpr> ;"
+
+double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void write_long(FILE* f, int i) {
+	fputs("; ", f);
+	for (int j = 0; j < 200; j++) { fputc('a' + (i + j) % 26, f); }
+	fputs("\n\"", f);
+	for (int j = 0; j < 500; j++) { fputc(j % 50 == 49 ? ' ' : 'a' + (i * j) % 26, f); }
+	fputs("\"\n", f);
+}
+
+void write_mixed(FILE* f, int i) {
+	fprintf(f, "(fun {f%d x y} {if (> x %d.5) {+ (* x -2) \"s%d\" y} {head {x y %d}}})\n",
+		i, i, i, i);
+}
+
+void write_record(FILE* f, int i) {
+	fprintf(f, "{\"id\" %d \"name\" \"n%d\" \"score\" %d.25 \"tags\" {a b c}}\n", i, i, i % 100);
+}
+
+void run(char* name, void (*write)(FILE*, int), long bytes, mpc_parser_t* expr) {
+	// Write bytes of data to a file, then parse it as a stream of expressions
+	char path[] = "/tmp/parse_benchXXXXXX";
+	int fd = mkstemp(path);
+	FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!f) {
+		perror("mkstemp");
+		exit(1);
+	}
+	for (int i = 0; ftell(f) < bytes; i++) { write(f, i); }
+	long size = ftell(f);
+	fclose(f);
+
+	double t = now();
+	long items = 0;
+	mpc_stream_t* s = mpc_stream_contents(path);
+	mpc_result_t r;
+	while (!mpc_stream_end(s)) {
+		if (!mpc_stream_next(s, expr, &r)) {
+			mpc_err_delete(r.error);
+			break;
+		}
+		mpc_ast_delete(r.output);
+		items++;
+	}
+	mpc_stream_delete(s);
+	t = now() - t;
+
+	printf("%-24s %10.1f MB/s   (%ld expressions)\n", name, size / t / 1e6, items);
+	remove(path);
+}
+
+int main(int argc, char** argv) {
+	long bytes = (argc >= 2 ? atol(argv[1]) : 10) << 20;
+
+	mpc_parser_t* Number  = mpc_new("number");
+	mpc_parser_t* Symbol  = mpc_new("symbol");
+	mpc_parser_t* String  = mpc_new("string");
+	mpc_parser_t* Comment = mpc_new("comment");
+	mpc_parser_t* Sexpr   = mpc_new("sexpr");
+	mpc_parser_t* Qexpr   = mpc_new("qexpr");
+	mpc_parser_t* Expr    = mpc_new("expr");
+	mpc_err_t* err = mpca_lang(MPCA_LANG_DEFAULT, GRAMMAR,
+		Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, NULL);
+	if (err) {
+		mpc_err_print(err);
+		return 1;
+	}
+
+	run("strings and comments", write_long, bytes, Expr);
+	run("mixed literals", write_mixed, bytes, Expr);
+	run("small records", write_record, bytes, Expr);
+
+	mpc_cleanup(7, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr);
+	return 0;
+}
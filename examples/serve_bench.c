@@ -0,0 +1,141 @@
+// Latency and throughput of lsp --serve: clients on threads of their own each send requests one
+// after another over a connection of their own, then the median and 99th percentile of the round
+// trips of all of them are reported along with requests per second
+//
+//     ./lsp --serve /tmp/lsp.sock &
+//     ./serve_bench /tmp/lsp.sock [clients] [requests per client] [expression]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+typedef struct {
+	char* path;
+	char* expr;
+	int n;
+	double* latency;
+	char* last;  // Last response, to show what the server answered
+	int failed;
+} client;
+
+int full(int fd, char* buf, size_t len, int writing) {
+	// Send or receive exactly len bytes, returns 0 if the connection broke
+	while (len > 0) {
+		ssize_t n = writing ? write(fd, buf, len) : read(fd, buf, len);
+		if (n <= 0) { return 0; }
+		buf += n;
+		len -= n;
+	}
+	return 1;
+}
+
+void* run(void* arg) {
+	client* c = arg;
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, c->path, sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		perror("connect");
+		c->failed = 1;
+		return NULL;
+	}
+
+	// The request is the same every time, its length first
+	size_t len = strlen(c->expr);
+	char* request = malloc(len + 4);
+	unsigned char* header = (unsigned char*)request;
+	header[0] = len >> 24; header[1] = len >> 16; header[2] = len >> 8; header[3] = len;
+	memcpy(request + 4, c->expr, len);
+
+	for (int i = 0; i < c->n; i++) {
+		double t = now();
+		unsigned char h[4];
+		if (!full(fd, request, len + 4, 1) || !full(fd, (char*)h, 4, 0)) {
+			c->failed = 1;
+			break;
+		}
+		size_t n = (size_t)h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+		free(c->last);
+		c->last = malloc(n + 1);
+		if (!full(fd, c->last, n, 0)) {
+			c->failed = 1;
+			break;
+		}
+		c->last[n] = '\0';
+		c->latency[i] = now() - t;
+	}
+
+	free(request);
+	close(fd);
+	return NULL;
+}
+
+int cmp(const void* a, const void* b) {
+	double x = *(double*)a, y = *(double*)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s socket [clients] [requests per client] [expression]\n", argv[0]);
+		return 1;
+	}
+	int clients = argc >= 3 ? atoi(argv[2]) : 16;
+	int n = argc >= 4 ? atoi(argv[3]) : 1000;
+	char* expr = argc >= 5 ? argv[4] : "(foldl + 0 (map (lambda {x} {* x x}) {1 2 3 4 5 6 7 8}))";
+
+	client* c = calloc(clients, sizeof(client));
+	pthread_t* threads = calloc(clients, sizeof(pthread_t));
+	double* latency = calloc((size_t)clients * n, sizeof(double));
+
+	double t = now();
+	for (int i = 0; i < clients; i++) {
+		c[i].path = argv[1];
+		c[i].expr = expr;
+		c[i].n = n;
+		c[i].latency = latency + (size_t)i * n;
+		if (pthread_create(&threads[i], NULL, run, &c[i]) != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (int i = 0; i < clients; i++) { pthread_join(threads[i], NULL); }
+	t = now() - t;
+
+	for (int i = 0; i < clients; i++) {
+		if (c[i].failed) {
+			fprintf(stderr, "client %d lost its connection\n", i);
+			return 1;
+		}
+	}
+
+	size_t total = (size_t)clients * n;
+	qsort(latency, total, sizeof(double), cmp);
+	printf("%s => %s\n", expr, c[0].last ? c[0].last : "");
+	printf("%d clients x %d requests\n", clients, n);
+	printf("%-24s %10.1f us\n", "p50 latency", latency[total / 2] * 1e6);
+	printf("%-24s %10.1f us\n", "p99 latency", latency[total * 99 / 100] * 1e6);
+	printf("%-24s %10.0f requests/s\n", "throughput", total / t);
+
+	for (int i = 0; i < clients; i++) { free(c[i].last); }
+	free(c);
+	free(threads);
+	free(latency);
+	return 0;
+}
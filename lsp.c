@@ -0,0 +1,4720 @@
+// Threads and clocks are POSIX, which -std=c99 only declares when asked for, as are anonymous
+// mappings and contexts for the stacks of generators
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+// #include with "" instead of <> searches local folder first
+#include "mpc.h"  // micro parser combinator lib
+#include <stddef.h>
+
+#include "lsp.h"      // public interface of this library
+#include "prelude.h"  // standard library source, generated from prelude.lsp
+
+// Memory mapped files for the prelude image, threads for parallel builtins and contexts for
+// generators, not available on Windows. Instead we provide fake substitutes for threads, so all
+// tasks run on one thread, and generators run on fibers
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <time.h>
+#include <ucontext.h>
+
+#else
+
+#include <windows.h>
+
+typedef int pthread_t;
+typedef int pthread_mutex_t;
+typedef int pthread_cond_t;
+typedef int pthread_rwlock_t;
+
+#define PTHREAD_MUTEX_INITIALIZER  0
+
+#define pthread_mutex_init(m, a)   ((void)0)
+#define pthread_mutex_destroy(m)   ((void)0)
+#define pthread_mutex_lock(m)      ((void)0)
+#define pthread_mutex_unlock(m)    ((void)0)
+#define pthread_cond_init(c, a)    ((void)0)
+#define pthread_cond_destroy(c)    ((void)0)
+#define pthread_cond_signal(c)     ((void)0)
+#define pthread_cond_broadcast(c)  ((void)0)
+#define pthread_cond_wait(c, m)    ((void)0)
+#define pthread_rwlock_init(l, a)  ((void)0)
+#define pthread_rwlock_destroy(l)  ((void)0)
+#define pthread_rwlock_rdlock(l)   ((void)0)
+#define pthread_rwlock_wrlock(l)   ((void)0)
+#define pthread_rwlock_unlock(l)   ((void)0)
+
+#endif
+
+// Sockets and epoll for the eval server, which is only available on Linux
+#ifdef __linux__
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#endif
+
+#if defined(__GNUC__)
+#define LSP_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define LSP_THREAD_LOCAL __declspec(thread)
+#else
+#define LSP_THREAD_LOCAL
+#endif
+
+char* ltype_name(int t) {
+	switch(t) {
+		case LVAL_NUM:   return "Number";
+		case LVAL_SYM:   return "Symbol";
+		case LVAL_BOOL:  return "Boolean";
+		case LVAL_ERR:   return "Error";
+		case LVAL_STR:   return "String";
+		case LVAL_FUN:   return "Function";
+		case LVAL_SEXPR: return "S-Expression";
+		case LVAL_QEXPR: return "Q-Expression";
+		case LVAL_FUT:   return "Future";
+		case LVAL_CHAN:  return "Channel";
+		case LVAL_GEN:   return "Generator";
+		case LVAL_SEQ:   return "Sequence";
+		default:         return "Unknown";
+	}
+}
+
+// Data Structures
+
+typedef struct lsp_future lsp_future;
+typedef struct lsp_chan lsp_chan;
+typedef struct lsp_gen lsp_gen;
+typedef struct lsp_seq lsp_seq;
+
+struct  lval {
+	int type;
+	
+	double num;       // Number / Boolean
+	char* sym;        // Symbol
+	char* err;        // Error
+	char* str;        // String
+	lbuiltin builtin; // Builtin function
+	lsp_future* fut;  // Future
+	lsp_chan* chan;   // Channel
+	lsp_gen* gen;     // Generator
+	lsp_seq* seq;     // Sequence
+	
+	// User-defined function
+	lenv* env;
+	lval* formals;
+	lval* body;
+	
+	// Expression
+	int count;
+	lval** cell;
+};
+
+struct lenv {
+	lenv* parent;
+	lsp_state* state;  // Interpreter owning a global environment, NULL for any other
+	int frozen;        // Set for global environments never changed again, see globals_freeze
+	int count;
+	char** syms;
+	lval** vals;
+};
+
+typedef struct {
+	char* name;
+	char* src;
+	size_t len;
+} prelude_def;
+
+typedef struct lsp_pool lsp_pool;
+
+struct lsp_state {
+	// Parsers
+	mpc_parser_t* number;
+	mpc_parser_t* symbol;
+	mpc_parser_t* string;
+	mpc_parser_t* comment;
+	mpc_parser_t* sexpr;
+	mpc_parser_t* qexpr;
+	mpc_parser_t* expr;
+	mpc_parser_t* form;
+	mpc_parser_t* lsp;
+	
+	// Global environment
+	lenv* env;
+	
+	// Prelude definitions not evaluated yet, and whether it came from the image
+	prelude_def* prelude_defs;
+	int prelude_defs_num;
+	int image;
+	
+	// Threads running parallel builtins, their interpreters point to the one owning the pool
+	lsp_pool* pool;
+	lsp_state* owner;
+	int worker;  // Index of the deque of the thread in the pool, 0 for the owner's
+};
+
+// Prelude image mapped by the first interpreter to load it, shared by all of them until the last
+// one is deleted. Values inside it are never freed. Interpreters on different threads map and
+// release it under image_lock, while lval_in_image reads where it is without taking the lock
+static char*  image_base = NULL;
+static size_t image_size = 0;
+static int    image_refs = 0;
+static pthread_mutex_t image_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int lval_in_image(lval* v) {
+#ifdef _WIN32
+	return (char*)v >= image_base && (char*)v < image_base + image_size;
+#else
+	char* base = __atomic_load_n(&image_base, __ATOMIC_ACQUIRE);
+	size_t size = __atomic_load_n(&image_size, __ATOMIC_RELAXED);
+	return base && (char*)v >= base && (char*)v < base + size;
+#endif
+}
+
+lval* lval_num(double x) {
+	// Constructor for number lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_NUM;
+	v->num = x;
+	return v;
+}
+
+lval* lval_sym(char* s) {
+	// Constructor for symbol lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_SYM;
+	v->sym = malloc(strlen(s)+1);
+	strcpy(v->sym, s);
+	return v;
+}
+
+lval* lval_bool(double x) {
+	// Constructor for boolean lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_BOOL;
+	v->num = x;
+	return v;
+}
+
+lval* lval_str(char* s) {
+	// Constructor for string lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_STR;
+	v->str = malloc(strlen(s)+1);
+	strcpy(v->str, s);
+	return v;
+}
+
+static lval* lval_builtin(lbuiltin func) {
+	// Constructor for builtin function lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_FUN;
+	v->builtin = func;
+	return v;
+}
+
+lval* lval_sexpr(void) {
+	// Constructor for S-expression lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_SEXPR;
+	v->count = 0;
+	v->cell = NULL;
+	return v;
+}
+
+lval* lval_qexpr(void) {
+	// Constructor for Q-expression lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_QEXPR;
+	v->count = 0;
+	v->cell = NULL;
+	return v;
+}
+
+lval* lval_err(char* fmt, ...) {
+	// Constructor for error lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_ERR;
+	
+	va_list va;
+	va_start(va, fmt);
+	
+	// Fixed 512B buffer
+	v->err = malloc(512);
+	
+	// printf the error string using the format string and arguments provided
+	vsnprintf(v->err, 511, fmt, va);
+	
+	// Reallocate to the actual size used
+	v->err = realloc(v->err, strlen(v->err)+1);
+	
+	va_end(va);
+	return v;
+}
+
+static lenv* lenv_new(void);
+
+static lval* lval_lambda(lval* formals, lval* body) {
+	// Constructor for user-defined function lval
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_FUN;
+	v->builtin = NULL;
+	v->env = lenv_new();
+	v->formals = formals;
+	v->body = body;
+	return v;
+}
+
+static lval* lval_future(lsp_future* f) {
+	// Constructor for future lval, taking over a reference to the future
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_FUT;
+	v->fut = f;
+	return v;
+}
+
+static lval* lval_chan(lsp_chan* c) {
+	// Constructor for channel lval, taking over a reference to the channel
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_CHAN;
+	v->chan = c;
+	return v;
+}
+
+static lval* lval_gen(lsp_gen* g) {
+	// Constructor for generator lval, taking over a reference to the generator
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_GEN;
+	v->gen = g;
+	return v;
+}
+
+static lval* lval_seq(lsp_seq* s) {
+	// Constructor for sequence lval, taking over a reference to the sequence
+	lval* v = malloc(sizeof(lval));
+	v->type = LVAL_SEQ;
+	v->seq = s;
+	return v;
+}
+
+static void future_ref(lsp_future* f, int n);
+static void chan_ref(lsp_chan* c, int n);
+static void gen_ref(lsp_gen* g, int n);
+static void seq_ref(lsp_seq* s, int n);
+
+static void lenv_del(lenv* env);
+
+void lval_del(lval* v) {
+	// Destructor for any kind of lval
+	if (lval_in_image(v)) { return; }
+	
+	switch (v->type) {
+		case LVAL_NUM: break;
+		case LVAL_BOOL: break;
+		case LVAL_FUN: 
+			if (!v->builtin) {
+				lenv_del(v->env);
+				lval_del(v->formals);
+				lval_del(v->body);
+			}
+			break;
+		case LVAL_SYM: free(v->sym); break;
+		case LVAL_ERR: free(v->err); break;
+		case LVAL_STR: free(v->str); break;
+		case LVAL_FUT: future_ref(v->fut, -1); break;
+		case LVAL_CHAN: chan_ref(v->chan, -1); break;
+		case LVAL_GEN: gen_ref(v->gen, -1); break;
+		case LVAL_SEQ: seq_ref(v->seq, -1); break;
+		case LVAL_QEXPR:
+		case LVAL_SEXPR:
+			for (int i = 0; i < v->count; i++) {
+				lval_del(v->cell[i]);
+			}
+			free(v->cell);
+			break;
+	}
+	free(v);
+}
+
+static lenv* lenv_copy(lenv* env);
+
+lval* lval_copy(lval* v) {
+	// Copies an lval and returns a pointer to the copy
+	
+	lval* x = malloc(sizeof(lval));
+	x->type = v->type;
+	
+	switch (v->type) {
+		case LVAL_BOOL:
+		case LVAL_NUM: x->num = v->num; break;
+		case LVAL_FUN:
+			if (v->builtin) {
+				x->builtin = v->builtin;
+			} else {
+				x->builtin = NULL;
+				x->env = lenv_copy(v->env);
+				x->formals = lval_copy(v->formals);
+				x->body = lval_copy(v->body);
+			}
+			break;
+		case LVAL_SYM:
+			x->sym = malloc(strlen(v->sym) + 1);
+			strcpy(x->sym, v->sym);
+			break;
+		case LVAL_ERR:
+			x->err = malloc(strlen(v->err) + 1);
+			strcpy(x->err, v->err);
+			break;
+		case LVAL_STR:
+			x->str = malloc(strlen(v->str) + 1);
+			strcpy(x->str, v->str);
+			break;
+		case LVAL_FUT:
+			// Shared, the result is only handed out once it is there
+			x->fut = v->fut;
+			future_ref(v->fut, 1);
+			break;
+		case LVAL_CHAN:
+			x->chan = v->chan;
+			chan_ref(v->chan, 1);
+			break;
+		case LVAL_GEN:
+			// Shared, pulling from a copy advances the original
+			x->gen = v->gen;
+			gen_ref(v->gen, 1);
+			break;
+		case LVAL_SEQ:
+			// Shared, it never changes
+			x->seq = v->seq;
+			seq_ref(v->seq, 1);
+			break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			x->count = v->count;
+			x->cell = malloc(sizeof(lval*) * x->count);
+			for (int i = 0; i < x->count; i++) {
+				x->cell[i] = lval_copy(v->cell[i]);
+			}
+			break;
+	}
+	
+	return x;
+}
+
+static double lval_eq(lval* x, lval* y) {
+	if (x->type != y->type) { return 0; }
+	
+	switch (x->type) {
+		case LVAL_BOOL: return (x->num ? y->num : !y->num);
+		case LVAL_NUM:  return (x->num == y->num);
+		case LVAL_SYM:  return (strcmp(x->sym, y->sym) == 0);
+		case LVAL_ERR:  return (strcmp(x->err, y->err) == 0);
+		case LVAL_STR:  return (strcmp(x->str, y->str) == 0);
+		case LVAL_FUT:  return (x->fut == y->fut);
+		case LVAL_CHAN: return (x->chan == y->chan);
+		case LVAL_GEN:  return (x->gen == y->gen);
+		case LVAL_SEQ:  return (x->seq == y->seq);
+		case LVAL_FUN:
+			if (x->builtin || y->builtin) {
+				return (x->builtin == y->builtin);
+			} else {
+				// user-defined functions on different scopes are the same
+				return (lval_eq(x->formals, y->formals)
+						&& lval_eq(x->formals, y->formals));
+			}
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			if (x->count != y->count) { return 0; }
+			for (int i = 0; i < x->count; i++) {
+				if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+			}
+			return 1;
+		break;
+	}
+	return 0;
+}
+
+lval* lval_add(lval* v, lval* x) {
+	// Appends an lval to an S-expression lval
+	v->count++;
+	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+	v->cell[v->count-1] = x;
+	return v;
+}
+
+static lval* lval_join(lval* v, lval* w) {
+	// Combines two S-expressions into one
+	for (int i = 0; i < w->count; i++) { v = lval_add(v, w->cell[i]); }
+	w->count = 0; lval_del(w);
+	// The above line deletes w but not its children since they now belong to v
+	// If it causes problems, we can use
+	// free(w->cell); free(w);
+	// which was used in the book and does not depend on lval_del, but I'm a bit conflicted about 
+	// it... reasoning being that if the deleter changes in the future in a way that does not
+	// account for this, we might run into hard to spot leaks and/or double frees
+	// This comment itself, sponsored by the double free I just found here ;)
+	return v;
+}
+
+lval* lval_pop(lval* v, int i) {
+	// Takes an element from an S-expression and shifts the list back
+	
+	// Find the element to extract
+	lval* w = v->cell[i];
+	
+	// Shift memory after the i-th element, decrease count and reallocate used memory
+	memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+	v->count--;
+	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+	return w;
+}
+
+lval* lval_take(lval* v, int i) {
+	// Takes an element from an S-expression and deletes the list
+	lval* w = lval_pop(v, i);
+	lval_del(v);
+	return w;
+}
+
+
+static void lval_cons(lval* v, lval* w) {
+	// Appends a value to the beginning of an S-expression
+	
+	// Allocate space for one more element on the list, shift to the right and increase count
+	w->cell = realloc(w->cell, sizeof(lval*) * w->count+1);
+	memmove(&w->cell[1], &w->cell[0], sizeof(lval*) * w->count);
+	w->count++;
+	
+	// Add element to the front
+	w->cell[0] = v;
+}
+
+static lenv* lenv_new(void) {
+	// Constructor for lenv
+	lenv* env = malloc(sizeof(lenv));
+	env->parent = NULL;
+	env->state = NULL;
+	env->frozen = 0;
+	env->count = 0;
+	env->syms = NULL;
+	env->vals = NULL;
+	return env;
+}
+
+static void lenv_del(lenv* env) {
+	// Destructor for lenv
+	for ( int i = 0; i < env->count; i++) {
+		free(env->syms[i]);
+		lval_del(env->vals[i]);
+	}
+	free(env->syms);
+	free(env->vals);
+	free(env);
+}
+
+static lenv* lenv_copy(lenv* env) {
+	lenv* new_env = malloc(sizeof(lenv));
+	new_env->parent = env->parent;
+	new_env->state  = env->state;
+	new_env->frozen = 0;
+	new_env->count  = env->count;
+	new_env->syms = malloc(sizeof(char*) * new_env->count);
+	new_env->vals = malloc(sizeof(lval*) * new_env->count);
+	for (int i = 0; i < env->count; i++) {
+		new_env->syms[i] = malloc(strlen(env->syms[i]) + 1);
+		strcpy(new_env->syms[i], env->syms[i]);
+		new_env->vals[i] = lval_copy(env->vals[i]);
+	}
+	return new_env;
+}
+
+static int prelude_force(lsp_state* state, char* name);
+
+static int  pool_lock(lenv* env, int write);
+static void pool_unlock(lenv* env);
+
+static lval* lenv_get(lenv* env, lval* key) {
+	// Searches for a given symbol in an environment, returns it if found
+	
+	int locked = pool_lock(env, 0);
+	for (int i = 0; i < env->count; i++) {
+		if (strcmp(env->syms[i], key->sym) == 0) {
+			lval* v = lval_copy(env->vals[i]);
+			if (locked) { pool_unlock(env); }
+			return v;
+		}
+	}
+	if (locked) { pool_unlock(env); }
+	
+	if (env->parent) { return lenv_get(env->parent, key); }
+	
+	// Prelude definitions are only evaluated once first looked up
+	if (prelude_force(env->state, key->sym)) { return lenv_get(env, key); }
+	else {                                     return lval_err("Unbound symbol '%s'", key->sym); }
+}
+
+static void lenv_put(lenv* env, lval* key, lval* value) {
+	// Inserts a variable (identifier-value pair) of lvals into an environment
+	
+	int locked = pool_lock(env, 1);
+	
+	// Check to see if the variable already exists
+	// If it does, replace it with the new value
+	for (int i = 0; i < env->count; i++) {
+		if (strcmp(env->syms[i], key->sym) == 0) {
+			lval_del(env->vals[i]);
+			env->vals[i] = lval_copy(value);
+			if (locked) { pool_unlock(env); }
+			return;
+		}
+	}
+	
+	// If variable does not exist, allocate and copy into the environment
+	env->count++;
+	env->vals = realloc(env->vals, sizeof(lval*) * env->count);
+	env->syms = realloc(env->syms, sizeof(char*) * env->count);
+	
+	env->vals[env->count-1] = lval_copy(value);
+	env->syms[env->count-1] = malloc(strlen(key->sym)+1);
+	strcpy(env->syms[env->count-1], key->sym);
+	
+	if (locked) { pool_unlock(env); }
+}
+
+lsp_state* lenv_state(lenv* env) {
+	// Interpreter an environment belongs to, found through its global environment
+	while (!env->state && env->parent) { env = env->parent; }
+	return env->state;
+}
+
+static void lenv_def(lenv* env, lval* key, lval* value) {
+	// Put a variable in the global environment, which for a pool thread is the one of its task
+	while (!env->state && env->parent) { env = env->parent; }
+	lenv_put(env, key, value);
+}
+
+// Printing
+
+// A value is written out into a buffer, on the stack unless it is long, which then goes to stdout
+// in a single call instead of a call per piece of it
+
+typedef struct {
+	char* data;
+	size_t len, size;
+	char local[256];
+} lval_text;
+
+static void text_add(lval_text* t, char* s, size_t n) {
+	// Append n bytes of s
+	if (t->len + n > t->size) {
+		t->size = (t->len + n) * 2;
+		char* data = malloc(t->size);
+		memcpy(data, t->data, t->len);
+		if (t->data != t->local) { free(t->data); }
+		t->data = data;
+	}
+	memcpy(t->data + t->len, s, n);
+	t->len += n;
+}
+
+static void text_puts(lval_text* t, char* s) { text_add(t, s, strlen(s)); }
+static void text_putc(lval_text* t, char c)  { text_add(t, &c, 1); }
+
+static void text_init(lval_text* t) {
+	t->data = t->local;
+	t->len = 0;
+	t->size = sizeof(t->local);
+}
+
+static void text_free(lval_text* t) {
+	if (t->data != t->local) { free(t->data); }
+}
+
+// Where print writes instead of stdout while a server request is evaluated. The pool tasks the
+// request starts write there too, from any thread, so it is locked, and it is shared by them and
+// the request until the last one is done with it. Once the request is answered it is closed, and
+// what futures still running print afterwards is dropped
+
+typedef struct {
+	lval_text text;
+	pthread_mutex_t lock;
+	int refs;
+	int open;
+} print_sink;
+
+// Sink of the task running on this thread, if any
+static LSP_THREAD_LOCAL print_sink* print_capture;
+
+static print_sink* sink_new(void) {
+	print_sink* sink = malloc(sizeof(print_sink));
+	text_init(&sink->text);
+	pthread_mutex_init(&sink->lock, NULL);
+	sink->refs = 1;
+	sink->open = 1;
+	return sink;
+}
+
+static print_sink* sink_ref(print_sink* sink, int n) {
+	// Add n references to a sink, which may be NULL, freeing it after the last one
+	if (!sink) { return NULL; }
+	pthread_mutex_lock(&sink->lock);
+	int refs = sink->refs += n;
+	pthread_mutex_unlock(&sink->lock);
+	if (refs > 0) { return sink; }
+	text_free(&sink->text);
+	pthread_mutex_destroy(&sink->lock);
+	free(sink);
+	return NULL;
+}
+
+static void sink_close(print_sink* sink, lval_text* t) {
+	// Append what was printed to t, dropping what is printed from now on
+	pthread_mutex_lock(&sink->lock);
+	text_add(t, sink->text.data, sink->text.len);
+	sink->open = 0;
+	pthread_mutex_unlock(&sink->lock);
+}
+
+static void lval_write(lval_text* t, lval* v);
+
+static void lval_write_str(lval_text* t, lval* v) {
+	char* escaped = malloc(strlen(v->str)+1);
+	strcpy(escaped, v->str);
+	escaped = mpcf_escape(escaped);
+	text_putc(t, '"');
+	text_puts(t, escaped);
+	text_putc(t, '"');
+	free(escaped);
+}
+
+static void lval_write_fun(lval_text* t, lval* v) {
+	if (v->builtin) {
+		text_puts(t, "builtin function");
+	} else {
+		text_puts(t, "function (");
+		lval_write(t, v->formals);
+		text_puts(t, " -> ");
+		// TODO: if function is curried, print bound arguments as their values and not their names
+		// Simpler alternative: print the function's env after the function's expression
+		lval_write(t, v->body);
+		text_putc(t, ')');
+	}
+}
+
+static void lval_write_expr(lval_text* t, lval* v, char open, char close) {
+	text_putc(t, open);
+	for (int i = 0; i < v->count; i++) {
+		lval_write(t, v->cell[i]);
+		if (i != (v->count-1)) { text_putc(t, ' '); }
+	}
+	text_putc(t, close);
+}
+
+static void lval_write(lval_text* t, lval* v) {
+	char num[32];
+	switch (v->type) {
+		case LVAL_NUM:
+			snprintf(num, sizeof(num), "%g", v->num);
+			text_puts(t, num);
+			break;
+		case LVAL_ERR:
+			text_puts(t, "Error: ");
+			text_puts(t, v->err);
+			break;
+		case LVAL_BOOL:  text_puts(t, v->num ? "true" : "false"); break;
+		case LVAL_SYM:   text_puts(t, v->sym);                    break;
+		case LVAL_STR:   lval_write_str(t, v);                    break;
+		case LVAL_FUN:   lval_write_fun(t, v);                    break;
+		case LVAL_SEXPR: lval_write_expr(t, v, '(', ')');         break;
+		case LVAL_QEXPR: lval_write_expr(t, v, '{', '}');         break;
+		case LVAL_FUT:   text_puts(t, "future");                  break;
+		case LVAL_CHAN:  text_puts(t, "channel");                 break;
+		case LVAL_GEN:   text_puts(t, "generator");               break;
+		case LVAL_SEQ:   text_puts(t, "sequence");                break;
+	}
+}
+
+static void print_text(char* s, size_t len) {
+	// Write to stdout, or to the sink of the task running on this thread
+	print_sink* sink = print_capture;
+	if (!sink) {
+		fwrite(s, 1, len, stdout);
+		return;
+	}
+	pthread_mutex_lock(&sink->lock);
+	if (sink->open) { text_add(&sink->text, s, len); }
+	pthread_mutex_unlock(&sink->lock);
+}
+
+static void lval_print_end(lval* v, char end) {
+	// Print v followed by end, unless it is NUL
+	lval_text t;
+	text_init(&t);
+	lval_write(&t, v);
+	if (end) { text_putc(&t, end); }
+	print_text(t.data, t.len);
+	text_free(&t);
+}
+
+void lval_print(lval* v)   { lval_print_end(v, '\0'); }
+void lval_println(lval* v) { lval_print_end(v, '\n'); }
+
+static void lenv_print(lenv* env) {
+	// Prints all named values in the environment
+	lval_text t;
+	text_init(&t);
+	text_puts(&t, "Bound values:\n");
+	for (int i = 0; i < env->count; i++) {
+		text_puts(&t, ltype_name(env->vals[i]->type));
+		text_putc(&t, ' ');
+		text_puts(&t, env->syms[i]);
+		text_putc(&t, '\n');
+	}
+	print_text(t.data, t.len);
+	text_free(&t);
+}
+
+// Builtins
+
+// The following preprocessor macros create error checking code blocks
+#define LASSERT(args, cond, fmt, ...) \
+	if (!(cond)) { \
+		lval* error = lval_err(fmt, ##__VA_ARGS__); \
+		lval_del(args); \
+		return error; \
+}
+
+#define LASSERT_TYPE(func, args, index, expected) \
+	LASSERT(args, args->cell[index]->type == expected, \
+		"Function '%s' passed incorrect type for argument %i. Expected %s, was given %s", \
+		func, index, ltype_name(expected), ltype_name(args->cell[index]->type));
+
+#define LASSERT_NUM(func, args, n) \
+	LASSERT(args, args->count == n, \
+		"Function '%s' passed incorrect number of arguments. Expected %i, was given %i", \
+		func, n, args->count);
+
+#define LASSERT_NON_EMPTY(func, args, index) \
+	LASSERT(args, args->cell[index]->count != 0, \
+		"Function '%s' passed empty %s, must contain at least one element", \
+		func, ltype_name(args->cell[index]->type));
+
+static lval* seq_list(lenv* env, lval* v, char* func);
+static int seq_endless(lsp_seq* s);
+
+// Sequences are lazy lists, an argument given one where a list is expected gets its values
+#define LFORCE_SEQ(env, func, args, index) \
+	if (args->cell[index]->type == LVAL_SEQ) { \
+		args->cell[index] = seq_list(env, args->cell[index], func); \
+		if (args->cell[index]->type == LVAL_ERR) { return lval_take(args, index); } \
+	}
+
+#define LASSERT_LIST(env, func, args, index) \
+	LFORCE_SEQ(env, func, args, index) \
+	LASSERT_TYPE(func, args, index, LVAL_QEXPR);
+
+static lval* lval_eval(lenv* env, lval* v);
+
+static lval* builtin_lambda(lenv* env, lval* args) {
+	// Builtin function "lambda": Takes a list of arguments and a body in a Q-expression and
+	// generates the proper function lval
+	
+	LASSERT_NUM("lambda", args, 2);
+	LASSERT_TYPE("lambda", args, 0, LVAL_QEXPR);
+	LASSERT_TYPE("lambda", args, 1, LVAL_QEXPR);
+	
+	// Formal arguments can only be symbols
+	for (int i = 0; i < args->cell[0]->count; i++) {
+		LASSERT(args, (args->cell[0]->cell[i]->type == LVAL_SYM),
+			"Function cannot take non-%s as argument, was given %s",
+			ltype_name(LVAL_SYM), ltype_name(args->cell[0]->cell[i]->type));
+	}
+	
+	lval* formals = lval_pop(args, 0);
+	lval* body = lval_pop(args, 0);
+	lval_del(args);
+	
+	return lval_lambda(formals, body);
+}
+
+static lval* builtin_list(lenv* env, lval* args) {
+	// Builtin function "list": Takes an S-expression and converts it to a Q-expression
+	args->type = LVAL_QEXPR;
+	return args;
+}
+
+static lval* seq_head(lenv* env, lval* v);
+
+static lval* builtin_head(lenv* env, lval* args) {
+	// Builtin function "head": Takes a Q-expression and returns the first element
+	
+	LASSERT_NUM("head", args, 1);
+	if (args->cell[0]->type == LVAL_SEQ) { return seq_head(env, lval_take(args, 0)); }
+	LASSERT_TYPE("head", args, 0, LVAL_QEXPR);
+	LASSERT_NON_EMPTY("head", args, 0);
+	
+	lval* v = lval_take(args, 0);
+	while (v->count > 1) { lval_del(lval_pop(v, 1)); }
+	return v;
+}
+
+static lval* builtin_tail(lenv* env, lval* args) {
+	// Builtin function "tail": Takes a Q-expression, removes the first element and returns it
+	
+	LASSERT_NUM("tail", args, 1);
+	LASSERT_LIST(env, "tail", args, 0);
+	LASSERT_NON_EMPTY("tail", args, 0);
+	
+	lval* v = lval_take(args, 0);
+	lval_del(lval_pop(v, 0));
+	return v;
+}
+
+static lval* builtin_eval(lenv* env, lval* args) {
+	//  Builtin function "eval": Takes a Q-expression and evaluates it as if it were an S-expression
+	
+	LASSERT_NUM("eval", args, 1)
+	LASSERT_TYPE("eval", args, 0, LVAL_QEXPR);
+	
+	lval* v = lval_take(args, 0);
+	v->type = LVAL_SEXPR;
+	return lval_eval(env, v);
+}
+
+static lval* builtin_join(lenv* env, lval* args) {
+	// Builtin function "join": Takes several Q-expression and concatenates them into a single one
+	
+	for (int i = 0; i < args->count; i++) {
+		LASSERT_LIST(env, "join", args, i);
+	}
+	
+	lval* v = lval_pop(args, 0);
+	while (args->count) { v = lval_join(v, lval_pop(args, 0)); }
+	
+	lval_del(args);
+	return v;
+}
+
+static lval* builtin_var(lenv* env, lval* args, char* func) {
+	
+	LASSERT_TYPE(func, args, 0, LVAL_QEXPR);
+	
+	// First argument is the list of symbols
+	lval* syms = args->cell[0];
+	
+	for (int i = 0; i < syms->count; i++) {
+		LASSERT(args, (syms->cell[i]->type == LVAL_SYM),
+			"Function '%s' cannot define non-symbols. Expected %s, was given %s",
+			func, ltype_name(LVAL_SYM), ltype_name(syms->cell[i]->type));
+	}
+	
+	LASSERT(args, (syms->count == args->count-1),
+		"Function '%s' cannot define mismatched number of values to symbols. "
+		"Was given %i symbol(s) but %i value(s).",
+		func, syms->count, args->count-1);
+	
+	for (int i = 0; i < syms->count; i++) {
+		if (strcmp(func, "def") == 0) { lenv_def(env, syms->cell[i], args->cell[i+1]); }
+		if (strcmp(func, "=")   == 0) { lenv_put(env, syms->cell[i], args->cell[i+1]); }
+	}
+	
+	lval_del(args);
+	return lval_sexpr();  // On success, return empty list
+}
+
+static lval* builtin_def(lenv* env, lval* args) {
+	// Builtin function "def": Takes symbol and value lists and registers each pair
+	// to the outermost environment
+	return builtin_var(env, args, "def");
+}
+
+static lval* builtin_put(lenv* env, lval* args) {
+	// Builtin function "=": Takes symbol and value lists and registers each pair
+	// to the environment
+	return builtin_var(env, args, "=");
+}
+
+static lval* builtin_fun(lenv* env, lval* args) {
+	// Builtin function "fun": Takes a name, argument Q-expression and body Q-expression and
+	// defines that function. Same as combining def and lambda
+	
+	LASSERT_NUM("fun", args, 2)
+	LASSERT_TYPE("fun", args, 0, LVAL_QEXPR);
+	LASSERT_TYPE("fun", args, 1, LVAL_QEXPR);
+	
+	// First element of first list must be the name of the function i.e. a symbol
+	LASSERT(args, (args->cell[0]->count >= 1), "Invalid function definition. Must give a name");
+	LASSERT(args, (args->cell[0]->cell[0]->type == LVAL_SYM),
+		"Invalid function definition. "
+		"First element of argument 0 (function name) must be %s, was given %s",
+		ltype_name(LVAL_SYM), ltype_name(args->cell[0]->type));
+	
+	// Formal arguments can only be symbols
+	for (int i = 1; i < args->cell[0]->count; i++) {
+		LASSERT(args, (args->cell[0]->cell[i]->type == LVAL_SYM),
+			"Function cannot take non-%s as argument, was given %s",
+			ltype_name(LVAL_SYM), ltype_name(args->cell[0]->cell[i]->type));
+	}
+	
+	// Get the name and wrap it into a Q-expression
+	lval* syms = lval_qexpr();
+	lval_add(syms, lval_pop(args->cell[0], 0));
+	
+	// Wrap the name and function into an S-expression for builtin_def
+	lval* def_args = lval_sexpr();
+	lval_add(def_args, syms);
+	lval_add(def_args, builtin_lambda(env, args));
+	
+	return builtin_def(env, def_args);
+}
+
+static lval* builtin_init(lenv* env, lval* args) {
+	// Builtin function "init": Takes a Q-expression, removes the last element and returns it
+	
+	LASSERT_NUM("init", args, 1);
+	LASSERT_LIST(env, "init", args, 0);
+	LASSERT_NON_EMPTY("init", args, 0);
+	
+	lval* v = lval_take(args, 0);
+	lval_del(lval_pop(v, v->count - 1));
+	return v;
+}
+
+static lval* builtin_cons(lenv* env, lval* args) {
+	// Builtin function "cons": Takes a value and a Q-expression and appends it to the front
+	
+	LASSERT_NUM("cons", args, 2)
+	LASSERT_LIST(env, "cons", args, 1);
+	
+	lval* v = lval_pop(args, 1);
+	lval_cons(lval_take(args, 0), v);
+	return v;
+}
+
+static lval* builtin_len(lenv* env, lval* args) {
+	// Builtin function "len": Takes a Q-expression and returns a number lval with its length
+	
+	LASSERT_NUM("len", args, 1)
+	LASSERT_LIST(env, "len", args, 0);
+	
+	lval* result = lval_num((double)args->cell[0]->count);
+	lval_del(args);
+	return result;
+}
+
+static lval* builtin_op(lenv* env, lval* args, char* op) {
+	// Apply a builtin arithmetic function to a list of arguments
+	
+	// Ensure all arguments are number lvals
+	for (int i = 0; i < args->count; i++) {
+		LASSERT_TYPE(op, args, i, LVAL_NUM);
+	}
+	
+	lval* x = lval_pop(args, 0);
+	
+	// Perform unary negation if applicable
+	if ((strcmp(op, "-") == 0) && args->count == 0) { x->num = -x->num; }
+	
+	// fold operation over all arguments
+	while (args->count > 0) {
+		lval* y = lval_pop(args, 0);
+		if (strcmp(op, "+") == 0) { x->num += y->num; }
+		if (strcmp(op, "-") == 0) { x->num -= y->num; }
+		if (strcmp(op, "*") == 0) { x->num *= y->num; }
+		if (strcmp(op, "/") == 0) {
+			if (y->num == 0) {
+				lval_del(x); lval_del(y);
+				x = lval_err("Division by zero");
+				break;
+			}
+			x->num /= y->num;
+		}
+		if (strcmp(op, "%") == 0) {
+			if (y->num == 0) {
+				lval_del(x); lval_del(y);
+				x = lval_err("Remainder on division by zero");
+				break;
+			}
+			x->num = remainder(x->num, y->num);
+		}
+		lval_del(y);
+	}
+	
+	lval_del(args);
+	return x;
+}
+
+static lval* builtin_add(lenv* env, lval* args) { return builtin_op(env, args, "+"); }
+static lval* builtin_sub(lenv* env, lval* args) { return builtin_op(env, args, "-"); }
+static lval* builtin_mul(lenv* env, lval* args) { return builtin_op(env, args, "*"); }
+static lval* builtin_div(lenv* env, lval* args) { return builtin_op(env, args, "/"); }
+static lval* builtin_mod(lenv* env, lval* args) { return builtin_op(env, args, "%"); }
+
+static lval* builtin_ord(lenv* env, lval* args, char* op) {
+	// Builtin order comparison operators: Test for order between two number lvals
+	
+	LASSERT_NUM(op, args, 2);
+	LASSERT_TYPE(op, args, 0, LVAL_NUM);
+	LASSERT_TYPE(op, args, 1, LVAL_NUM);
+	
+	double result;
+	if (strcmp(op, ">")  == 0) { result = (args->cell[0]->num >  args->cell[1]->num); }
+	if (strcmp(op, "<")  == 0) { result = (args->cell[0]->num <  args->cell[1]->num); }
+	if (strcmp(op, ">=") == 0) { result = (args->cell[0]->num >= args->cell[1]->num); }
+	if (strcmp(op, "<=") == 0) { result = (args->cell[0]->num <= args->cell[1]->num); }
+	
+	lval_del(args);
+	return lval_bool(result);
+}
+
+static lval* builtin_gt(lenv* env, lval* args) { return builtin_ord(env, args, ">");  }
+static lval* builtin_lt(lenv* env, lval* args) { return builtin_ord(env, args, "<");  }
+static lval* builtin_ge(lenv* env, lval* args) { return builtin_ord(env, args, ">="); }
+static lval* builtin_le(lenv* env, lval* args) { return builtin_ord(env, args, "<="); }
+
+static lval* builtin_cmp(lenv* env, lval* args, char* op) {
+	// Builtin (non-)equailty operators: Test for equality for two lvals
+	
+	LASSERT_NUM(op, args, 2);
+	
+	// Sequences are equal to the lists of their values, an endless one to none
+	for (int i = 0; i < 2; i++) {
+		if (args->cell[i]->type == LVAL_SEQ && !seq_endless(args->cell[i]->seq)) {
+			LFORCE_SEQ(env, op, args, i);
+		}
+	}
+	
+	double result = lval_eq(args->cell[0], args->cell[1]);
+	if (strcmp(op, "!=") == 0) { result = !result; }
+	
+	lval_del(args);
+	return lval_bool(result);
+}
+
+static lval* builtin_eq(lenv* env, lval* args) { return builtin_cmp(env, args, "=="); }
+static lval* builtin_ne(lenv* env, lval* args) { return builtin_cmp(env, args, "!="); }
+
+static lval* builtin_logical(lenv* env, lval* args, char* op) {
+	// Builtin logical operators: Apply to one or more boolean lvals
+	
+	for (int i = 0; i < args->count; i++) {
+		LASSERT_TYPE(op, args, i, LVAL_BOOL);
+	}
+	
+	double res;
+	
+	if (strcmp(op, "!") == 0) {
+		LASSERT_NUM(op, args, 1);
+		res = (! args->cell[0]->num);
+	}
+	
+	if (strcmp(op, "||") == 0) {
+		res = 0;
+		for (int i = 0; i < args->count; i++) {
+			res = res || args->cell[i]->num;
+		}
+	}
+	
+	if (strcmp(op, "&&") == 0) {
+		res = 1;
+		for (int i = 0; i < args->count; i++) {
+			res = res && args->cell[i]->num;
+		}
+	}
+	
+	lval_del(args);
+	return lval_bool(res);
+}
+
+static lval* builtin_or(lenv* env,  lval* args) { return builtin_logical(env, args, "||"); }
+static lval* builtin_and(lenv* env, lval* args) { return builtin_logical(env, args, "&&"); }
+static lval* builtin_not(lenv* env, lval* args) { return builtin_logical(env, args, "!");  }
+
+static lval* builtin_if(lenv* env, lval* args) {
+	// Builtin function "if": Basic 'if cond then else' statement, where 'cond' is a number lval and
+	// 'then' and 'else' are Q-Expressions that are evaluated based on whether cond is zero (False)
+	// or not (True)
+	
+	LASSERT_NUM("if", args, 3);
+	LASSERT_TYPE("if", args, 0, LVAL_BOOL);
+	LASSERT_TYPE("if", args, 1, LVAL_QEXPR);
+	LASSERT_TYPE("if", args, 2, LVAL_QEXPR);
+	
+	lval* x;
+	if (args->cell[0]->num) {
+		args->cell[1]->type = LVAL_SEXPR;
+		x = lval_eval(env, lval_pop(args, 1));
+	} else {
+		args->cell[2]->type = LVAL_SEXPR;
+		x = lval_eval(env, lval_pop(args, 2));
+	}
+	
+	lval_del(args);
+	return x;
+}
+
+static lval* builtin_print_env(lenv* env, lval* args) {
+	// Builtin function "env": prints all named values in the environment
+	lenv_print(env);
+	return lval_sexpr();
+}
+
+static lval* lval_read(mpc_ast_t* t);
+
+typedef struct module_writer module_writer;
+
+static int module_load(lenv* env, char* filename);
+static module_writer* module_new(char* filename);
+static void module_add(module_writer* m, lval* expr);
+static void module_end(module_writer* m, int ok);
+
+static void lval_eval_forms(lenv* env, lval* expr) {
+	// Evaluate each expression read from a script, printing any errors, then delete the list
+	while (expr->count) {
+		lval* x = lval_eval(env, lval_pop(expr, 0));
+		if (x->type == LVAL_ERR) { lval_println(x); }
+		lval_del(x);
+	}
+	lval_del(expr);
+}
+
+static lval* builtin_load(lenv* env, lval* args) {
+	// Builtin function "load": Takes a string with a file name and imports it as an Lsp script
+	// On success, return empty list, otherwise print any errors
+	
+	LASSERT_NUM("load", args, 1);
+	LASSERT_TYPE("load", args, 0, LVAL_STR);
+	
+	char* filename = args->cell[0]->str;
+	int piped = strcmp(filename, "-") == 0;
+	
+	// Skip parsing if the script has an up to date compiled module
+	if (!piped && module_load(env, filename)) {
+		lval_del(args);
+		return lval_sexpr();
+	}
+	
+	// Open the script, the name "-" reads it from standard input
+	mpc_stream_t* in = piped
+		? mpc_stream_pipe("<stdin>", stdin)
+		: mpc_stream_contents(filename);
+	
+	// Compile a module for next time while reading
+	module_writer* m = piped ? NULL : module_new(filename);
+	
+	// Parse and evaluate one top level expression at a time
+	mpc_result_t r;
+	while (!mpc_stream_end(in)) {
+		
+		if (!mpc_stream_next(in, lenv_state(env)->form, &r)) {
+			
+			// Parsing error, print it
+			char* err_msg = mpc_err_string(r.error);
+			mpc_err_delete(r.error);
+			mpc_stream_delete(in);
+			module_end(m, 0);
+			
+			// Return an error lval
+			lval* err = lval_err("Could not load library %s", err_msg);
+			free(err_msg);
+			lval_del(args);
+			return err;
+		}
+		
+		// Read AST, an empty list for a comment or trailing whitespace
+		lval* expr = lval_read(r.output);
+		mpc_ast_delete(r.output);
+		
+		// Evaluate it
+		module_add(m, expr);
+		lval_eval_forms(env, expr);
+	}
+	
+	mpc_stream_delete(in);
+	module_end(m, 1);
+	lval_del(args);
+	return lval_sexpr();
+}
+
+static lval* seq_lists(lenv* env, lval* v);
+
+static lval* builtin_print(lenv* env, lval* args) {
+	// Builtin function "print": Prints each argument to stdout, separated by spaces
+	
+	// Written as a whole, so that lines printed by other threads do not end up inside it
+	lval_text t;
+	text_init(&t);
+	for (int i = 0; i < args->count; i++) {
+		args->cell[i] = seq_lists(env, args->cell[i]);
+		lval_write(&t, args->cell[i]);
+		if (i < args->count - 1) { text_putc(&t, ' '); }
+	}
+	text_putc(&t, '\n');
+	print_text(t.data, t.len);
+	text_free(&t);
+	
+	lval_del(args);
+	return lval_sexpr();
+}
+
+static lval* builtin_error(lenv* env, lval* args) {
+	// Builtin function "error": Generates an error lval with a custom error message
+	
+	LASSERT_NUM("error", args, 1);
+	LASSERT_TYPE("error", args, 0, LVAL_STR);
+	
+	lval* error = lval_err(args->cell[0]->str);
+	
+	lval_del(args);
+	return error;
+}
+
+static lval* builtin_read(lenv* env, lval* args) {
+	// Builtin function "read": Converts a string into a Q-expression
+	
+	LASSERT_NUM("read", args, 1);
+	LASSERT_TYPE("read", args, 0, LVAL_STR);
+	
+	// Parse string contents in place
+	mpc_result_t r;
+	char* str = args->cell[0]->str;
+	if (mpc_nparse_borrow("<string>", str, strlen(str), lenv_state(env)->lsp, &r)) {
+		
+		// Read AST
+		lval* expr = lval_read(r.output);
+		mpc_ast_delete(r.output);
+		
+		// Return AST as a Q-expression
+		expr->type = LVAL_QEXPR;
+		return expr;
+		
+	} else {
+		
+		// Parsing error, print it
+		char* err_msg = mpc_err_string(r.error);
+		mpc_err_delete(r.error);
+		
+		// Return an error lval
+		lval* err = lval_err("Could not read expression %s", err_msg);
+		free(err_msg);
+		lval_del(args);
+		return err;
+	}
+}
+
+static lval* builtin_show(lenv* env, lval* args) {
+	// Builtin function "show": Print the contents of a string as is i.e. unescaped
+	
+	LASSERT_NUM("show", args, 1);
+	LASSERT_TYPE("show", args, 0, LVAL_STR);
+	
+	print_text("\"", 1);
+	print_text(args->cell[0]->str, strlen(args->cell[0]->str));
+	print_text("\"\n", 2);
+	lval_del(args);
+	return lval_sexpr();
+}
+
+static void lenv_add_builtin(lenv* env, char* name, lbuiltin func) {
+	lval* k = lval_sym(name);
+	lval* v = lval_builtin(func);
+	lenv_put(env, k, v);
+	// lenv_put registers copies of the passed values so we must delete them now
+	lval_del(k); lval_del(v);
+}
+
+static lval* builtin_pmap(lenv* env, lval* args);
+static lval* builtin_pfilter(lenv* env, lval* args);
+static lval* builtin_preduce(lenv* env, lval* args);
+static lval* builtin_spawn(lenv* env, lval* args);
+static lval* builtin_await(lenv* env, lval* args);
+static lval* builtin_freeze(lenv* env, lval* args);
+static lval* builtin_chan(lenv* env, lval* args);
+static lval* builtin_send(lenv* env, lval* args);
+static lval* builtin_recv(lenv* env, lval* args);
+static lval* builtin_close(lenv* env, lval* args);
+static lval* builtin_gen(lenv* env, lval* args);
+static lval* builtin_yield(lenv* env, lval* args);
+static lval* builtin_next(lenv* env, lval* args);
+static lval* builtin_gen_range(lenv* env, lval* args);
+static lval* builtin_gen_map(lenv* env, lval* args);
+static lval* builtin_gen_filter(lenv* env, lval* args);
+static lval* builtin_gen_take(lenv* env, lval* args);
+static lval* builtin_gen_foldl(lenv* env, lval* args);
+static lval* builtin_gen_each(lenv* env, lval* args);
+static lval* builtin_gen_list(lenv* env, lval* args);
+static lval* builtin_range(lenv* env, lval* args);
+static lval* builtin_range_from(lenv* env, lval* args);
+static lval* builtin_iterate(lenv* env, lval* args);
+static lval* builtin_is_seq(lenv* env, lval* args);
+static lval* builtin_seq_map(lenv* env, lval* args);
+static lval* builtin_seq_filter(lenv* env, lval* args);
+static lval* builtin_seq_take(lenv* env, lval* args);
+static lval* builtin_seq_take_while(lenv* env, lval* args);
+static lval* builtin_seq_drop(lenv* env, lval* args);
+static lval* builtin_seq_drop_while(lenv* env, lval* args);
+
+static void lenv_add_builtins(lenv* env) {
+	// Library functions
+	lenv_add_builtin(env, "load", builtin_load);
+
+	// Variable functions
+	lenv_add_builtin(env, "def", builtin_def);
+	lenv_add_builtin(env, "=",   builtin_put);
+	lenv_add_builtin(env, "lambda", builtin_lambda);
+	lenv_add_builtin(env, "fun", builtin_fun);
+	lenv_add_builtin(env, "env", builtin_print_env);
+	
+	// Comparison functions
+	lenv_add_builtin(env, "if", builtin_if);
+	lenv_add_builtin(env, "==", builtin_eq);
+	lenv_add_builtin(env, "!=", builtin_ne);
+	lenv_add_builtin(env, "<",  builtin_lt);
+	lenv_add_builtin(env, "<=", builtin_le);
+	lenv_add_builtin(env, ">",  builtin_gt);
+	lenv_add_builtin(env, ">=", builtin_ge);
+	
+	// Logical functions
+	lenv_add_builtin(env, "||", builtin_or);
+	lenv_add_builtin(env, "&&", builtin_and);
+	lenv_add_builtin(env, "!",  builtin_not);
+	
+	// Arithmetic functions
+	lenv_add_builtin(env, "+", builtin_add);
+	lenv_add_builtin(env, "-", builtin_sub);
+	lenv_add_builtin(env, "*", builtin_mul);
+	lenv_add_builtin(env, "/", builtin_div);
+	lenv_add_builtin(env, "%", builtin_mod);
+	
+	// List functions
+	lenv_add_builtin(env, "list", builtin_list);
+	lenv_add_builtin(env, "head", builtin_head);
+	lenv_add_builtin(env, "tail", builtin_tail);
+	lenv_add_builtin(env, "init", builtin_init);
+	lenv_add_builtin(env, "eval", builtin_eval);
+	lenv_add_builtin(env, "join", builtin_join);
+	lenv_add_builtin(env, "cons", builtin_cons);
+	lenv_add_builtin(env, "len",  builtin_len);
+	
+	// Parallel functions
+	lenv_add_builtin(env, "pmap",    builtin_pmap);
+	lenv_add_builtin(env, "pfilter", builtin_pfilter);
+	lenv_add_builtin(env, "preduce", builtin_preduce);
+	lenv_add_builtin(env, "spawn",   builtin_spawn);
+	lenv_add_builtin(env, "await",   builtin_await);
+	lenv_add_builtin(env, "freeze",  builtin_freeze);
+	
+	// Channels
+	lenv_add_builtin(env, "chan",  builtin_chan);
+	lenv_add_builtin(env, "send",  builtin_send);
+	lenv_add_builtin(env, "recv",  builtin_recv);
+	lenv_add_builtin(env, "close", builtin_close);
+	
+	// Generators
+	lenv_add_builtin(env, "gen",        builtin_gen);
+	lenv_add_builtin(env, "yield",      builtin_yield);
+	lenv_add_builtin(env, "next",       builtin_next);
+	lenv_add_builtin(env, "gen-range",  builtin_gen_range);
+	lenv_add_builtin(env, "gen-map",    builtin_gen_map);
+	lenv_add_builtin(env, "gen-filter", builtin_gen_filter);
+	lenv_add_builtin(env, "gen-take",   builtin_gen_take);
+	lenv_add_builtin(env, "gen-foldl",  builtin_gen_foldl);
+	lenv_add_builtin(env, "gen-each",   builtin_gen_each);
+	lenv_add_builtin(env, "gen-list",   builtin_gen_list);
+	
+	// Sequences
+	lenv_add_builtin(env, "range",          builtin_range);
+	lenv_add_builtin(env, "range-from",     builtin_range_from);
+	lenv_add_builtin(env, "iterate",        builtin_iterate);
+	lenv_add_builtin(env, "is-seq",         builtin_is_seq);
+	lenv_add_builtin(env, "seq-map",        builtin_seq_map);
+	lenv_add_builtin(env, "seq-filter",     builtin_seq_filter);
+	lenv_add_builtin(env, "seq-take",       builtin_seq_take);
+	lenv_add_builtin(env, "seq-take-while", builtin_seq_take_while);
+	lenv_add_builtin(env, "seq-drop",       builtin_seq_drop);
+	lenv_add_builtin(env, "seq-drop-while", builtin_seq_drop_while);
+	
+	// String functions
+	lenv_add_builtin(env, "print", builtin_print);
+	lenv_add_builtin(env, "error", builtin_error);
+	lenv_add_builtin(env, "read",  builtin_read);
+	lenv_add_builtin(env, "show",  builtin_show);
+}
+
+// Evaluation
+
+static lval* lval_call(lenv* env, lval* f, lval* args) {
+	// Evaluate a function lval with the given input arguments
+	
+	// If builtin, simply use the stored function pointer
+	if (f->builtin) { return f->builtin(env, args); }
+	
+	int given = args->count;
+	int total = f->formals->count;
+	
+	while (args->count) {
+		if (f->formals->count == 0) {
+			lval_del(args);
+			return lval_err("Function passed too many arguments. Expected %i, was given %i",
+							total, given);
+		}
+		// Bind the next formal argument to the next provided value
+		lval* sym = lval_pop(f->formals, 0);
+		
+		// Special case: variable length arguments
+		if (strcmp(sym->sym, "&") == 0) {
+			if (f->formals->count != 1) {
+				lval_del(args);
+				return lval_err("Invalid function call. "
+				                "'&' must be followed by a single symbol, got %i",
+				                f->formals->count);
+			}
+			// Next (i.e. the last) formal must be bound to the remaining arguments
+			lval* nsym = lval_pop(f->formals, 0);
+			lenv_put(f->env, nsym, builtin_list(env, args));
+			lval_del(sym); lval_del(nsym);
+			break;
+		}
+		
+		lval* val = lval_pop(args, 0);
+		lenv_put(f->env, sym, val);
+		lval_del(sym); lval_del(val);
+	}
+	
+	lval_del(args);
+	
+	// Handle variable arguments ('&') with 0 optional arguments passed by binding an empty list
+	if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+		if (f->formals->count != 2) {
+			return lval_err("Function format invalid. "
+			                "'&' must be followed by a single symbol, got %i",
+			                f->formals->count);
+		}
+		lval_del(lval_pop(f->formals, 0));
+		lval* sym = lval_pop(f->formals, 0);
+		lval* val = lval_qexpr();
+		lenv_put(f->env, sym, val);
+		lval_del(sym); lval_del(val);
+	}
+	
+	// If all formals have been bound then evaluate
+	if (f->formals->count == 0) {
+		f->env->parent = env;  // parent env in the function is the one from which it is called
+		return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+	} else { return lval_copy(f); /* Otherwise return partially evaluated function (currying) */ }
+}
+
+static int gen_cancelled(void);
+
+static lval* lval_eval_sexpr(lenv* env, lval* v) {
+	// A generator deleted while suspended evaluates nothing more, so that its stack unwinds
+	if (gen_cancelled()) {
+		lval_del(v);
+		return lval_err("Generator was deleted");
+	}
+	
+	// Evaluate children
+	for (int i = 0; i < v->count; i++) {
+		v->cell[i] = lval_eval(env, v->cell[i]);
+	}
+	
+	// Error checking
+	for (int i = 0; i < v->count; i++) {
+		if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+	}
+	
+	// Check for empty or single expression
+	if (v->count == 0) { return v; }
+	if (v->count == 1) { return lval_eval(env, lval_take(v, 0)); }
+	
+	// Ensure first element is a function after evaluation
+	lval* f = lval_pop(v, 0);
+	if (f->type != LVAL_FUN) {
+		lval* error = lval_err("S-expression starts with incorrect type. "
+							   "Expected %s, was given %s",
+							   ltype_name(LVAL_FUN), ltype_name(f->type));
+		lval_del(f); lval_del(v);
+		return error;
+	}
+	
+	// If so, call the function
+	lval* result = lval_call(env, f, v);
+	lval_del(f);
+	return result;
+}
+
+static lval* lval_eval(lenv* env, lval* v) {
+	// If it's a symbol, go fetch the corresponding value in the environment
+	if (v->type == LVAL_SYM) {
+		lval* x = lenv_get(env, v);
+		lval_del(v);
+		return x;
+	}
+	if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(env, v); }
+	return v;
+}
+
+// Reading
+
+static lval* lval_read_num(mpc_ast_t* t) {
+	errno = 0;
+	double x = strtod(t->contents, NULL);
+	if (errno != ERANGE) { return lval_num(x); }
+	else { return lval_err("Invalid number. could not parse %s to Number", t->contents); }
+}
+
+static lval* lval_read_str(mpc_ast_t* t) {
+	// Cut off the final quote character
+	t->contents[strlen(t->contents)-1] = '\0';
+	// Copy the string except the first quote character
+	char* unescaped = malloc(strlen(t->contents+1)+1);
+	strcpy(unescaped, t->contents+1);
+	
+	unescaped = mpcf_unescape(unescaped);
+	lval* str = lval_str(unescaped);
+	free(unescaped);
+	return str;
+}
+
+static lval* lval_read(mpc_ast_t* t) {
+
+	if (strstr(t->tag, "number")) { return lval_read_num(t); }
+	if (strstr(t->tag, "symbol")) {
+		if (strcmp(t->contents, "true")  == 0) { return lval_bool(1); }
+		if (strcmp(t->contents, "false") == 0) { return lval_bool(0); }
+		else { return lval_sym(t->contents); }
+	}
+	if (strstr(t->tag, "string")) { return lval_read_str(t); }
+	
+	// If root (>) or sexpr then create empty list
+	lval* v = NULL;
+	if (strcmp(t->tag, ">") == 0) { v = lval_sexpr(); }
+	if (strstr(t->tag, "sexpr"))  { v = lval_sexpr(); }
+	if (strstr(t->tag, "qexpr"))  { v = lval_qexpr(); }
+	
+	// Fill the list with any valid expression contained within
+	for (int i = 0; i < t->children_num; i++) {
+		if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
+		if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
+		if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
+		if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
+		if (strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
+		if (strstr(t->children[i]->tag, "comment"))     { continue; }
+		v = lval_add(v, lval_read(t->children[i]));
+	}
+	
+	return v;
+}
+
+static lval* lval_eval_source(lenv* env, char* filename, char* input, size_t len) {
+	// Parse all expressions in input and evaluate them as one, as typed into the REPL
+	mpc_result_t r;
+	if (!mpc_nparse_borrow(filename, input, len, lenv_state(env)->lsp, &r)) {
+		char* err_msg = mpc_err_string(r.error);
+		mpc_err_delete(r.error);
+		
+		// mpc ends its messages with a newline, lval_println adds its own
+		size_t n = strlen(err_msg);
+		if (n && err_msg[n-1] == '\n') { err_msg[n-1] = '\0'; }
+		
+		lval* err = lval_err("%s", err_msg);
+		free(err_msg);
+		return err;
+	}
+	
+	lval* expr = lval_read(r.output);
+	mpc_ast_delete(r.output);
+	return lval_eval(env, expr);
+}
+
+// Prelude
+
+// The standard library is compiled into the binary from prelude.h. On startup, expressions that
+// define a single name, "(fun {name ...} ...)" or "(def {name} ...)", are only recorded, then
+// parsed and evaluated the first time lenv_get cannot find that name. Anything else is
+// evaluated straight away
+
+static char* prelude_skip(char* s) {
+	// Skip whitespace and comments
+	while (1) {
+		while (*s && isspace((unsigned char)*s)) { s++; }
+		if (*s != ';') { return s; }
+		while (*s && *s != '\n') { s++; }
+	}
+}
+
+static char* prelude_end(char* s) {
+	// Find the end of the top level expression starting at s
+	int depth = 0;
+	while (*s) {
+		if (*s == '"') {
+			for (s++; *s && *s != '"'; s++) { if (*s == '\\' && s[1]) { s++; } }
+		} else if (*s == ';') {
+			while (s[1] && s[1] != '\n') { s++; }
+		} else if (*s == '(' || *s == '{') {
+			depth++;
+		} else if (*s == ')' || *s == '}') {
+			depth--;
+		} else if (depth <= 0 && isspace((unsigned char)*s)) {
+			return s;
+		}
+		
+		if (*s) { s++; }
+		if (depth <= 0 && (s[-1] == ')' || s[-1] == '}' || s[-1] == '"')) { return s; }
+	}
+	return s;
+}
+
+static char* prelude_name(char* s) {
+	// Name defined by "(fun {name ...} ...)" or "(def {name} ...)", NULL for anything else
+	
+	int def = strncmp(s, "(def", 4) == 0;
+	if (!def && strncmp(s, "(fun", 4) != 0) { return NULL; }
+	s += 4;
+	
+	if (!isspace((unsigned char)*s)) { return NULL; }
+	while (isspace((unsigned char)*s)) { s++; }
+	if (*s++ != '{') { return NULL; }
+	while (isspace((unsigned char)*s)) { s++; }
+	
+	char* name = s;
+	while (*s && (isalnum((unsigned char)*s) || strchr("_+-*/%\\=<>!|&", *s))) { s++; }
+	size_t n = s - name;
+	if (n == 0) { return NULL; }
+	
+	// Several names are defined at once, evaluate those right away
+	while (isspace((unsigned char)*s)) { s++; }
+	if (def && *s != '}') { return NULL; }
+	
+	char* copy = malloc(n + 1);
+	memcpy(copy, name, n);
+	copy[n] = '\0';
+	return copy;
+}
+
+static void prelude_eval(lsp_state* state, char* src, size_t len) {
+	mpc_result_t r;
+	if (mpc_nparse_borrow("prelude.lsp", src, len, state->lsp, &r)) {
+		lval* expr = lval_read(r.output);
+		mpc_ast_delete(r.output);
+		lval_eval_forms(state->env, expr);
+	} else {
+		mpc_err_print(r.error);
+		mpc_err_delete(r.error);
+	}
+}
+
+static void prelude_load(lsp_state* state, int lazy) {
+	// Load the standard library, leaving definitions for later if lazy
+	
+	char* s = prelude_skip(prelude_lsp);
+	while (*s) {
+		char* end = prelude_end(s);
+		char* name = lazy ? prelude_name(s) : NULL;
+		
+		if (!name) {
+			prelude_eval(state, s, end - s);
+			s = prelude_skip(end);
+			continue;
+		}
+		
+		// A later definition of the same name replaces the earlier one
+		prelude_def* defs = state->prelude_defs;
+		int i = 0;
+		while (i < state->prelude_defs_num && strcmp(defs[i].name, name) != 0) { i++; }
+		if (i == state->prelude_defs_num) {
+			state->prelude_defs_num++;
+			defs = realloc(defs, sizeof(prelude_def) * state->prelude_defs_num);
+			state->prelude_defs = defs;
+		} else {
+			free(defs[i].name);
+		}
+		
+		defs[i].name = name;
+		defs[i].src = s;
+		defs[i].len = end - s;
+		s = prelude_skip(end);
+	}
+}
+
+static int prelude_force(lsp_state* state, char* name) {
+	// Evaluate the recorded definition of a name, returns 0 if there is none
+	if (!state) { return 0; }
+	
+	prelude_def* defs = state->prelude_defs;
+	for (int i = 0; i < state->prelude_defs_num; i++) {
+		if (strcmp(defs[i].name, name) == 0) {
+			// Forget it first, so that a failing definition is not retried
+			prelude_def d = defs[i];
+			defs[i] = defs[--state->prelude_defs_num];
+			prelude_eval(state, d.src, d.len);
+			free(d.name);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void prelude_force_all(lsp_state* state) {
+	// Evaluate every definition still pending
+	while (state->prelude_defs_num) { prelude_force(state, state->prelude_defs[0].name); }
+}
+
+static void prelude_free(lsp_state* state) {
+	for (int i = 0; i < state->prelude_defs_num; i++) { free(state->prelude_defs[i].name); }
+	free(state->prelude_defs);
+	state->prelude_defs = NULL;
+	state->prelude_defs_num = 0;
+}
+
+// Images
+
+// A prelude image is the global environment after loading the builtins and the prelude, written
+// out as raw lval and lenv structs. Pointers are stored as offsets into the file and builtins as
+// their index in lenv_add_builtins, both listed in relocation tables, so loading an image only
+// maps the file and patches those fields instead of parsing and evaluating the prelude again
+
+#define IMAGE_MAGIC "LSPIMG02"
+
+typedef struct {
+	char magic[8];
+	size_t lval_size;                // Must match the binary reading it
+	size_t lenv_size;
+	unsigned long long builtins;     // Hash of the builtin names, in order
+	size_t source_size;              // Size and hash of the prelude it was built from
+	unsigned long long source_hash;
+	size_t size;                     // Size of the whole image
+	size_t env;                      // Offset of the global environment
+	size_t relocs, relocs_num;       // Offsets of pointer fields
+	size_t calls, calls_num;         // Offsets of builtin fields
+} image_header;
+
+typedef struct {
+	lenv* builtins;
+	char* data;
+	size_t size, slots;
+	size_t* relocs;
+	size_t relocs_num;
+	size_t* calls;
+	size_t calls_num;
+	int unknown;  // Set for builtins not in lenv_add_builtins and values shared by reference
+} image_writer;
+
+static unsigned long long image_hash(unsigned long long h, char* data, size_t n) {
+	// FNV-1a, start with h = 14695981039346656037
+	for (size_t i = 0; i < n; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static unsigned long long image_builtins(lenv* env) {
+	// Hash the names of the builtins, their order gives the index stored in the image
+	unsigned long long h = 14695981039346656037ULL;
+	for (int i = 0; i < env->count; i++) {
+		h = image_hash(h, env->syms[i], strlen(env->syms[i]) + 1);
+	}
+	return h;
+}
+
+static int image_source(char* filename, size_t* size, unsigned long long* hash) {
+	// Size and hash of a source file, returns 0 if it cannot be read
+	FILE* f = fopen(filename, "rb");
+	if (!f) { return 0; }
+	
+	char buffer[4096];
+	size_t n;
+	*size = 0;
+	*hash = 14695981039346656037ULL;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+		*size += n;
+		*hash = image_hash(*hash, buffer, n);
+	}
+	
+	fclose(f);
+	return 1;
+}
+
+static size_t image_alloc(image_writer* w, size_t n) {
+	// Reserve n zeroed, aligned bytes in the image and return their offset
+	size_t off = (w->size + 7) & ~(size_t)7;
+	while (off + n > w->slots) {
+		w->slots = w->slots ? w->slots * 2 : 4096;
+		w->data = realloc(w->data, w->slots);
+	}
+	memset(w->data + w->size, 0, off + n - w->size);
+	w->size = off + n;
+	return off;
+}
+
+static void image_set(image_writer* w, size_t field, size_t target) {
+	// Store a pointer field as an offset and record it for relocation, 0 stays NULL
+	if (!target) { return; }
+	memcpy(w->data + field, &target, sizeof(size_t));
+	w->relocs = realloc(w->relocs, sizeof(size_t) * (w->relocs_num+1));
+	w->relocs[w->relocs_num++] = field;
+}
+
+static size_t image_str(image_writer* w, char* s) {
+	size_t off = image_alloc(w, strlen(s) + 1);
+	strcpy(w->data + off, s);
+	return off;
+}
+
+static size_t image_lenv(image_writer* w, lenv* env);
+
+static size_t image_lval(image_writer* w, lval* v) {
+	// Append an lval and everything it owns, returns its offset
+	// Offsets are used throughout since appending may move the data
+	size_t off = image_alloc(w, sizeof(lval));
+	lval* x = (lval*)(w->data + off);
+	x->type = v->type;
+	
+	switch (v->type) {
+		case LVAL_NUM:
+		case LVAL_BOOL: x->num = v->num; break;
+		case LVAL_SYM: image_set(w, off + offsetof(lval, sym), image_str(w, v->sym)); break;
+		case LVAL_ERR: image_set(w, off + offsetof(lval, err), image_str(w, v->err)); break;
+		case LVAL_STR: image_set(w, off + offsetof(lval, str), image_str(w, v->str)); break;
+		case LVAL_FUT:
+		case LVAL_CHAN:
+		case LVAL_GEN:
+		case LVAL_SEQ: w->unknown = 1; break;
+		case LVAL_FUN:
+			if (v->builtin) {
+				// Store the builtin as its index plus one
+				size_t index = 0;
+				while ((int)index < w->builtins->count
+					&& w->builtins->vals[index]->builtin != v->builtin) { index++; }
+				if ((int)index == w->builtins->count) { w->unknown = 1; }
+				index++;
+				memcpy(w->data + off + offsetof(lval, builtin), &index, sizeof(size_t));
+				w->calls = realloc(w->calls, sizeof(size_t) * (w->calls_num+1));
+				w->calls[w->calls_num++] = off + offsetof(lval, builtin);
+			} else {
+				image_set(w, off + offsetof(lval, env),     image_lenv(w, v->env));
+				image_set(w, off + offsetof(lval, formals), image_lval(w, v->formals));
+				image_set(w, off + offsetof(lval, body),    image_lval(w, v->body));
+			}
+			break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			x->count = v->count;
+			if (v->count) {
+				size_t cell = image_alloc(w, sizeof(lval*) * v->count);
+				image_set(w, off + offsetof(lval, cell), cell);
+				for (int i = 0; i < v->count; i++) {
+					image_set(w, cell + sizeof(lval*) * i, image_lval(w, v->cell[i]));
+				}
+			}
+			break;
+	}
+	
+	return off;
+}
+
+static size_t image_lenv(image_writer* w, lenv* env) {
+	// Append an environment, the parent is left NULL since functions are given theirs when called
+	size_t off = image_alloc(w, sizeof(lenv));
+	((lenv*)(w->data + off))->count = env->count;
+	
+	if (env->count) {
+		size_t syms = image_alloc(w, sizeof(char*) * env->count);
+		size_t vals = image_alloc(w, sizeof(lval*) * env->count);
+		image_set(w, off + offsetof(lenv, syms), syms);
+		image_set(w, off + offsetof(lenv, vals), vals);
+		for (int i = 0; i < env->count; i++) {
+			image_set(w, syms + sizeof(char*) * i, image_str(w, env->syms[i]));
+			image_set(w, vals + sizeof(lval*) * i, image_lval(w, env->vals[i]));
+		}
+	}
+	
+	return off;
+}
+
+static int image_dump(lenv* env, char* filename) {
+	// Write the global environment to an image, returns 0 on failure
+	
+	image_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, IMAGE_MAGIC, 8);
+	h.lval_size = sizeof(lval);
+	h.lenv_size = sizeof(lenv);
+	h.source_size = sizeof(prelude_lsp) - 1;
+	h.source_hash = image_hash(14695981039346656037ULL, prelude_lsp, h.source_size);
+	
+	// Index builtins the same way the loader will
+	image_writer w;
+	memset(&w, 0, sizeof(w));
+	w.builtins = lenv_new();
+	lenv_add_builtins(w.builtins);
+	h.builtins = image_builtins(w.builtins);
+	
+	// The header goes first so that no value sits at offset 0
+	image_alloc(&w, sizeof(image_header));
+	h.env = image_lenv(&w, env);
+	
+	h.relocs_num = w.relocs_num;
+	h.relocs = image_alloc(&w, sizeof(size_t) * w.relocs_num);
+	memcpy(w.data + h.relocs, w.relocs, sizeof(size_t) * w.relocs_num);
+	
+	h.calls_num = w.calls_num;
+	h.calls = image_alloc(&w, sizeof(size_t) * w.calls_num);
+	memcpy(w.data + h.calls, w.calls, sizeof(size_t) * w.calls_num);
+	
+	h.size = w.size;
+	memcpy(w.data, &h, sizeof(h));
+	
+	// Builtins registered by the host and values tied to this process cannot be restored by another
+	FILE* f = w.unknown ? NULL : fopen(filename, "wb");
+	int ok = f && fwrite(w.data, 1, w.size, f) == w.size;
+	if (f) { ok = (fclose(f) == 0) && ok; }
+	
+	lenv_del(w.builtins);
+	free(w.data);
+	free(w.relocs);
+	free(w.calls);
+	return ok;
+}
+
+static char* image_map(lenv* env, char* filename) {
+	// Map and relocate an image, given an environment holding just the builtins
+	// Returns NULL if the image is missing or out of date
+	
+#ifdef _WIN32
+	return NULL;
+#else
+	size_t source_size = sizeof(prelude_lsp) - 1;
+	unsigned long long source_hash = image_hash(14695981039346656037ULL, prelude_lsp, source_size);
+	
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) { return NULL; }
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(image_header)) {
+		close(fd);
+		return NULL;
+	}
+	
+	// Private writable mapping, relocated pages are copied on write and the file is untouched
+	char* base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) { return NULL; }
+	
+	image_header* h = (image_header*)base;
+	if (memcmp(h->magic, IMAGE_MAGIC, 8) != 0
+		|| h->lval_size   != sizeof(lval)
+		|| h->lenv_size   != sizeof(lenv)
+		|| h->builtins    != image_builtins(env)
+		|| h->source_size != source_size
+		|| h->source_hash != source_hash
+		|| h->size        != (size_t)st.st_size) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	
+	// Turn offsets back into pointers and indices back into builtins
+	size_t* relocs = (size_t*)(base + h->relocs);
+	for (size_t i = 0; i < h->relocs_num; i++) {
+		*(size_t*)(base + relocs[i]) += (size_t)base;
+	}
+	
+	size_t* calls = (size_t*)(base + h->calls);
+	for (size_t i = 0; i < h->calls_num; i++) {
+		size_t index = *(size_t*)(base + calls[i]);
+		lbuiltin func = (index >= 1 && (int)index <= env->count) ? env->vals[index-1]->builtin : NULL;
+		memcpy(base + calls[i], &func, sizeof(lbuiltin));
+	}
+	
+	return base;
+#endif
+}
+
+static void image_publish(char* base, size_t size) {
+	// Set where the image is for lval_in_image, so that it never sees a base without its size
+#ifdef _WIN32
+	image_base = base;
+	image_size = size;
+#else
+	if (base) {
+		__atomic_store_n(&image_size, size, __ATOMIC_RELAXED);
+		__atomic_store_n(&image_base, base, __ATOMIC_RELEASE);
+	} else {
+		__atomic_store_n(&image_base, NULL, __ATOMIC_RELAXED);
+		__atomic_store_n(&image_size, 0, __ATOMIC_RELEASE);
+	}
+#endif
+}
+
+static int image_load(lsp_state* state, char* filename) {
+	// Replace the bindings of a global environment holding just the builtins with those of an
+	// image, mapping it unless another interpreter already did
+	// Returns 0 and leaves the environment as is if the image is missing or out of date
+	
+	lenv* env = state->env;
+	pthread_mutex_lock(&image_lock);
+	if (!image_base) {
+		char* base = image_map(env, filename);
+		if (!base) {
+			pthread_mutex_unlock(&image_lock);
+			return 0;
+		}
+		image_publish(base, ((image_header*)base)->size);
+	}
+	image_refs++;
+	pthread_mutex_unlock(&image_lock);
+	state->image = 1;
+	
+	// Symbols are copied so the environment can grow as usual, values stay in the image
+	lenv* img = (lenv*)(image_base + ((image_header*)image_base)->env);
+	for (int i = 0; i < env->count; i++) {
+		free(env->syms[i]);
+		lval_del(env->vals[i]);
+	}
+	
+	env->count = img->count;
+	env->syms = realloc(env->syms, sizeof(char*) * env->count);
+	env->vals = realloc(env->vals, sizeof(lval*) * env->count);
+	for (int i = 0; i < env->count; i++) {
+		env->syms[i] = malloc(strlen(img->syms[i]) + 1);
+		strcpy(env->syms[i], img->syms[i]);
+		env->vals[i] = img->vals[i];
+	}
+	
+	return 1;
+}
+
+static void image_release(void) {
+	// Unmap the image once no interpreter uses it
+	pthread_mutex_lock(&image_lock);
+	if (--image_refs == 0) {
+		char* base = image_base;
+		size_t size = image_size;
+		image_publish(NULL, 0);
+#ifndef _WIN32
+		munmap(base, size);
+#endif
+	}
+	pthread_mutex_unlock(&image_lock);
+}
+
+// Compiled modules
+
+// Scripts passed to load are cached next to them, "script.lsp" in "script.lspc", holding the
+// lvals read from each top level expression in a compact prefix encoding: a type byte, then
+// the number, the string or the children count and children. A module is used instead of the
+// script while the script's size, modification time and hash match those in its header
+
+#define MODULE_MAGIC "LSPC0001"
+
+typedef struct {
+	char magic[8];
+	size_t source_size;
+	long long source_mtime;
+	unsigned long long source_hash;
+	size_t size;                     // Size of the whole module
+} module_header;
+
+struct module_writer {
+	module_header h;
+	FILE* file;
+	char* filename;
+	char* tmpname;
+};
+
+static char* module_filename(char* filename) {
+	// "script.lsp" is compiled into "script.lspc", anything else gets ".lspc" appended
+	size_t n = strlen(filename);
+	char* name = malloc(n + 6);
+	strcpy(name, filename);
+	if (n >= 4 && strcmp(filename + n - 4, ".lsp") == 0) { strcat(name, "c"); }
+	else { strcat(name, ".lspc"); }
+	return name;
+}
+
+static int module_key(char* filename, module_header* h) {
+	// Fill in what identifies the current contents of a script, returns 0 if it cannot be read
+#ifdef _WIN32
+	return 0;
+#else
+	struct stat st;
+	if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) { return 0; }
+	h->source_mtime = (long long)st.st_mtime;
+	return image_source(filename, &h->source_size, &h->source_hash);
+#endif
+}
+
+static void module_write_count(FILE* f, size_t n) {
+	// Variable length count, 7 bits per byte with the high bit set on all but the last
+	while (n >= 0x80) {
+		fputc((int)(n & 0x7F) | 0x80, f);
+		n >>= 7;
+	}
+	fputc((int)n, f);
+}
+
+static void module_write_str(FILE* f, char* s) {
+	size_t n = strlen(s);
+	module_write_count(f, n);
+	fwrite(s, 1, n, f);
+}
+
+static void module_write(FILE* f, lval* v) {
+	fputc(v->type, f);
+	switch (v->type) {
+		case LVAL_NUM:
+		case LVAL_BOOL: fwrite(&v->num, sizeof(double), 1, f); break;
+		case LVAL_SYM:  module_write_str(f, v->sym); break;
+		case LVAL_ERR:  module_write_str(f, v->err); break;
+		case LVAL_STR:  module_write_str(f, v->str); break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			module_write_count(f, v->count);
+			for (int i = 0; i < v->count; i++) { module_write(f, v->cell[i]); }
+			break;
+	}
+}
+
+static int module_read_count(char** p, char* end, size_t* n) {
+	*n = 0;
+	for (int shift = 0; *p < end && shift < 64; shift += 7) {
+		unsigned char c = (unsigned char)*(*p)++;
+		*n |= (size_t)(c & 0x7F) << shift;
+		if (!(c & 0x80)) { return 1; }
+	}
+	return 0;
+}
+
+static char* module_read_str(char** p, char* end) {
+	size_t n;
+	if (!module_read_count(p, end, &n) || n > (size_t)(end - *p)) { return NULL; }
+	char* s = malloc(n + 1);
+	memcpy(s, *p, n);
+	s[n] = '\0';
+	*p += n;
+	return s;
+}
+
+static lval* module_read(char** p, char* end) {
+	// Decode one lval, returns NULL if the data is cut short
+	if (*p >= end) { return NULL; }
+	int type = (unsigned char)*(*p)++;
+	
+	lval* v = NULL;
+	char* s;
+	size_t n;
+	switch (type) {
+		case LVAL_NUM:
+		case LVAL_BOOL:
+			if ((size_t)(end - *p) < sizeof(double)) { return NULL; }
+			v = type == LVAL_NUM ? lval_num(0) : lval_bool(0);
+			memcpy(&v->num, *p, sizeof(double));
+			*p += sizeof(double);
+			break;
+		case LVAL_SYM:
+		case LVAL_ERR:
+		case LVAL_STR:
+			if (!(s = module_read_str(p, end))) { return NULL; }
+			v = malloc(sizeof(lval));
+			v->type = type;
+			if (type == LVAL_SYM) { v->sym = s; }
+			if (type == LVAL_ERR) { v->err = s; }
+			if (type == LVAL_STR) { v->str = s; }
+			break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			if (!module_read_count(p, end, &n)) { return NULL; }
+			v = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+			for (size_t i = 0; i < n; i++) {
+				lval* x = module_read(p, end);
+				if (!x) { lval_del(v); return NULL; }
+				lval_add(v, x);
+			}
+			break;
+	}
+	return v;
+}
+
+static int module_load(lenv* env, char* filename) {
+	// Evaluate a script from its compiled module, returns 0 if there is none or it is out of date
+	
+#ifdef _WIN32
+	return 0;
+#else
+	module_header key;
+	if (!module_key(filename, &key)) { return 0; }
+	
+	char* name = module_filename(filename);
+	int fd = open(name, O_RDONLY);
+	free(name);
+	if (fd < 0) { return 0; }
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(module_header)) {
+		close(fd);
+		return 0;
+	}
+	
+	char* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) { return 0; }
+	
+	module_header* h = (module_header*)base;
+	if (memcmp(h->magic, MODULE_MAGIC, 8) != 0
+		|| h->source_size  != key.source_size
+		|| h->source_mtime != key.source_mtime
+		|| h->source_hash  != key.source_hash
+		|| h->size         != (size_t)st.st_size) {
+		munmap(base, st.st_size);
+		return 0;
+	}
+	
+	// Decode every top level expression before evaluating any, so that a module cut short or
+	// corrupted is not half evaluated before the script is parsed instead
+	char* p = base + sizeof(module_header);
+	char* end = base + h->size;
+	lval* forms = lval_sexpr();
+	while (p < end) {
+		lval* expr = module_read(&p, end);
+		if (!expr || expr->type != LVAL_SEXPR) {
+			if (expr) { lval_del(expr); }
+			lval_del(forms);
+			munmap(base, st.st_size);
+			return 0;
+		}
+		lval_add(forms, expr);
+	}
+	munmap(base, st.st_size);
+	
+	// Each form is deleted once evaluated, leaving only the list itself to free
+	for (int i = 0; i < forms->count; i++) { lval_eval_forms(env, forms->cell[i]); }
+	forms->count = 0;
+	lval_del(forms);
+	return 1;
+#endif
+}
+
+static module_writer* module_new(char* filename) {
+	// Start compiling a module for a script, returns NULL if it cannot be written
+	
+#ifdef _WIN32
+	return NULL;
+#else
+	module_header h;
+	memset(&h, 0, sizeof(h));
+	if (!module_key(filename, &h)) { return NULL; }
+	
+	// Written to a file of its own and renamed into place, so that interpreters loading the
+	// same script at once neither write into each other's module nor read one half written
+	char* name = module_filename(filename);
+	char* tmpname = malloc(strlen(name) + 8);
+	strcpy(tmpname, name);
+	strcat(tmpname, ".XXXXXX");
+	
+	int fd = mkstemp(tmpname);
+	FILE* file = fd < 0 ? NULL : fdopen(fd, "wb");
+	if (!file) {
+		if (fd >= 0) {
+			close(fd);
+			remove(tmpname);
+		}
+		free(name);
+		free(tmpname);
+		return NULL;
+	}
+	
+	// The header is written without its magic until the module is complete
+	module_writer* m = malloc(sizeof(module_writer));
+	m->h = h;
+	m->file = file;
+	m->filename = name;
+	m->tmpname = tmpname;
+	fwrite(&m->h, sizeof(module_header), 1, file);
+	return m;
+#endif
+}
+
+static void module_add(module_writer* m, lval* expr) {
+	// Append the expressions read from one top level form, if any
+	if (m && expr->count) { module_write(m->file, expr); }
+}
+
+static void module_end(module_writer* m, int ok) {
+	// Finish a module, or discard it if the script could not be read in full
+	if (!m) { return; }
+	
+	if (ok) {
+		long size = ftell(m->file);
+		memcpy(m->h.magic, MODULE_MAGIC, 8);
+		m->h.size = size < 0 ? 0 : (size_t)size;
+		ok = size >= 0
+			&& fseek(m->file, 0, SEEK_SET) == 0
+			&& fwrite(&m->h, sizeof(module_header), 1, m->file) == 1;
+	}
+	ok = !ferror(m->file) && ok;
+	ok = (fclose(m->file) == 0) && ok;
+	
+	if (ok) { ok = rename(m->tmpname, m->filename) == 0; }
+	if (!ok) { remove(m->tmpname); }
+	
+	free(m->filename);
+	free(m->tmpname);
+	free(m);
+}
+
+// Grammar
+
+// The parsers are built directly from mpc combinators, the same ones mpca_lang would produce for
+//
+//     number  : /-?[0-9]+(\.[0-9]*)?/ ;
+//     symbol  : /[a-zA-Z0-9_+\-*\/%\\=<>!|&]+/ ;
+//     string  : /"(\\.|[^"\\])*"/s ;
+//     comment : /;[^\r\n]*/ ;
+//     sexpr   : '(' <expr>* ')' ;
+//     qexpr   : '{' <expr>* '}' ;
+//     expr    : <number>  | <symbol> | <string>
+//             | <comment> | <sexpr>  | <qexpr> ;
+//     form    : // (<expr> | /$/) ;
+//     lsp     : /^/ <expr>* /$/ ;
+//
+// so startup does not have to parse the grammar itself. Keep both in sync when changing it
+
+static mpc_parser_t* grammar_regex(char* re, int mode) {
+	// A regular expression, whitespace insensitive
+	return mpca_state(mpca_tag(mpc_apply(mpc_tok(mpc_re_mode(re, mode)), mpcf_str_ast), "regex"));
+}
+
+static mpc_parser_t* grammar_char(char c) {
+	// A character literal, whitespace insensitive
+	return mpca_state(mpca_tag(mpc_apply(mpc_tok(mpc_char(c)), mpcf_str_ast), "char"));
+}
+
+static mpc_parser_t* grammar_rule(mpc_parser_t* p, char* name) {
+	// A reference to another rule, which adds its name to the AST tag
+	return mpca_state(mpca_root(mpca_add_tag(p, name)));
+}
+
+static mpc_parser_t* grammar_seq(int n, ...) {
+	// A sequence of n parsers, nested the way mpca_lang nests them
+	va_list va;
+	va_start(va, n);
+	mpc_parser_t* p = mpc_pass();
+	for (int i = 0; i < n; i++) { p = mpca_and(2, p, va_arg(va, mpc_parser_t*)); }
+	va_end(va);
+	return p;
+}
+
+static void grammar_define(mpc_parser_t* p, mpc_parser_t* a) {
+	mpc_optimise(a);
+	mpc_define(p, a);
+}
+
+static void grammar_new(lsp_state* s) {
+	// Declare parsers
+	s->number  = mpc_new("number");
+	s->symbol  = mpc_new("symbol");
+	s->string  = mpc_new("string");
+	s->comment = mpc_new("comment");
+	s->sexpr   = mpc_new("sexpr");
+	s->qexpr   = mpc_new("qexpr");
+	s->expr    = mpc_new("expr");
+	s->form    = mpc_new("form");
+	s->lsp     = mpc_new("lsp");
+	
+	// Define them
+	grammar_define(s->number,  grammar_seq(1, grammar_regex("-?[0-9]+(\\.[0-9]*)?", MPC_RE_DEFAULT)));
+	grammar_define(s->symbol,  grammar_seq(1, grammar_regex("[a-zA-Z0-9_+\\-*/%\\\\=<>!|&]+", MPC_RE_DEFAULT)));
+	grammar_define(s->string,  grammar_seq(1, grammar_regex("\"(\\\\.|[^\"\\\\])*\"", MPC_RE_DOTALL)));
+	grammar_define(s->comment, grammar_seq(1, grammar_regex(";[^\\r\\n]*", MPC_RE_DEFAULT)));
+	
+	grammar_define(s->sexpr, grammar_seq(3,
+		grammar_char('('), mpca_many(grammar_rule(s->expr, "expr")), grammar_char(')')));
+	grammar_define(s->qexpr, grammar_seq(3,
+		grammar_char('{'), mpca_many(grammar_rule(s->expr, "expr")), grammar_char('}')));
+	
+	grammar_define(s->expr,
+		mpca_or(2, grammar_seq(1, grammar_rule(s->number,  "number")),
+		mpca_or(2, grammar_seq(1, grammar_rule(s->symbol,  "symbol")),
+		mpca_or(2, grammar_seq(1, grammar_rule(s->string,  "string")),
+		mpca_or(2, grammar_seq(1, grammar_rule(s->comment, "comment")),
+		mpca_or(2, grammar_seq(1, grammar_rule(s->sexpr,   "sexpr")),
+		           grammar_seq(1, grammar_rule(s->qexpr,   "qexpr"))))))));
+	
+	grammar_define(s->form, grammar_seq(2,
+		grammar_regex("", MPC_RE_DEFAULT),
+		mpca_or(2, grammar_seq(1, grammar_rule(s->expr, "expr")),
+		           grammar_seq(1, grammar_regex("$", MPC_RE_DEFAULT)))));
+	
+	grammar_define(s->lsp, grammar_seq(3,
+		grammar_regex("^", MPC_RE_DEFAULT),
+		mpca_many(grammar_rule(s->expr, "expr")),
+		grammar_regex("$", MPC_RE_DEFAULT)));
+	
+	// Rules refer to each other, so optimise again once all of them are defined
+	mpc_optimise(s->number);
+	mpc_optimise(s->symbol);
+	mpc_optimise(s->string);
+	mpc_optimise(s->comment);
+	mpc_optimise(s->sexpr);
+	mpc_optimise(s->qexpr);
+	mpc_optimise(s->expr);
+	mpc_optimise(s->form);
+	mpc_optimise(s->lsp);
+}
+
+// Forms
+
+// Programs reading input in blocks, like batch mode in repl.c, find where each top level
+// expression ends before parsing it, so that it is evaluated as soon as it is all there. Parsing
+// a stream with the form rule would not do: it reads the whitespace after an expression, waiting
+// for more input before returning it. This scan must split input exactly where the grammar above
+// does, which tests/test_grammar.c checks
+
+static int form_delim(char c) {
+	return isspace((unsigned char)c) || c == '(' || c == ')' || c == '{' || c == '}'
+		|| c == '"' || c == ';';
+}
+
+size_t lsp_form_length(char* s, size_t n, int eof) {
+	// Length of the first expression in s along with the whitespace and comments before it, 0 if
+	// there is none or it is not all there yet. At the end of input what is left is taken whole,
+	// for the parser to report what it lacks
+	int depth = 0, started = 0;
+	for (size_t i = 0; i < n; i++) {
+		char c = s[i];
+		if (c == ';') {
+			while (i < n && s[i] != '\n') { i++; }
+		} else if (c == '"') {
+			for (i++; i < n && s[i] != '"'; i++) {
+				if (s[i] == '\\') { i++; }
+			}
+			if (i < n && depth == 0) { return i + 1; }
+			started = 1;
+		} else if (c == '(' || c == '{') {
+			depth++;
+			started = 1;
+		} else if (c == ')' || c == '}') {
+			// An unmatched one is an expression of its own, which fails to parse
+			if (--depth <= 0) { return i + 1; }
+		} else if (!isspace((unsigned char)c)) {
+			started = 1;
+			if (depth == 0) {
+				// Number or symbol, which may go on in the input yet to come
+				while (i < n && !form_delim(s[i])) { i++; }
+				if (i < n) { return i; }
+			}
+		}
+	}
+	return eof && started ? n : 0;
+}
+
+// Interpreter state
+
+static lsp_state* lsp_state_new(void) {
+	lsp_state* state = calloc(1, sizeof(lsp_state));
+	grammar_new(state);
+	
+	state->env = lenv_new();
+	state->env->state = state;
+	lenv_add_builtins(state->env);
+	
+	return state;
+}
+
+static void pool_del(lsp_pool* pool);
+
+static lsp_state* lsp_state_worker(lsp_state* owner, int worker) {
+	// Interpreter of a pool thread, tasks bring their own environment
+	lsp_state* state = calloc(1, sizeof(lsp_state));
+	grammar_new(state);
+	state->owner = owner;
+	state->worker = worker;
+	return state;
+}
+
+static void lsp_state_del(lsp_state* state) {
+	// Stop the pool threads before the global environment they read
+	if (state->pool) { pool_del(state->pool); }
+	
+	// Along with any frozen below it
+	while (state->env) {
+		lenv* parent = state->env->parent;
+		lenv_del(state->env);
+		state->env = parent;
+	}
+	prelude_free(state);
+	if (state->image) { image_release(); }
+	
+	// Undefine and delete the parsers
+	mpc_cleanup(9, state->number, state->symbol, state->string, state->comment,
+		state->sexpr, state->qexpr, state->expr, state->form, state->lsp);
+	free(state);
+}
+
+// Thread pool
+
+// Parallel builtins hand their work to a pool of threads, started the first time one is used,
+// each with an interpreter of its own for parsing. Their tasks look names up in environments of
+// the thread that submitted them, down to the global ones of the interpreter owning the pool,
+// which are only read meanwhile: that thread waits for the tasks, running them too. Definitions
+// made by a task go to an environment of its own instead
+//
+// Starting the pool freezes the standard library and whatever else was defined so far, which
+// threads then read without locks. Futures keep running after the builtin that spawned them
+// returns, while they do the global environment defined since is guarded by a lock taken to
+// read it from pool threads and to change it from the owner's
+//
+// Every thread, the owner's included, has a deque of tasks. It takes its newest task first,
+// while a thread running out of them steals the oldest task of another. LSP_THREADS sets how
+// many threads there are, the owner's included, which defaults to the number of processors.
+// The pool only grows past that when threads blocking on channels would leave tasks waiting
+
+typedef struct lsp_task lsp_task;
+
+struct lsp_task {
+	// Run by some thread of the pool with its interpreter, run must also free the task
+	void (*run)(lsp_state* state, lsp_task* task);
+};
+
+typedef struct {
+	pthread_mutex_t lock;
+	lsp_task** tasks;
+	int head, tail, size;  // Tasks waiting are those in [head, tail)
+} pool_deque;
+
+#define POOL_MAX 1024
+
+struct lsp_pool {
+	lsp_state* owner;
+	int num;                // Threads started, their deques follow the owner's
+	size_t stack;
+	pthread_t* threads;
+	lsp_state** states;
+	pool_deque* deques;
+	
+	// Threads with nothing to run sleep on wake, which is signalled for every new task and
+	// broadcast whenever a group of tasks is done
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int queued;             // Tasks in all deques
+	int idle;               // Threads looking for tasks
+	int stop;
+	
+	// Futures not done, and the lock on the global environment for them
+	int futures;
+	pthread_rwlock_t globals;
+};
+
+// Interpreter of the pool thread running, NULL on any other thread
+static LSP_THREAD_LOCAL lsp_state* pool_self;
+
+static int pool_atomic_add(int* p, int n) {
+	// Add to a counter shared between threads, returns the new value
+#ifdef _WIN32
+	return *p += n;
+#else
+	return __sync_add_and_fetch(p, n);
+#endif
+}
+
+static double pool_now(void) {
+	// Seconds on a monotonic clock
+#ifdef _WIN32
+	return (double)clock() / CLOCKS_PER_SEC;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+static void deque_push(pool_deque* d, lsp_task* t) {
+	pthread_mutex_lock(&d->lock);
+	if (d->tail == d->size && d->head > 0) {
+		// Move tasks back to the start
+		memmove(d->tasks, d->tasks + d->head, sizeof(lsp_task*) * (d->tail - d->head));
+		d->tail -= d->head;
+		d->head = 0;
+	}
+	if (d->tail == d->size) {
+		d->size = d->size ? d->size * 2 : 16;
+		d->tasks = realloc(d->tasks, sizeof(lsp_task*) * d->size);
+	}
+	d->tasks[d->tail++] = t;
+	pthread_mutex_unlock(&d->lock);
+}
+
+static lsp_task* deque_pop(pool_deque* d, int oldest) {
+	// Take the newest task, or the oldest when stealing, NULL if there is none
+	lsp_task* t = NULL;
+	pthread_mutex_lock(&d->lock);
+	if (d->head < d->tail) { t = oldest ? d->tasks[d->head++] : d->tasks[--d->tail]; }
+	if (d->head == d->tail) { d->head = d->tail = 0; }
+	pthread_mutex_unlock(&d->lock);
+	return t;
+}
+
+static int deque_empty(pool_deque* d) {
+	pthread_mutex_lock(&d->lock);
+	int empty = d->head == d->tail;
+	pthread_mutex_unlock(&d->lock);
+	return empty;
+}
+
+static void pool_push(lsp_pool* pool, lsp_state* state, lsp_task* t) {
+	// Add a task to the deque of the thread running state and wake a thread for it
+	deque_push(&pool->deques[state->worker], t);
+	pool_atomic_add(&pool->queued, 1);
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static lsp_task* pool_take(lsp_pool* pool, lsp_state* state) {
+	// Next task for the thread running state, its own or stolen, NULL if there is none
+	if (pool_atomic_add(&pool->queued, 0) == 0) { return NULL; }
+	
+	int num = pool_atomic_add(&pool->num, 0) + 1;
+	lsp_task* t = deque_pop(&pool->deques[state->worker], 0);
+	for (int i = 1; !t && i < num; i++) {
+		t = deque_pop(&pool->deques[(state->worker + i) % num], 1);
+	}
+	
+	if (t) { pool_atomic_add(&pool->queued, -1); }
+	return t;
+}
+
+static void pool_sleep(lsp_pool* pool, int* pending) {
+	// Wait for a task to be queued, or for the count pointed to by pending to reach zero
+	pthread_mutex_lock(&pool->lock);
+	if (!pool_atomic_add(&pool->stop, 0) && !pool_atomic_add(&pool->queued, 0)
+		&& (!pending || pool_atomic_add(pending, 0) > 0)) {
+		pool_atomic_add(&pool->idle, 1);
+		pthread_cond_wait(&pool->wake, &pool->lock);
+		pool_atomic_add(&pool->idle, -1);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_done(lsp_pool* pool, int* pending) {
+	// Count down a group of tasks, waking whoever waits for them after the last one
+	if (pool_atomic_add(pending, -1) > 0) { return; }
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_wait(lsp_pool* pool, lsp_state* state, int* pending) {
+	// Run tasks on the thread running state until a group of tasks is done
+	while (pool_atomic_add(pending, 0) > 0) {
+		lsp_task* t = pool_take(pool, state);
+		if (t) { t->run(state, t); }
+		else   { pool_sleep(pool, pending); }
+	}
+}
+
+#ifndef _WIN32
+
+static void* pool_thread(void* arg) {
+	lsp_state* state = arg;
+	lsp_pool* pool = state->owner->pool;
+	pool_self = state;
+	while (!pool_atomic_add(&pool->stop, 0)) {
+		lsp_task* t = pool_take(pool, state);
+		if (t) { t->run(state, t); }
+		else   { pool_sleep(pool, NULL); }
+	}
+	return NULL;
+}
+
+static int pool_threads(void) {
+	// Threads a pool should have, the owner's included
+	char* env = getenv("LSP_THREADS");
+	long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n > POOL_MAX ? POOL_MAX : (int)n;
+}
+
+#endif
+
+static int pool_grow(lsp_pool* pool) {
+	// Start another thread, returns 0 if it could not
+#ifdef _WIN32
+	return 0;
+#else
+	pthread_mutex_lock(&pool->lock);
+	int num = pool_atomic_add(&pool->num, 0);
+	int ok = num < POOL_MAX;
+	if (ok) {
+		lsp_state* worker = lsp_state_worker(pool->owner, num + 1);
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, pool->stack);
+		ok = pthread_create(&pool->threads[num], &attr, pool_thread, worker) == 0;
+		pthread_attr_destroy(&attr);
+		
+		if (ok) {
+			pool->states[num] = worker;
+			pool_atomic_add(&pool->num, 1);
+		} else {
+			lsp_state_del(worker);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return ok;
+#endif
+}
+
+static void globals_freeze(lsp_state* state);
+
+static lsp_pool* pool_get(lsp_state* state) {
+	// Pool of the interpreter, or of the one whose thread runs it, started on first use
+	lsp_state* owner = state->owner ? state->owner : state;
+	if (owner->pool) { return owner->pool; }
+	
+	// What is defined so far no longer changes once threads read it
+	globals_freeze(owner);
+	
+	lsp_pool* pool = calloc(1, sizeof(lsp_pool));
+	pool->owner = owner;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_rwlock_init(&pool->globals, NULL);
+	owner->pool = pool;
+	owner->worker = 0;
+	
+	pool->deques = calloc(POOL_MAX + 1, sizeof(pool_deque));
+	for (int i = 0; i <= POOL_MAX; i++) { pthread_mutex_init(&pool->deques[i].lock, NULL); }
+	pool->threads = calloc(POOL_MAX, sizeof(pthread_t));
+	pool->states = calloc(POOL_MAX, sizeof(lsp_state*));
+	
+#ifndef _WIN32
+	// Evaluation recurses on the C stack, give threads as much as the main one
+	struct rlimit rl;
+	pool->stack = 8 << 20;
+	if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > pool->stack) {
+		pool->stack = rl.rlim_cur;
+	}
+	
+	// Should a thread fail to start, the pool makes do with those before it
+	for (int i = 1, num = pool_threads(); i < num && pool_grow(pool); i++) {}
+#endif
+	
+	return pool;
+}
+
+static int pool_lock(lenv* env, int write) {
+	// Lock the global environment of an interpreter while futures run, returns whether it did
+	lsp_state* state = env->state;
+	if (env->frozen || !state || state->owner || !state->pool || env != state->env) { return 0; }
+	if (pool_atomic_add(&state->pool->futures, 0) == 0) { return 0; }
+	
+	// Only the owner's thread changes it, and it needs no lock to read it
+	if (write == !!pool_self) { return 0; }
+	if (write) { pthread_rwlock_wrlock(&state->pool->globals); }
+	else       { pthread_rwlock_rdlock(&state->pool->globals); }
+	return 1;
+}
+
+static void pool_unlock(lenv* env) {
+	pthread_rwlock_unlock(&env->state->pool->globals);
+}
+
+static void pool_del(lsp_pool* pool) {
+	// Stop and join the threads once futures nobody awaited are done
+	pool_wait(pool, pool->owner, &pool->futures);
+	
+	pthread_mutex_lock(&pool->lock);
+	pool_atomic_add(&pool->stop, 1);
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	
+	for (int i = 0; i < pool->num; i++) {
+#ifndef _WIN32
+		pthread_join(pool->threads[i], NULL);
+#endif
+		lsp_state_del(pool->states[i]);
+	}
+	
+	for (int i = 0; i <= POOL_MAX; i++) {
+		pthread_mutex_destroy(&pool->deques[i].lock);
+		free(pool->deques[i].tasks);
+	}
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_rwlock_destroy(&pool->globals);
+	free(pool->deques);
+	free(pool->threads);
+	free(pool->states);
+	free(pool);
+}
+
+// Parallel builtins
+
+// pmap, pfilter and preduce split their list into ranges run as pool tasks. A range evaluates
+// its items in order, and while some thread is idle it hands the second half of what is left to
+// it, unless going by the time its items took so far that is less than PAR_SPLIT seconds of
+// work. Cheap items are thus run in long chunks and expensive ones spread out one by one
+//
+// Results are kept per item, or per range for preduce, and put together in order afterwards.
+// An error stops items after it from being evaluated, the one returned is the first in the list
+
+#define PAR_SPLIT 50e-6
+
+enum { PAR_MAP, PAR_FILTER, PAR_REDUCE };
+
+typedef struct {
+	int kind;
+	char* func;
+	lenv* env;       // Where the builtin was called from
+	lval* f;
+	lval* items;     // Only read while tasks run
+	lval** results;  // Indexed by item for pmap and pfilter, by start of range for preduce
+	int limit;       // Index of the first error so far, or the number of items
+	int pending;     // Ranges not done
+	lsp_pool* pool;
+	print_sink* sink;  // Where the caller prints, which its ranges print to as well
+} par_job;
+
+typedef struct {
+	lsp_task task;
+	par_job* job;
+	int lo, hi;
+} par_range;
+
+static lval* par_call(lenv* env, lval* f, lval* x, lval* y) {
+	// Call a copy of f, lval_call consumes its formals, with one or two arguments
+	lval* args = lval_add(lval_sexpr(), x);
+	if (y) { lval_add(args, y); }
+	
+	f = lval_copy(f);
+	lval* result = lval_call(env, f, args);
+	lval_del(f);
+	return result;
+}
+
+static void par_error(par_job* job, int i) {
+	// Lower the limit to item i
+	int limit;
+	while ((limit = pool_atomic_add(&job->limit, 0)) > i) {
+#ifdef _WIN32
+		job->limit = i;
+#else
+		__sync_bool_compare_and_swap(&job->limit, limit, i);
+#endif
+	}
+}
+
+static void par_range_run(lsp_state* state, lsp_task* task);
+
+static void par_range_push(lsp_state* state, par_job* job, int lo, int hi) {
+	par_range* r = malloc(sizeof(par_range));
+	r->task.run = par_range_run;
+	r->job = job;
+	r->lo = lo;
+	r->hi = hi;
+	pool_atomic_add(&job->pending, 1);
+	pool_push(job->pool, state, &r->task);
+}
+
+static void par_range_run(lsp_state* state, lsp_task* task) {
+	par_range* r = (par_range*)task;
+	par_job* job = r->job;
+	lsp_pool* pool = job->pool;
+	
+	// Definitions made while evaluating stay here and are dropped with the range
+	lenv* env = lenv_new();
+	env->state = state;
+	env->parent = job->env;
+	
+	// For this range only, the thread may be waiting in a task of another request meanwhile
+	print_sink* capture = print_capture;
+	print_capture = job->sink;
+	
+	lval* acc = NULL;
+	double start = pool_now();
+	for (int i = r->lo; i < r->hi && i < pool_atomic_add(&job->limit, 0); i++) {
+		
+		// Estimated time left, from the average time per item so far
+		int left = r->hi - i;
+		double cost = i > r->lo ? (pool_now() - start) / (i - r->lo) * left : 0;
+		if (left >= 2 && cost > PAR_SPLIT && pool_atomic_add(&pool->idle, 0) > 0
+			&& deque_empty(&pool->deques[state->worker])) {
+			par_range_push(state, job, r->hi - left / 2, r->hi);
+			r->hi -= left / 2;
+		}
+		
+		lval* x = lval_copy(job->items->cell[i]);
+		
+		if (job->kind == PAR_REDUCE) {
+			acc = acc ? par_call(env, job->f, acc, x) : x;
+			if (acc->type == LVAL_ERR) { par_error(job, i); }
+			continue;
+		}
+		
+		lval* y = par_call(env, job->f, x, NULL);
+		if (job->kind == PAR_FILTER && y->type != LVAL_BOOL && y->type != LVAL_ERR) {
+			lval* err = lval_err("Function '%s' passed a function returning %s. Expected %s",
+			                     job->func, ltype_name(y->type), ltype_name(LVAL_BOOL));
+			lval_del(y);
+			y = err;
+		}
+		job->results[i] = y;
+		if (y->type == LVAL_ERR) { par_error(job, i); }
+	}
+	
+	if (job->kind == PAR_REDUCE) { job->results[r->lo] = acc; }
+	print_capture = capture;
+	
+	lenv_del(env);
+	free(r);
+	pool_done(pool, &job->pending);
+}
+
+static lval* builtin_par(lenv* env, lval* args, int kind, char* func) {
+	// Shared by the parallel builtins, the function comes first and the list last
+	
+	int n = kind == PAR_REDUCE ? 3 : 2;
+	LASSERT_NUM(func, args, n);
+	LASSERT_TYPE(func, args, 0, LVAL_FUN);
+	LASSERT_LIST(env, func, args, n - 1);
+	
+	lsp_state* state = lenv_state(env);
+	lval* items = args->cell[n - 1];
+	
+	par_job job;
+	job.kind = kind;
+	job.func = func;
+	job.env = env;
+	job.f = args->cell[0];
+	job.items = items;
+	job.results = calloc(items->count ? items->count : 1, sizeof(lval*));
+	job.limit = items->count;
+	job.pending = 0;
+	job.pool = pool_get(state);
+	job.sink = print_capture;
+	
+	if (items->count) {
+		par_range_push(state, &job, 0, items->count);
+		pool_wait(job.pool, state, &job.pending);
+	}
+	
+	lval* result;
+	if (kind == PAR_REDUCE) {
+		
+		// Fold the result of each range into the initial value, in order
+		result = lval_pop(args, 1);
+		for (int i = 0; i < items->count; i++) {
+			lval* x = job.results[i];
+			if (!x) { continue; }
+			if      (result->type == LVAL_ERR) { lval_del(x); }
+			else if (x->type == LVAL_ERR)      { lval_del(result); result = x; }
+			else                               { result = par_call(env, job.f, result, x); }
+		}
+		
+	} else if (job.limit < items->count) {
+		
+		// First error, anything evaluated besides it is dropped
+		result = job.results[job.limit];
+		for (int i = 0; i < items->count; i++) {
+			if (job.results[i] && i != job.limit) { lval_del(job.results[i]); }
+		}
+		
+	} else {
+		
+		result = lval_qexpr();
+		for (int i = 0; i < items->count; i++) {
+			if (kind == PAR_MAP) {
+				lval_add(result, job.results[i]);
+			} else {
+				if (job.results[i]->num) { lval_add(result, lval_copy(items->cell[i])); }
+				lval_del(job.results[i]);
+			}
+		}
+	}
+	
+	free(job.results);
+	lval_del(args);
+	return result;
+}
+
+static lval* builtin_pmap(lenv* env, lval* args) {
+	// Builtin function "pmap": Same as map, with items evaluated in parallel
+	return builtin_par(env, args, PAR_MAP, "pmap");
+}
+
+static lval* builtin_pfilter(lenv* env, lval* args) {
+	// Builtin function "pfilter": Same as filter, with items evaluated in parallel
+	return builtin_par(env, args, PAR_FILTER, "pfilter");
+}
+
+static lval* builtin_preduce(lenv* env, lval* args) {
+	// Builtin function "preduce": Same as foldl for an associative function, items are folded
+	// in parallel ranges whose results are then folded into the initial value
+	return builtin_par(env, args, PAR_REDUCE, "preduce");
+}
+
+// Futures
+
+// spawn moves its expression into a pool task and returns a future for it right away, await
+// waits for the result, running other tasks meanwhile. The task evaluates in an environment of
+// its own over the global one, with copies of the local variables the expression names, since
+// those of the caller may be gone by the time it runs
+//
+// A future is shared by its copies and the task, whichever is last frees it. An error is the
+// result like any other value, and the last copy to await it gets it moved out
+
+struct lsp_future {
+	lsp_task task;
+	int refs;      // Copies of the future, plus the task until it is done
+	int pending;   // 1 until the result is set
+	lval* expr;
+	lenv* env;
+	lval* result;
+	lsp_pool* pool;
+	print_sink* sink;  // Where the spawning task printed, if not stdout
+};
+
+static void future_ref(lsp_future* f, int n) {
+	// Add n references to a future, freeing it after the last one
+	if (pool_atomic_add(&f->refs, n) > 0) { return; }
+	if (f->expr)   { lval_del(f->expr); }
+	if (f->env)    { lenv_del(f->env); }
+	if (f->result) { lval_del(f->result); }
+	sink_ref(f->sink, -1);
+	free(f);
+}
+
+static void future_run(lsp_state* state, lsp_task* task) {
+	lsp_future* f = (lsp_future*)task;
+	lsp_pool* pool = f->pool;
+	
+	print_sink* capture = print_capture;
+	print_capture = f->sink;
+	f->env->state = state;
+	f->result = lval_eval(f->env, f->expr);
+	f->expr = NULL;
+	print_capture = capture;
+	lenv_del(f->env);
+	f->env = NULL;
+	
+	// Counted out of the pool first, so that it is no longer running once awaited
+	pool_done(pool, &pool->futures);
+	pool_done(pool, &f->pending);
+	future_ref(f, -1);
+}
+
+static void future_capture(lenv* task, lenv* env, lval* v) {
+	// Copy local variables named in v into the environment of a task
+	if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+		for (int i = 0; i < v->count; i++) { future_capture(task, env, v->cell[i]); }
+		return;
+	}
+	if (v->type != LVAL_SYM) { return; }
+	
+	for (int i = 0; i < task->count; i++) {
+		if (strcmp(task->syms[i], v->sym) == 0) { return; }
+	}
+	
+	// Closest definition below the global environment, which the task reads itself
+	lsp_state* state = lenv_state(env);
+	lsp_state* owner = state->owner ? state->owner : state;
+	for (lenv* e = env; e && e != owner->env; e = e->parent) {
+		for (int i = 0; i < e->count; i++) {
+			if (strcmp(e->syms[i], v->sym) == 0) {
+				lenv_put(task, v, e->vals[i]);
+				return;
+			}
+		}
+	}
+}
+
+static lval* builtin_spawn(lenv* env, lval* args) {
+	// Builtin function "spawn": Takes a Q-expression and evaluates it as an S-expression on
+	// another thread, returns a future for the result
+	
+	LASSERT_NUM("spawn", args, 1);
+	LASSERT_TYPE("spawn", args, 0, LVAL_QEXPR);
+	
+	lsp_state* state = lenv_state(env);
+	lsp_future* f = malloc(sizeof(lsp_future));
+	f->task.run = future_run;
+	f->refs = 2;
+	f->pending = 1;
+	f->expr = lval_take(args, 0);
+	f->expr->type = LVAL_SEXPR;
+	f->env = lenv_new();
+	f->result = NULL;
+	f->pool = pool_get(state);
+	f->sink = sink_ref(print_capture, 1);
+	
+	future_capture(f->env, env, f->expr);
+	f->env->parent = f->pool->owner->env;
+	
+	pool_atomic_add(&f->pool->futures, 1);
+	pool_push(f->pool, state, &f->task);
+	return lval_future(f);
+}
+
+static lval* builtin_await(lenv* env, lval* args) {
+	// Builtin function "await": Takes a future and returns its result once there is one
+	
+	LASSERT_NUM("await", args, 1);
+	LASSERT_TYPE("await", args, 0, LVAL_FUT);
+	
+	lsp_future* f = args->cell[0]->fut;
+	pool_wait(f->pool, lenv_state(env), &f->pending);
+	
+	// Nothing else can read the result if args holds the last reference
+	lval* result;
+	if (pool_atomic_add(&f->refs, 0) == 1) {
+		result = f->result;
+		f->result = NULL;
+	} else {
+		result = lval_copy(f->result);
+	}
+	
+	lval_del(args);
+	return result;
+}
+
+// Channels
+
+// A channel is a bounded queue of values between tasks, or between interpreters running on
+// threads of their own. Its ring buffer takes no lock: each slot has a sequence number telling
+// whether it is free for the send at a position or holds the value for the recv at it, and a
+// thread claims a position by moving head or tail past it. Values are moved through, what is
+// sent belongs to whoever receives it
+//
+// send on a full channel and recv on an empty one sleep until the channel changes. A pool thread
+// does not run tasks meanwhile as it does waiting for a future: were one to block on the channel
+// too, with this one below it on the stack, neither would return. Rather, the pool gets another
+// thread if tasks would be left waiting. Closing a channel makes any later send fail, and recv
+// once nothing is left
+
+struct lsp_chan {
+	int refs;
+	int size;
+	long* seqs;
+	lval** vals;
+	long head;   // Position of the next send
+	long tail;   // Position of the next recv
+	int closed;
+	
+	// Threads waiting on the channel sleep on wake, broadcast whenever it changes
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int sleepers;
+};
+
+static long chan_atomic_add(long* p, long n) {
+#ifdef _WIN32
+	return *p += n;
+#else
+	return __sync_add_and_fetch(p, n);
+#endif
+}
+
+static int chan_atomic_cas(long* p, long old, long n) {
+#ifdef _WIN32
+	if (*p != old) { return 0; }
+	*p = n;
+	return 1;
+#else
+	return __sync_bool_compare_and_swap(p, old, n);
+#endif
+}
+
+static lsp_chan* chan_new(int size) {
+	lsp_chan* c = calloc(1, sizeof(lsp_chan));
+	c->refs = 1;
+	c->size = size;
+	c->seqs = malloc(sizeof(long) * size);
+	c->vals = malloc(sizeof(lval*) * size);
+	for (int i = 0; i < size; i++) { c->seqs[i] = i; }
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->wake, NULL);
+	return c;
+}
+
+static lval* chan_pop(lsp_chan* c);
+
+static void chan_ref(lsp_chan* c, int n) {
+	// Add n references to a channel, freeing it and the values left in it after the last one
+	if (pool_atomic_add(&c->refs, n) > 0) { return; }
+	lval* v;
+	while ((v = chan_pop(c))) { lval_del(v); }
+	pthread_cond_destroy(&c->wake);
+	pthread_mutex_destroy(&c->lock);
+	free(c->seqs);
+	free(c->vals);
+	free(c);
+}
+
+static int chan_push(lsp_chan* c, lval* v) {
+	// Put v in the ring unless it is full, returns whether it did
+	long pos = chan_atomic_add(&c->head, 0);
+	while (1) {
+		int i = pos % c->size;
+		long dif = chan_atomic_add(&c->seqs[i], 0) - pos;
+		if (dif == 0 && chan_atomic_cas(&c->head, pos, pos + 1)) {
+			c->vals[i] = v;
+			chan_atomic_add(&c->seqs[i], 1);
+			return 1;
+		}
+		if (dif < 0) { return 0; }
+		pos = chan_atomic_add(&c->head, 0);
+	}
+}
+
+static lval* chan_pop(lsp_chan* c) {
+	// Take the oldest value out of the ring, NULL if it is empty
+	long pos = chan_atomic_add(&c->tail, 0);
+	while (1) {
+		int i = pos % c->size;
+		long dif = chan_atomic_add(&c->seqs[i], 0) - (pos + 1);
+		if (dif == 0 && chan_atomic_cas(&c->tail, pos, pos + 1)) {
+			lval* v = c->vals[i];
+			chan_atomic_add(&c->seqs[i], c->size - 1);
+			return v;
+		}
+		if (dif < 0) { return NULL; }
+		pos = chan_atomic_add(&c->tail, 0);
+	}
+}
+
+static int chan_ready(lsp_chan* c, int send) {
+	// Whether a send or recv would not block, or the channel is closed
+	if (pool_atomic_add(&c->closed, 0)) { return 1; }
+	long pos = chan_atomic_add(send ? &c->head : &c->tail, 0);
+	long seq = chan_atomic_add(&c->seqs[pos % c->size], 0);
+	return send ? seq >= pos : seq >= pos + 1;
+}
+
+static void chan_signal(lsp_chan* c) {
+	// Wake the threads sleeping on a channel, if any
+	if (pool_atomic_add(&c->sleepers, 0) == 0) { return; }
+	pthread_mutex_lock(&c->lock);
+	pthread_cond_broadcast(&c->wake);
+	pthread_mutex_unlock(&c->lock);
+}
+
+static void chan_wait(lsp_state* state, lsp_chan* c, int send) {
+	// Sleep until a send or recv on the channel may no longer block
+	lsp_pool* pool = (state->owner ? state->owner : state)->pool;
+	if (pool && pool_atomic_add(&pool->queued, 0) > 0 && pool_atomic_add(&pool->idle, 0) == 0
+		&& !pool_grow(pool)) {
+		// Without threads the tasks can only run here
+		lsp_task* t = pool_take(pool, state);
+		if (t) {
+			t->run(state, t);
+			return;
+		}
+	}
+	
+	pthread_mutex_lock(&c->lock);
+	pool_atomic_add(&c->sleepers, 1);
+	if (!chan_ready(c, send)) { pthread_cond_wait(&c->wake, &c->lock); }
+	pool_atomic_add(&c->sleepers, -1);
+	pthread_mutex_unlock(&c->lock);
+}
+
+static lval* builtin_chan(lenv* env, lval* args) {
+	// Builtin function "chan": Takes a capacity and returns a new channel holding that many values
+	
+	LASSERT_NUM("chan", args, 1);
+	LASSERT_TYPE("chan", args, 0, LVAL_NUM);
+	
+	double size = args->cell[0]->num;
+	LASSERT(args, size >= 1 && size <= (1 << 24) && size == (int)size,
+		"Function 'chan' passed capacity %g. Expected a whole number from 1 to %i", size, 1 << 24);
+	
+	lval_del(args);
+	return lval_chan(chan_new((int)size));
+}
+
+static lval* builtin_send(lenv* env, lval* args) {
+	// Builtin function "send": Takes a channel and a value, which it puts in the channel once
+	// there is room
+	
+	LASSERT_NUM("send", args, 2);
+	LASSERT_TYPE("send", args, 0, LVAL_CHAN);
+	
+	lsp_chan* c = args->cell[0]->chan;
+	lval* v = lval_pop(args, 1);
+	while (!pool_atomic_add(&c->closed, 0)) {
+		if (chan_push(c, v)) {
+			chan_signal(c);
+			lval_del(args);
+			return lval_sexpr();
+		}
+		chan_wait(lenv_state(env), c, 1);
+	}
+	
+	lval_del(v);
+	lval_del(args);
+	return lval_err("Function 'send' passed a closed channel");
+}
+
+static lval* builtin_recv(lenv* env, lval* args) {
+	// Builtin function "recv": Takes a channel and returns the oldest value in it once there is one
+	
+	LASSERT_NUM("recv", args, 1);
+	LASSERT_TYPE("recv", args, 0, LVAL_CHAN);
+	
+	lsp_chan* c = args->cell[0]->chan;
+	while (1) {
+		// Values sent before the channel was closed are still received
+		int closed = pool_atomic_add(&c->closed, 0);
+		lval* v = chan_pop(c);
+		if (v) {
+			chan_signal(c);
+			lval_del(args);
+			return v;
+		}
+		LASSERT(args, !closed, "Function 'recv' passed a closed channel with nothing left in it");
+		chan_wait(lenv_state(env), c, 0);
+	}
+}
+
+static lval* builtin_close(lenv* env, lval* args) {
+	// Builtin function "close": Takes a channel and closes it, waking anyone waiting on it
+	
+	LASSERT_NUM("close", args, 1);
+	LASSERT_TYPE("close", args, 0, LVAL_CHAN);
+	
+	lsp_chan* c = args->cell[0]->chan;
+	pool_atomic_add(&c->closed, 1);
+	chan_signal(c);
+	
+	lval_del(args);
+	return lval_sexpr();
+}
+
+// Generators
+
+// A generator produces values one at a time, as they are pulled from it. The ones made by gen
+// evaluate an expression as a coroutine with a stack of its own: yield hands a value to whoever
+// pulls and suspends the expression until the next pull. The native ones compute each value as
+// it is pulled, from a range or from another generator or list for gen-map, gen-filter and
+// gen-take, so a chain of them holds one item at a time however long the sequence. Reading a
+// lazy sequence is done by one more kind, see Sequences
+//
+// A generator ends after its last value or an error. Deleting one while it is suspended resumes
+// it a last time with any S-expression evaluating to an error, unwinding its stack so that what
+// it held is freed
+
+#define GEN_STACK (8 << 20)
+
+enum { GEN_BODY, GEN_LIST, GEN_RANGE, GEN_MAP, GEN_FILTER, GEN_TAKE, GEN_SEQ };
+
+struct lsp_gen {
+	int refs;
+	int kind;
+	int running;     // Pulling from a generator already running is an error
+	int done;
+	
+	lsp_gen* src;    // Generator pulled from by map, filter and take
+	lval* f;         // Function of map and filter, or the list of a list generator
+	double i, end;   // Position and end of a range or list, values left for take
+	
+	// Cursor of a sequence, its stages from the source on and what each has left to take or drop
+	lsp_seq** stages;
+	double* left;
+	int count;
+	
+	// Coroutine of gen, started on the first pull
+	lval* body;
+	lenv* env;
+	lval* value;     // Handed over by yield, or the error the expression returned
+	int started;
+	int finished;
+	int cancel;
+#ifdef _WIN32
+	void* fiber;
+	void* caller;
+#else
+	ucontext_t ctx;
+	ucontext_t caller;
+	char* stack;
+#endif
+};
+
+// Innermost generator whose expression runs on this thread
+static LSP_THREAD_LOCAL lsp_gen* gen_self;
+
+static int gen_cancelled(void) {
+	return gen_self && gen_self->cancel;
+}
+
+static lsp_gen* gen_new(int kind) {
+	lsp_gen* g = calloc(1, sizeof(lsp_gen));
+	g->refs = 1;
+	g->kind = kind;
+	return g;
+}
+
+static void gen_run(lsp_gen* g) {
+	// Evaluate the expression of a generator on its stack, an error it returns is its last value
+	lval* body = g->body;
+	g->body = NULL;
+	lval* result = lval_eval(g->env, body);
+	if (result->type == LVAL_ERR && !g->cancel) {
+		g->value = result;
+	} else {
+		lval_del(result);
+		g->value = NULL;
+	}
+	g->finished = 1;
+}
+
+#ifdef _WIN32
+
+static void CALLBACK gen_fiber(void* arg) {
+	lsp_gen* g = arg;
+	gen_run(g);
+	SwitchToFiber(g->caller);
+}
+
+#else
+
+static void gen_start(void) {
+	// Entry point of a coroutine, returning to the context in uc_link
+	gen_run(gen_self);
+}
+
+#endif
+
+static void gen_free_stack(lsp_gen* g) {
+#ifdef _WIN32
+	if (g->fiber) { DeleteFiber(g->fiber); }
+	g->fiber = NULL;
+#else
+	if (g->stack) { munmap(g->stack, GEN_STACK); }
+	g->stack = NULL;
+#endif
+}
+
+static lval* gen_resume(lsp_gen* g) {
+	// Run the expression of a generator until it yields or returns, returns the value yielded,
+	// the error it returned or NULL
+	if (g->finished) { return NULL; }
+	
+#ifdef _WIN32
+	if (!g->fiber) { g->fiber = CreateFiberEx(0, GEN_STACK, 0, gen_fiber, g); }
+	if (!g->fiber) {
+#else
+	if (!g->stack) {
+		// Pages are only committed as the stack grows into them, the lowest one faults on overflow
+		char* stack = mmap(NULL, GEN_STACK, PROT_READ | PROT_WRITE,
+		                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (stack != MAP_FAILED) {
+			mprotect(stack, 4096, PROT_NONE);
+			g->stack = stack;
+			getcontext(&g->ctx);
+			g->ctx.uc_stack.ss_sp = stack;
+			g->ctx.uc_stack.ss_size = GEN_STACK;
+			g->ctx.uc_link = &g->caller;
+			makecontext(&g->ctx, gen_start, 0);
+		}
+	}
+	if (!g->stack) {
+#endif
+		g->finished = 1;
+		return lval_err("Could not allocate a stack for a generator");
+	}
+	
+	g->started = 1;
+	lsp_gen* prev = gen_self;
+	gen_self = g;
+#ifdef _WIN32
+	if (!IsThreadAFiber()) { ConvertThreadToFiber(NULL); }
+	g->caller = GetCurrentFiber();
+	SwitchToFiber(g->fiber);
+#else
+	swapcontext(&g->caller, &g->ctx);
+#endif
+	gen_self = prev;
+	
+	if (g->finished) { gen_free_stack(g); }
+	lval* v = g->value;
+	g->value = NULL;
+	return v;
+}
+
+static void gen_ref(lsp_gen* g, int n) {
+	// Add n references to a generator, freeing it after the last one
+	if (pool_atomic_add(&g->refs, n) > 0) { return; }
+	
+	if (g->started && !g->finished) {
+		// Suspended
+		g->cancel = 1;
+		lval* v = gen_resume(g);
+		if (v) { lval_del(v); }
+	}
+	if (g->kind == GEN_LIST) {
+		// Values before i were moved out
+		for (int i = (int)g->i; i < g->f->count; i++) { lval_del(g->f->cell[i]); }
+		free(g->f->cell);
+		free(g->f);
+	} else if (g->f) {
+		lval_del(g->f);
+	}
+	
+	if (g->stages) {
+		seq_ref(g->stages[g->count - 1], -1);
+		free(g->stages);
+		free(g->left);
+	}
+	
+	if (g->src)  { gen_ref(g->src, -1); }
+	if (g->body) { lval_del(g->body); }
+	if (g->env)  { lenv_del(g->env); }
+	gen_free_stack(g);
+	free(g);
+}
+
+static lval* gen_test(lenv* env, lval* f, lval* x, char* func) {
+	// Call a predicate on x, returns the Boolean it returned or an error
+	lval* keep = par_call(env, f, x, NULL);
+	if (keep->type == LVAL_BOOL || keep->type == LVAL_ERR) { return keep; }
+	
+	lval* err = lval_err("Function '%s' passed a function returning %s. Expected %s",
+		func, ltype_name(keep->type), ltype_name(LVAL_BOOL));
+	lval_del(keep);
+	return err;
+}
+
+static lval* seq_pull(lenv* env, lsp_gen* g);
+
+static lval* gen_next(lenv* env, lsp_gen* g) {
+	// Pull the next value from a generator, NULL once there are none
+	if (g->done) { return NULL; }
+	if (pool_atomic_add(&g->running, 1) > 1) {
+		pool_atomic_add(&g->running, -1);
+		return lval_err("Cannot pull from a generator already running");
+	}
+	
+	lval* v = NULL;
+	switch (g->kind) {
+		case GEN_BODY:
+			v = gen_resume(g);
+			break;
+		case GEN_LIST:
+			if (g->i < g->f->count) { v = g->f->cell[(int)g->i++]; }
+			break;
+		case GEN_RANGE:
+			if (g->i < g->end) { v = lval_num(g->i++); }
+			break;
+		case GEN_MAP:
+			v = gen_next(env, g->src);
+			if (v && v->type != LVAL_ERR) { v = par_call(env, g->f, v, NULL); }
+			break;
+		case GEN_FILTER:
+			while ((v = gen_next(env, g->src)) && v->type != LVAL_ERR) {
+				lval* keep = gen_test(env, g->f, lval_copy(v), "gen-filter");
+				if (keep->type == LVAL_ERR) {
+					lval_del(v);
+					v = keep;
+					break;
+				}
+				int kept = keep->num != 0;
+				lval_del(keep);
+				if (kept) { break; }
+				lval_del(v);
+			}
+			break;
+		case GEN_TAKE:
+			if (g->i >= 1) {
+				g->i--;
+				v = gen_next(env, g->src);
+			}
+			break;
+		case GEN_SEQ:
+			v = seq_pull(env, g);
+			break;
+	}
+	
+	if (!v || v->type == LVAL_ERR) { g->done = 1; }
+	pool_atomic_add(&g->running, -1);
+	return v;
+}
+
+#define LASSERT_SEQ(func, args, index) \
+	LASSERT(args, args->cell[index]->type == LVAL_GEN || args->cell[index]->type == LVAL_SEQ \
+		|| args->cell[index]->type == LVAL_QEXPR, \
+		"Function '%s' passed incorrect type for argument %i. Expected %s, %s or %s, " \
+		"was given %s", func, index, ltype_name(LVAL_GEN), ltype_name(LVAL_SEQ), \
+		ltype_name(LVAL_QEXPR), ltype_name(args->cell[index]->type));
+
+static lsp_gen* seq_open(lsp_seq* s);
+
+static lsp_gen* gen_arg(lval* args, int i) {
+	// Generator of an argument, taking a list out of args
+	lval* v = args->cell[i];
+	if (v->type == LVAL_GEN) {
+		gen_ref(v->gen, 1);
+		return v->gen;
+	}
+	if (v->type == LVAL_SEQ) { return seq_open(v->seq); }
+	lsp_gen* g = gen_new(GEN_LIST);
+	g->f = v;
+	args->cell[i] = lval_sexpr();
+	return g;
+}
+
+static lval* builtin_gen(lenv* env, lval* args) {
+	// Builtin function "gen": Takes a Q-expression and returns a generator of the values it
+	// yields when evaluated as an S-expression
+	
+	LASSERT_NUM("gen", args, 1);
+	LASSERT_TYPE("gen", args, 0, LVAL_QEXPR);
+	
+	// Like a future it may run once the caller returned, so it keeps the locals it names
+	lsp_state* state = lenv_state(env);
+	lsp_gen* g = gen_new(GEN_BODY);
+	g->body = lval_take(args, 0);
+	g->body->type = LVAL_SEXPR;
+	g->env = lenv_new();
+	future_capture(g->env, env, g->body);
+	g->env->state = state;
+	g->env->parent = (state->owner ? state->owner : state)->env;
+	return lval_gen(g);
+}
+
+static lval* builtin_yield(lenv* env, lval* args) {
+	// Builtin function "yield": Hands a value to whoever pulls from the generator running, and
+	// returns once the next value is pulled
+	
+	LASSERT_NUM("yield", args, 1);
+	lsp_gen* g = gen_self;
+	LASSERT(args, g, "Function 'yield' called outside of a generator");
+	
+	g->value = lval_take(args, 0);
+#ifdef _WIN32
+	SwitchToFiber(g->caller);
+#else
+	swapcontext(&g->ctx, &g->caller);
+#endif
+	return g->cancel ? lval_err("Generator was deleted") : lval_sexpr();
+}
+
+static lval* builtin_next(lenv* env, lval* args) {
+	// Builtin function "next": Takes a generator and returns its next value in a Q-expression,
+	// which is empty once there are none
+	
+	LASSERT_NUM("next", args, 1);
+	LASSERT_TYPE("next", args, 0, LVAL_GEN);
+	
+	lval* v = gen_next(env, args->cell[0]->gen);
+	lval_del(args);
+	if (!v) { return lval_qexpr(); }
+	if (v->type == LVAL_ERR) { return v; }
+	return lval_add(lval_qexpr(), v);
+}
+
+static lval* builtin_gen_range(lenv* env, lval* args) {
+	// Builtin function "gen-range": Generator of the numbers from 0, or the first argument, up to
+	// the last one excluded
+	
+	LASSERT(args, args->count == 1 || args->count == 2,
+		"Function 'gen-range' passed incorrect number of arguments. Expected 1 or 2, was given %i",
+		args->count);
+	for (int i = 0; i < args->count; i++) { LASSERT_TYPE("gen-range", args, i, LVAL_NUM); }
+	
+	lsp_gen* g = gen_new(GEN_RANGE);
+	g->i = args->count == 2 ? args->cell[0]->num : 0;
+	g->end = args->cell[args->count - 1]->num;
+	lval_del(args);
+	return lval_gen(g);
+}
+
+static lval* gen_stage(lval* args, int kind, char* func) {
+	// Generator applying a function to the values of a generator or list
+	LASSERT_NUM(func, args, 2);
+	LASSERT_TYPE(func, args, 0, LVAL_FUN);
+	LASSERT_SEQ(func, args, 1);
+	
+	lsp_gen* g = gen_new(kind);
+	g->src = gen_arg(args, 1);
+	g->f = lval_pop(args, 0);
+	lval_del(args);
+	return lval_gen(g);
+}
+
+static lval* builtin_gen_map(lenv* env, lval* args) {
+	// Builtin function "gen-map": Same as map, as a generator
+	return gen_stage(args, GEN_MAP, "gen-map");
+}
+
+static lval* builtin_gen_filter(lenv* env, lval* args) {
+	// Builtin function "gen-filter": Same as filter, as a generator
+	return gen_stage(args, GEN_FILTER, "gen-filter");
+}
+
+static lval* builtin_gen_take(lenv* env, lval* args) {
+	// Builtin function "gen-take": Generator of the first n values of a generator or list
+	
+	LASSERT_NUM("gen-take", args, 2);
+	LASSERT_TYPE("gen-take", args, 0, LVAL_NUM);
+	LASSERT_SEQ("gen-take", args, 1);
+	
+	lsp_gen* g = gen_new(GEN_TAKE);
+	g->i = args->cell[0]->num;
+	g->src = gen_arg(args, 1);
+	lval_del(args);
+	return lval_gen(g);
+}
+
+static lval* builtin_gen_foldl(lenv* env, lval* args) {
+	// Builtin function "gen-foldl": Same as foldl, pulling values from a generator or list
+	
+	LASSERT_NUM("gen-foldl", args, 3);
+	LASSERT_TYPE("gen-foldl", args, 0, LVAL_FUN);
+	LASSERT_SEQ("gen-foldl", args, 2);
+	
+	lsp_gen* g = gen_arg(args, 2);
+	lval* acc = lval_pop(args, 1);
+	lval* x;
+	while (acc->type != LVAL_ERR && (x = gen_next(env, g))) {
+		if (x->type == LVAL_ERR) {
+			lval_del(acc);
+			acc = x;
+		} else {
+			acc = par_call(env, args->cell[0], acc, x);
+		}
+	}
+	
+	gen_ref(g, -1);
+	lval_del(args);
+	return acc;
+}
+
+static lval* builtin_gen_each(lenv* env, lval* args) {
+	// Builtin function "gen-each": Calls a function on every value of a generator or list
+	
+	LASSERT_NUM("gen-each", args, 2);
+	LASSERT_TYPE("gen-each", args, 0, LVAL_FUN);
+	LASSERT_SEQ("gen-each", args, 1);
+	
+	lsp_gen* g = gen_arg(args, 1);
+	lval* result = lval_sexpr();
+	lval* x;
+	while (result->type != LVAL_ERR && (x = gen_next(env, g))) {
+		lval_del(result);
+		result = x->type == LVAL_ERR ? x : par_call(env, args->cell[0], x, NULL);
+	}
+	if (result->type != LVAL_ERR) {
+		lval_del(result);
+		result = lval_sexpr();
+	}
+	
+	gen_ref(g, -1);
+	lval_del(args);
+	return result;
+}
+
+static lval* gen_drain(lenv* env, lsp_gen* g) {
+	// List of all values left in a generator, or the error it ended with
+	lval* list = lval_qexpr();
+	lval* x;
+	while ((x = gen_next(env, g))) {
+		if (x->type == LVAL_ERR) {
+			lval_del(list);
+			return x;
+		}
+		lval_add(list, x);
+	}
+	return list;
+}
+
+static lval* builtin_gen_list(lenv* env, lval* args) {
+	// Builtin function "gen-list": Takes a generator and returns a list of all its values
+	
+	LASSERT_NUM("gen-list", args, 1);
+	LASSERT_SEQ("gen-list", args, 0);
+	
+	lsp_gen* g = gen_arg(args, 0);
+	lval* list = gen_drain(env, g);
+	gen_ref(g, -1);
+	lval_del(args);
+	return list;
+}
+
+// Sequences
+
+// A sequence is a lazy list. range, range-from and iterate make one without computing any of its
+// values, and map, filter, take, take-while, drop and drop-while of the prelude only add a stage
+// on top of one they are given. A sequence never changes, its copies share it and each use reads
+// it from the start again
+//
+// Reading one opens a cursor on it, a generator taking each value from the source through every
+// stage in a single loop, so a chain of stages is one pass with no list built in between. Stage
+// functions run when the sequence is read, which may be after the caller returned, so a lambda
+// keeps copies of the local variables it names as gen does. A builtin expecting a list is given
+// one of all the values, which an endless sequence only has after a take or take-while
+
+enum { SEQ_RANGE, SEQ_ITERATE, SEQ_MAP, SEQ_FILTER, SEQ_TAKE, SEQ_TAKE_WHILE, SEQ_DROP,
+       SEQ_DROP_WHILE };
+
+struct lsp_seq {
+	int refs;
+	int kind;
+	int depth;       // Stages from the source up to this one
+	lsp_seq* src;    // Stage values come from, NULL for the source
+	lval* f;         // Function of a stage or of iterate
+	lval* x;         // First value of iterate
+	double a, b;     // Start and end of a range, values to take or drop
+};
+
+static lsp_seq* seq_new(int kind, lsp_seq* src) {
+	// New stage over src, taking over a reference to it
+	lsp_seq* s = calloc(1, sizeof(lsp_seq));
+	s->refs = 1;
+	s->kind = kind;
+	s->src = src;
+	s->depth = src ? src->depth + 1 : 1;
+	return s;
+}
+
+static void seq_ref(lsp_seq* s, int n) {
+	// Add n references to a sequence, freeing it after the last one and then its stages below
+	while (s && pool_atomic_add(&s->refs, n) <= 0) {
+		lsp_seq* src = s->src;
+		if (s->f) { lval_del(s->f); }
+		if (s->x) { lval_del(s->x); }
+		free(s);
+		s = src;
+		n = -1;
+	}
+}
+
+static int seq_endless(lsp_seq* s) {
+	// Whether a sequence goes on forever, a take-while is trusted to end it
+	for (; s; s = s->src) {
+		if (s->kind == SEQ_TAKE || s->kind == SEQ_TAKE_WHILE) { return 0; }
+		if (s->kind == SEQ_ITERATE) { return 1; }
+		if (s->kind == SEQ_RANGE) { return isinf(s->b); }
+	}
+	return 0;
+}
+
+static lsp_gen* seq_open(lsp_seq* s) {
+	// Cursor reading a sequence from its first value
+	lsp_gen* g = gen_new(GEN_SEQ);
+	g->count = s->depth;
+	g->stages = malloc(sizeof(lsp_seq*) * g->count);
+	g->left = malloc(sizeof(double) * g->count);
+	seq_ref(s, 1);
+	for (int k = g->count - 1; k >= 0; k--, s = s->src) {
+		g->stages[k] = s;
+		g->left[k] = s->b;
+		// Nothing gets past a take of no values, so the source is not even read
+		if (s->kind == SEQ_TAKE && s->b < 1) { g->done = 1; }
+	}
+	g->i = g->stages[0]->a;
+	return g;
+}
+
+static lval* seq_pull(lenv* env, lsp_gen* g) {
+	// Next value out of the last stage of a sequence, NULL once there are none
+	while (!g->done) {
+		lsp_seq* s = g->stages[0];
+		lval* x;
+		if (s->kind == SEQ_RANGE) {
+			if (g->i >= s->b) { return NULL; }
+			x = lval_num(g->i++);
+		} else {
+			// Iterate keeps the last value it gave to compute the next one from
+			x = g->f ? par_call(env, s->f, g->f, NULL) : lval_copy(s->x);
+			g->f = NULL;
+			if (x->type == LVAL_ERR) { return x; }
+			g->f = lval_copy(x);
+		}
+		
+		// A stage leaving x out goes back for another value from the source
+		for (int k = 1; x && k < g->count; k++) {
+			s = g->stages[k];
+			switch (s->kind) {
+				case SEQ_MAP:
+					x = par_call(env, s->f, x, NULL);
+					if (x->type == LVAL_ERR) { return x; }
+					break;
+				case SEQ_TAKE:
+					if (--g->left[k] < 1) { g->done = 1; }
+					break;
+				case SEQ_DROP:
+					if (g->left[k] >= 1) {
+						g->left[k]--;
+						lval_del(x);
+						x = NULL;
+					}
+					break;
+				case SEQ_FILTER:
+				case SEQ_TAKE_WHILE:
+				case SEQ_DROP_WHILE: {
+					// A drop-while is done once a value fails its test, left is set then
+					if (s->kind == SEQ_DROP_WHILE && g->left[k]) { break; }
+					lval* keep = gen_test(env, s->f, lval_copy(x),
+						s->kind == SEQ_FILTER ? "filter"
+						: s->kind == SEQ_TAKE_WHILE ? "take-while" : "drop-while");
+					if (keep->type == LVAL_ERR) {
+						lval_del(x);
+						return keep;
+					}
+					int kept = keep->num != 0;
+					lval_del(keep);
+					
+					if (s->kind == SEQ_DROP_WHILE) {
+						if (!kept) { g->left[k] = 1; break; }
+					} else if (kept) {
+						break;
+					} else if (s->kind == SEQ_TAKE_WHILE) {
+						g->done = 1;
+					}
+					lval_del(x);
+					x = NULL;
+					break;
+				}
+			}
+		}
+		if (x) { return x; }
+	}
+	return NULL;
+}
+
+static lval* seq_list(lenv* env, lval* v, char* func) {
+	// List of all values of a sequence, for func which expects one
+	if (seq_endless(v->seq)) {
+		lval_del(v);
+		return lval_err("Function '%s' passed an endless %s, take a part of it first",
+			func, ltype_name(LVAL_SEQ));
+	}
+	lsp_gen* g = seq_open(v->seq);
+	lval_del(v);
+	lval* list = gen_drain(env, g);
+	gen_ref(g, -1);
+	return list;
+}
+
+static lval* seq_head(lenv* env, lval* v) {
+	// First value of a sequence in a Q-expression, the only one computed
+	lsp_gen* g = seq_open(v->seq);
+	lval_del(v);
+	lval* x = gen_next(env, g);
+	gen_ref(g, -1);
+	
+	if (!x) {
+		return lval_err("Function 'head' passed empty %s, must contain at least one element",
+			ltype_name(LVAL_SEQ));
+	}
+	return x->type == LVAL_ERR ? x : lval_add(lval_qexpr(), x);
+}
+
+static lval* seq_lists(lenv* env, lval* v) {
+	// Replace the sequences in a value by lists of their values, except endless ones, for it to
+	// be printed or handed back to C
+	if (v->type == LVAL_SEQ && !seq_endless(v->seq)) { v = seq_list(env, v, "print"); }
+	if (v->type == LVAL_QEXPR || v->type == LVAL_SEXPR) {
+		for (int i = 0; i < v->count; i++) { v->cell[i] = seq_lists(env, v->cell[i]); }
+	}
+	return v;
+}
+
+static lval* seq_fun(lenv* env, lval* f) {
+	// Function of a stage, a lambda with copies of the local variables it names
+	if (!f->builtin) { future_capture(f->env, env, f->body); }
+	return f;
+}
+
+static lval* builtin_range(lenv* env, lval* args) {
+	// Builtin function "range": Sequence of the numbers from 0, or the first argument, up to the
+	// last one excluded
+	
+	LASSERT(args, args->count == 1 || args->count == 2,
+		"Function 'range' passed incorrect number of arguments. Expected 1 or 2, was given %i",
+		args->count);
+	for (int i = 0; i < args->count; i++) { LASSERT_TYPE("range", args, i, LVAL_NUM); }
+	
+	lsp_seq* s = seq_new(SEQ_RANGE, NULL);
+	s->a = args->count == 2 ? args->cell[0]->num : 0;
+	s->b = args->cell[args->count - 1]->num;
+	lval_del(args);
+	return lval_seq(s);
+}
+
+static lval* builtin_range_from(lenv* env, lval* args) {
+	// Builtin function "range-from": Endless sequence of the numbers from the one given
+	
+	LASSERT_NUM("range-from", args, 1);
+	LASSERT_TYPE("range-from", args, 0, LVAL_NUM);
+	
+	lsp_seq* s = seq_new(SEQ_RANGE, NULL);
+	s->a = args->cell[0]->num;
+	s->b = INFINITY;
+	lval_del(args);
+	return lval_seq(s);
+}
+
+static lval* builtin_iterate(lenv* env, lval* args) {
+	// Builtin function "iterate": Takes a function and a value x, returns the endless sequence
+	// of x, f(x), f(f(x)) and so on
+	
+	LASSERT_NUM("iterate", args, 2);
+	LASSERT_TYPE("iterate", args, 0, LVAL_FUN);
+	
+	lsp_seq* s = seq_new(SEQ_ITERATE, NULL);
+	s->f = seq_fun(env, lval_pop(args, 0));
+	s->x = lval_take(args, 0);
+	return lval_seq(s);
+}
+
+static lval* builtin_is_seq(lenv* env, lval* args) {
+	// Builtin function "is-seq": Takes a value and returns whether it is a sequence
+	
+	LASSERT_NUM("is-seq", args, 1);
+	
+	int result = args->cell[0]->type == LVAL_SEQ;
+	lval_del(args);
+	return lval_bool(result);
+}
+
+static lval* seq_stage(lenv* env, lval* args, int kind, char* func) {
+	// Sequence adding a stage on top of another, the first argument is its function or count
+	LASSERT_NUM(func, args, 2);
+	int counted = kind == SEQ_TAKE || kind == SEQ_DROP;
+	int expected = counted ? LVAL_NUM : LVAL_FUN;
+	LASSERT_TYPE(func, args, 0, expected);
+	LASSERT_TYPE(func, args, 1, LVAL_SEQ);
+	
+	lsp_seq* src = args->cell[1]->seq;
+	lsp_seq* s;
+	if (counted) {
+		double n = args->cell[0]->num >= 1 ? floor(args->cell[0]->num) : 0;
+		if (src->kind == SEQ_RANGE) {
+			// Taking from or dropping from a range is another range
+			s = seq_new(SEQ_RANGE, NULL);
+			s->a = kind == SEQ_DROP ? src->a + n : src->a;
+			s->b = kind == SEQ_TAKE && src->a + n < src->b ? src->a + n : src->b;
+		} else {
+			seq_ref(src, 1);
+			s = seq_new(kind, src);
+			s->b = n;
+		}
+	} else {
+		seq_ref(src, 1);
+		s = seq_new(kind, src);
+		s->f = seq_fun(env, lval_pop(args, 0));
+	}
+	
+	lval_del(args);
+	return lval_seq(s);
+}
+
+static lval* builtin_seq_map(lenv* env, lval* args) {
+	// Builtin function "seq-map": Same as map, lazily on a sequence. map calls it for one
+	return seq_stage(env, args, SEQ_MAP, "seq-map");
+}
+
+static lval* builtin_seq_filter(lenv* env, lval* args) {
+	// Builtin function "seq-filter": Same as filter, lazily on a sequence. filter calls it for one
+	return seq_stage(env, args, SEQ_FILTER, "seq-filter");
+}
+
+static lval* builtin_seq_take(lenv* env, lval* args) {
+	// Builtin function "seq-take": Same as take, lazily on a sequence. take calls it for one
+	return seq_stage(env, args, SEQ_TAKE, "seq-take");
+}
+
+static lval* builtin_seq_take_while(lenv* env, lval* args) {
+	// Builtin function "seq-take-while": Same as take-while, lazily on a sequence.
+	// take-while calls it for one
+	return seq_stage(env, args, SEQ_TAKE_WHILE, "seq-take-while");
+}
+
+static lval* builtin_seq_drop(lenv* env, lval* args) {
+	// Builtin function "seq-drop": Same as drop, lazily on a sequence. drop calls it for one
+	return seq_stage(env, args, SEQ_DROP, "seq-drop");
+}
+
+static lval* builtin_seq_drop_while(lenv* env, lval* args) {
+	// Builtin function "seq-drop-while": Same as drop-while, lazily on a sequence.
+	// drop-while calls it for one
+	return seq_stage(env, args, SEQ_DROP_WHILE, "seq-drop-while");
+}
+
+// Frozen environments
+
+// Freezing an interpreter moves the bindings of its global environment to a new one below it,
+// which never changes again, leaving the global one empty for later definitions that shadow any
+// of the same name. Values are only ever copied out of an environment, so none reachable from a
+// frozen one is changed either, and any number of threads may read it without locks. The
+// standard library is evaluated first, it could no longer be added as it is looked up
+
+static void prelude_force_all(lsp_state* state);
+
+static void globals_freeze(lsp_state* state) {
+	prelude_force_all(state);
+	
+	lenv* env = state->env;
+	if (env->count == 0) { return; }
+	
+	// The global environment itself stays, environments of code running point to it
+	lenv* frozen = lenv_new();
+	frozen->state = state;
+	frozen->frozen = 1;
+	frozen->parent = env->parent;
+	frozen->count = env->count;
+	frozen->syms = env->syms;
+	frozen->vals = env->vals;
+	
+	env->parent = frozen;
+	env->count = 0;
+	env->syms = NULL;
+	env->vals = NULL;
+}
+
+static void globals_flatten(lenv* dst, lenv* env) {
+	// Put the bindings of env and of the frozen environments below it into dst, newest last
+	if (env->parent) { globals_flatten(dst, env->parent); }
+	for (int i = 0; i < env->count; i++) {
+		lval* key = lval_sym(env->syms[i]);
+		lenv_put(dst, key, env->vals[i]);
+		lval_del(key);
+	}
+}
+
+static lval* builtin_freeze(lenv* env, lval* args) {
+	// Builtin function "freeze": Freezes what the global environment holds so far
+	// Like "env" it ignores its arguments, a lone symbol evaluates to the function: (freeze ())
+	
+	// Threads may be reading the global environment
+	lsp_state* state = lenv_state(env);
+	lenv* global = env;
+	while (!global->state && global->parent) { global = global->parent; }
+	LASSERT(args, global == state->env, "Function 'freeze' cannot be called from a parallel task");
+	LASSERT(args, !state->pool || pool_atomic_add(&state->pool->futures, 0) == 0,
+		"Function 'freeze' cannot be called while futures are running");
+	
+	globals_freeze(state);
+	lval_del(args);
+	return lval_sexpr();
+}
+
+// Server
+
+// lsp_serve answers clients of a Unix domain socket, each request evaluated as the REPL would.
+// A request is the length of the source that follows in 4 bytes, most significant first, and its
+// response is framed the same way around what print wrote during it followed by the result
+//
+// A single thread waits on all connections with epoll, reading requests and writing responses
+// without blocking, and hands requests to the thread pool, started with the standard library
+// frozen and a thread more than usual since this one runs no tasks. Every connection is a session
+// with an environment of its own over the global one, so a client only sees what it defined
+// itself. Requests of a session are evaluated one at a time, in the order they came. A client may
+// shut down its side once it sent its last request, the session then goes after answering them
+//
+// Anyone able to connect to the socket can run any Lsp code, but no more than that: clients get
+// no access to files. load is replaced in the global environment while serving, where sessions,
+// futures and generators all find it, so only the files given to the server before it started
+// are loaded, and no client can read another file or leave a compiled module next to it. It stays
+// replaced after the server stops, since futures of clients may still be running
+
+#ifdef __linux__
+
+#define SERVE_MAX (16 << 20)  // Longest request, a client sending one longer is disconnected
+#define SERVE_EVENTS 64
+
+typedef struct serve_session serve_session;
+typedef struct serve_task serve_task;
+
+struct serve_session {
+	int fd;
+	lenv* env;
+	char* in;                  // Bytes read not yet handed out as a request
+	size_t in_len, in_size;
+	char* out;                 // Responses not yet written, from out_pos on
+	size_t out_len, out_pos, out_size;
+	int busy;                  // A request is being evaluated
+	int closed;                // The connection is gone, the session goes once not busy
+	int eof;                   // The client sent all it will, no longer read
+	uint32_t events;           // What epoll waits for on the socket
+	serve_session* prev;
+	serve_session* next;
+};
+
+typedef struct {
+	lsp_state* state;
+	lsp_pool* pool;
+	int epoll;
+	int listener;
+	int wake[2];               // Pipe a task writes to once done, to wake the epoll thread
+	pthread_mutex_t lock;
+	serve_task* done;          // Tasks done, their responses not yet queued
+	int pending;               // Tasks not done
+	serve_session* sessions;
+	serve_session* dropped;    // Sessions closed while handling events, freed after them
+} lsp_server;
+
+struct serve_task {
+	lsp_task task;
+	lsp_server* server;
+	serve_session* session;
+	char* input;
+	size_t len;
+	lval_text out;             // Response, its length first
+	serve_task* next;
+};
+
+static volatile sig_atomic_t serve_stop;
+static int serve_wake;
+
+static lval* builtin_serve_load(lenv* env, lval* args) {
+	// Builtin function "load" for clients of the server, which may not read files
+	lval_del(args);
+	return lval_err("Function 'load' is not available to clients of the server");
+}
+
+static void serve_signal(int sig) {
+	// Any thread may get the signal, the pipe wakes the epoll thread
+	char c = 0;
+	serve_stop = 1;
+	if (write(serve_wake, &c, 1) < 0) {}
+}
+
+static void serve_run(lsp_state* state, lsp_task* task) {
+	// Evaluate a request on a pool thread, capturing what it prints into the response
+	serve_task* t = (serve_task*)task;
+	lsp_server* server = t->server;
+	
+	// Tasks waiting on others may run another request meanwhile
+	print_sink* capture = print_capture;
+	print_capture = sink_new();
+	t->session->env->state = state;
+	lval* v = lval_eval_source(t->session->env, "<request>", t->input, t->len);
+	v = seq_lists(t->session->env, v);
+	
+	text_init(&t->out);
+	text_add(&t->out, "\0\0\0\0", 4);
+	sink_close(print_capture, &t->out);
+	sink_ref(print_capture, -1);
+	print_capture = capture;
+	lval_write(&t->out, v);
+	lval_del(v);
+	
+	size_t len = t->out.len - 4;
+	unsigned char* header = (unsigned char*)t->out.data;
+	header[0] = len >> 24; header[1] = len >> 16; header[2] = len >> 8; header[3] = len;
+	free(t->input);
+	t->input = NULL;
+	
+	pthread_mutex_lock(&server->lock);
+	t->next = server->done;
+	server->done = t;
+	pthread_mutex_unlock(&server->lock);
+	
+	// The pipe being full already wakes the epoll thread
+	char c = 0;
+	if (write(server->wake[1], &c, 1) < 0) {}
+	pool_done(server->pool, &server->pending);
+}
+
+static void serve_drop(lsp_server* server, serve_session* s) {
+	// Close a session, freed later as events for it may still be waiting to be handled
+	if (s->prev) { s->prev->next = s->next; } else { server->sessions = s->next; }
+	if (s->next) { s->next->prev = s->prev; }
+	
+	close(s->fd);
+	s->closed = 1;
+	s->next = server->dropped;
+	server->dropped = s;
+}
+
+static void serve_free(serve_session* s) {
+	lenv_del(s->env);
+	free(s->in);
+	free(s->out);
+	free(s);
+}
+
+static void serve_dispatch(lsp_server* server, serve_session* s) {
+	// Hand the next complete request of a session to the pool, unless one is running
+	if (s->busy || s->closed || s->in_len < 4) { return; }
+	
+	unsigned char* header = (unsigned char*)s->in;
+	size_t len = (size_t)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+	if (len > SERVE_MAX) {
+		serve_drop(server, s);
+		return;
+	}
+	if (s->in_len < 4 + len) { return; }
+	
+	serve_task* t = calloc(1, sizeof(serve_task));
+	t->task.run = serve_run;
+	t->server = server;
+	t->session = s;
+	t->input = malloc(len + 1);
+	memcpy(t->input, s->in + 4, len);
+	t->input[len] = '\0';
+	t->len = len;
+	
+	s->in_len -= 4 + len;
+	memmove(s->in, s->in + 4 + len, s->in_len);
+	
+	s->busy = 1;
+	pool_atomic_add(&server->pending, 1);
+	pool_push(server->pool, server->state, &t->task);
+}
+
+static int serve_watch(lsp_server* server, serve_session* s, int writing) {
+	// Wait for the socket of a session to be writable too, or no longer, and readable until the
+	// client sent all it will
+	struct epoll_event ev;
+	ev.events = (s->eof ? 0 : EPOLLIN) | (writing ? EPOLLOUT : 0);
+	ev.data.ptr = s;
+	if (s->events == ev.events) { return 1; }
+	s->events = ev.events;
+	return epoll_ctl(server->epoll, EPOLL_CTL_MOD, s->fd, &ev) == 0;
+}
+
+static void serve_end(lsp_server* server, serve_session* s) {
+	// Close a session whose client sent all it will once every request of it is answered
+	if (s->eof && !s->closed && !s->busy && s->out_len == 0) { serve_drop(server, s); }
+}
+
+static int serve_write(lsp_server* server, serve_session* s) {
+	// Write as much of the responses of a session as the socket takes, returns 0 on failure
+	while (s->out_pos < s->out_len) {
+		ssize_t n = send(s->fd, s->out + s->out_pos, s->out_len - s->out_pos, MSG_NOSIGNAL);
+		if (n > 0) {
+			s->out_pos += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return serve_watch(server, s, 1);
+		} else {
+			return 0;
+		}
+	}
+	s->out_pos = s->out_len = 0;
+	return serve_watch(server, s, 0);
+}
+
+static int serve_read(lsp_server* server, serve_session* s) {
+	// Read what the client sent and dispatch a request, returns 0 once the connection is gone
+	while (!s->eof) {
+		if (s->in_len == s->in_size) {
+			s->in_size = s->in_size ? s->in_size * 2 : 4096;
+			s->in = realloc(s->in, s->in_size);
+		}
+		ssize_t n = read(s->fd, s->in + s->in_len, s->in_size - s->in_len);
+		if (n > 0) {
+			s->in_len += n;
+			if (s->in_len > SERVE_MAX + 4) { return 0; }
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else if (n == 0) {
+			// Shut down for writing, the responses may still be waited for
+			s->eof = 1;
+			if (!serve_watch(server, s, (s->events & EPOLLOUT) != 0)) { return 0; }
+		} else {
+			return 0;
+		}
+	}
+	serve_dispatch(server, s);
+	return 1;
+}
+
+static void serve_accept(lsp_server* server) {
+	// Start a session for every connection waiting
+	for (;;) {
+		int fd = accept(server->listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) { continue; }
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		
+		serve_session* s = calloc(1, sizeof(serve_session));
+		s->fd = fd;
+		s->env = lenv_new();
+		s->env->parent = server->state->env;
+		s->events = EPOLLIN;
+		
+		struct epoll_event ev;
+		ev.events = s->events;
+		ev.data.ptr = s;
+		if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			close(fd);
+			serve_free(s);
+			continue;
+		}
+		s->next = server->sessions;
+		if (s->next) { s->next->prev = s; }
+		server->sessions = s;
+	}
+}
+
+static void serve_finish(lsp_server* server) {
+	// Queue the responses of tasks done, then start the next request of their sessions
+	char buf[256];
+	while (read(server->wake[0], buf, sizeof(buf)) > 0) {}
+	
+	pthread_mutex_lock(&server->lock);
+	serve_task* t = server->done;
+	server->done = NULL;
+	pthread_mutex_unlock(&server->lock);
+	
+	while (t) {
+		serve_task* next = t->next;
+		serve_session* s = t->session;
+		s->busy = 0;
+		
+		if (s->closed) {
+			// Dropped while busy, so not freed along with the others
+			s->next = server->dropped;
+			server->dropped = s;
+		} else {
+			if (s->out_len + t->out.len > s->out_size) {
+				s->out_size = s->out_size ? s->out_size : 4096;
+				while (s->out_len + t->out.len > s->out_size) { s->out_size *= 2; }
+				s->out = realloc(s->out, s->out_size);
+			}
+			memcpy(s->out + s->out_len, t->out.data, t->out.len);
+			s->out_len += t->out.len;
+			
+			if (!serve_write(server, s)) { serve_drop(server, s); }
+			else                         { serve_dispatch(server, s); }
+			serve_end(server, s);
+		}
+		
+		text_free(&t->out);
+		free(t);
+		t = next;
+	}
+}
+
+static void serve_free_dropped(lsp_server* server) {
+	// Free sessions dropped while handling events, except those with a request still running
+	serve_session* s = server->dropped;
+	server->dropped = NULL;
+	while (s) {
+		serve_session* next = s->next;
+		if (!s->busy) { serve_free(s); }
+		s = next;
+	}
+}
+
+static void serve_events(lsp_server* server) {
+	struct epoll_event events[SERVE_EVENTS];
+	while (!serve_stop) {
+		int n = epoll_wait(server->epoll, events, SERVE_EVENTS, -1);
+		if (n < 0 && errno != EINTR) { return; }
+		
+		for (int i = 0; i < n; i++) {
+			void* ptr = events[i].data.ptr;
+			if (ptr == &server->listener) { serve_accept(server); continue; }
+			if (ptr == server->wake)      { serve_finish(server); continue; }
+			
+			serve_session* s = ptr;
+			if (s->closed) { continue; }
+			int ok = 1;
+			if (events[i].events & EPOLLOUT) { ok = serve_write(server, s); }
+			if (ok && events[i].events & EPOLLIN) { ok = serve_read(server, s); }
+			
+			// Reported even when not waited for, once the client can no longer get responses
+			if (events[i].events & (EPOLLHUP | EPOLLERR)) { ok = 0; }
+			if (!ok) { serve_drop(server, s); }
+			else     { serve_end(server, s); }
+		}
+		serve_free_dropped(server);
+	}
+}
+
+int lsp_serve(lsp_state* state, char* path) {
+	// Answer clients of a Unix domain socket at path until interrupted, returns 0 on failure
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) { return 0; }
+	strcpy(addr.sun_path, path);
+	
+	// A socket left by a server that did not exit cleanly is replaced, any other file is not
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) { unlink(path); }
+	
+	lsp_server server;
+	memset(&server, 0, sizeof(server));
+	server.state = state;
+	server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server.listener < 0) { return 0; }
+	if (bind(server.listener, (struct sockaddr*)&addr, sizeof(addr)) != 0
+		|| listen(server.listener, SOMAXCONN) != 0 || pipe(server.wake) != 0) {
+		close(server.listener);
+		return 0;
+	}
+	int fds[3] = { server.listener, server.wake[0], server.wake[1] };
+	for (int i = 0; i < 3; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	
+	server.epoll = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &server.listener;
+	epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.listener, &ev);
+	ev.data.ptr = server.wake;
+	epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.wake[0], &ev);
+	pthread_mutex_init(&server.lock, NULL);
+	
+	// Interrupted system calls return instead of restarting, so that the loop sees the signal
+	struct sigaction sa, old_int, old_term;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal;
+	sigemptyset(&sa.sa_mask);
+	serve_stop = 0;
+	serve_wake = server.wake[1];
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+	
+	server.pool = pool_get(state);
+	pool_grow(server.pool);
+	lenv_add_builtin(state->env, "load", builtin_serve_load);
+	serve_events(&server);
+	
+	// Requests running are finished, their responses are not sent
+	while (server.sessions) { serve_drop(&server, server.sessions); }
+	serve_free_dropped(&server);
+	pool_wait(server.pool, state, &server.pending);
+	serve_finish(&server);
+	serve_free_dropped(&server);
+	
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+	pthread_mutex_destroy(&server.lock);
+	close(server.epoll);
+	close(server.listener);
+	close(server.wake[0]);
+	close(server.wake[1]);
+	unlink(path);
+	return 1;
+}
+
+#else
+
+int lsp_serve(lsp_state* state, char* path) {
+	// Sessions are multiplexed with epoll, so there is no server elsewhere
+	return 0;
+}
+
+#endif
+
+// Library interface
+
+lsp_state* lsp_new(char* image) {
+	// Create an interpreter, loading the standard library from an image if given and up to date
+	lsp_state* state = lsp_state_new();
+	if (!image || !image_load(state, image)) { prelude_load(state, 1); }
+	return state;
+}
+
+void lsp_delete(lsp_state* state) {
+	lsp_state_del(state);
+}
+
+lval* lsp_eval_string(lsp_state* state, char* filename, char* input) {
+	// Evaluate every expression in a string as the REPL does, returning the result
+	lval* result = lval_eval_source(state->env, filename, input, strlen(input));
+	return seq_lists(state->env, result);
+}
+
+lval* lsp_eval_file(lsp_state* state, char* filename) {
+	// Same as (load filename), "-" reads standard input
+	return builtin_load(state->env, lval_add(lval_sexpr(), lval_str(filename)));
+}
+
+lval* lsp_call(lsp_state* state, char* name, int argc, lval** argv) {
+	// Call a global function, taking ownership of the arguments
+	lval* args = lval_sexpr();
+	for (int i = 0; i < argc; i++) { lval_add(args, argv[i]); }
+	
+	lval* key = lval_sym(name);
+	lval* f = lenv_get(state->env, key);
+	lval_del(key);
+	
+	// Unbound symbol
+	if (f->type == LVAL_ERR) {
+		lval_del(args);
+		return f;
+	}
+	
+	if (f->type != LVAL_FUN) {
+		lval* err = lval_err("Cannot call '%s'. Expected %s, was given %s",
+		                     name, ltype_name(LVAL_FUN), ltype_name(f->type));
+		lval_del(f); lval_del(args);
+		return err;
+	}
+	
+	lval* result = lval_call(state->env, f, args);
+	lval_del(f);
+	return seq_lists(state->env, result);
+}
+
+void lsp_add_builtin(lsp_state* state, char* name, lbuiltin func) {
+	lenv_add_builtin(state->env, name, func);
+}
+
+void lsp_freeze(lsp_state* state) {
+	globals_freeze(state);
+}
+
+int lsp_dump_image(lsp_state* state, char* filename) {
+	// Evaluate what is left of the standard library, then save the global environment
+	prelude_force_all(state);
+	if (!state->env->parent) { return image_dump(state->env, filename); }
+	
+	// Frozen environments are saved as one
+	lenv* env = lenv_new();
+	globals_flatten(env, state->env);
+	int ok = image_dump(env, filename);
+	lenv_del(env);
+	return ok;
+}
+
+int lval_type(lval* v) {
+	return v->type;
+}
+
+double lval_to_num(lval* v) {
+	return (v->type == LVAL_NUM || v->type == LVAL_BOOL) ? v->num : 0;
+}
+
+char* lval_to_str(lval* v) {
+	switch (v->type) {
+		case LVAL_SYM: return v->sym;
+		case LVAL_ERR: return v->err;
+		case LVAL_STR: return v->str;
+		default:       return NULL;
+	}
+}
+
+int lval_count(lval* v) {
+	return (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) ? v->count : 0;
+}
+
+lval* lval_child(lval* v, int i) {
+	return (i >= 0 && i < lval_count(v)) ? v->cell[i] : NULL;
+}
@@ -0,0 +1,104 @@
+#ifndef lsp_h
+#define lsp_h
+
+// Lsp as a library, built from lsp.c and mpc.c. The REPL in repl.c is one client of it
+//
+// Values and interpreters are opaque, so programs built against this header keep working when
+// their layout changes. An lval returned by any function here belongs to the caller, who must
+// free it with lval_del, and an lval passed in is taken over unless said otherwise. The same
+// applies to native builtins, which receive their arguments as an S-expression to delete
+//
+// A lazy sequence returned to C, by evaluating a string or calling a function, comes back as a
+// list of its values unless it is endless
+
+#include <stddef.h>
+
+struct lval;
+struct lenv;
+struct lsp_state;
+
+typedef struct lval lval;
+typedef struct lenv lenv;
+typedef struct lsp_state lsp_state;
+
+typedef lval*(*lbuiltin)(lenv*, lval*);
+
+enum { // Valid lval types
+	   LVAL_NUM,   LVAL_SYM,  LVAL_BOOL,
+	   LVAL_ERR,   LVAL_FUN,  LVAL_STR,
+	   LVAL_SEXPR, LVAL_QEXPR,
+	   LVAL_FUT,   LVAL_CHAN, LVAL_GEN,
+	   LVAL_SEQ };
+
+// Interpreters
+
+// Create an interpreter, mapping the standard library from an image written by lsp_dump_image
+// if the file exists and matches, otherwise evaluating it as needed. image may be NULL
+lsp_state* lsp_new(char* image);
+void lsp_delete(lsp_state* state);
+
+// Evaluate all expressions in a string, as typed into the REPL. filename only names the
+// input in parse errors, which come back as an error lval
+lval* lsp_eval_string(lsp_state* state, char* filename, char* input);
+
+// Length of the first top level expression in the n bytes at s, with the whitespace and comments
+// before it, 0 if it is not all there yet. With eof set no more input follows, and whatever is
+// left is taken whole, for lsp_eval_string to report what it lacks. This lets a program reading
+// input in blocks evaluate each expression as soon as it is complete
+size_t lsp_form_length(char* s, size_t n, int eof);
+
+// Evaluate a script as (load filename) does, printing errors of its expressions as they occur
+lval* lsp_eval_file(lsp_state* state, char* filename);
+
+// Call the global function name with argc arguments
+lval* lsp_call(lsp_state* state, char* name, int argc, lval** argv);
+
+// Bind a native function to a global name. Builtins added this way cannot be saved in images,
+// and neither can futures, channels, generators or sequences
+void lsp_add_builtin(lsp_state* state, char* name, lbuiltin func);
+
+// Interpreter a builtin is running in, from the environment it is given
+lsp_state* lenv_state(lenv* env);
+
+// Make what the global environment holds so far read-only, later definitions shadowing it, so
+// that threads can share it without locks. Parallel builtins do so themselves when first used
+void lsp_freeze(lsp_state* state);
+
+// Answer clients of a Unix domain socket at path until SIGINT or SIGTERM, each request evaluated
+// by the thread pool in an environment of the client's own over the global one. Requests and
+// responses are a 4 byte big-endian length followed by that many bytes: the source to evaluate,
+// then what it printed, from any thread, and its result. Clients cannot read files: load is
+// unavailable to Lsp code from then on, only lsp_eval_file still loads scripts. Returns 0 if it
+// could not listen, or not on Linux
+int lsp_serve(lsp_state* state, char* path);
+
+// Save the global environment, with the whole standard library evaluated, returns 0 on failure
+int lsp_dump_image(lsp_state* state, char* filename);
+
+// Values
+
+lval* lval_num(double x);
+lval* lval_bool(double x);
+lval* lval_sym(char* s);
+lval* lval_str(char* s);
+lval* lval_err(char* fmt, ...);
+lval* lval_sexpr(void);
+lval* lval_qexpr(void);
+
+lval* lval_add(lval* v, lval* x);  // Append x to an expression, returns v
+lval* lval_pop(lval* v, int i);    // Remove the i-th child and return it
+lval* lval_take(lval* v, int i);   // Same as lval_pop, then delete v
+lval* lval_copy(lval* v);
+void  lval_del(lval* v);
+
+int    lval_type(lval* v);
+char*  ltype_name(int t);
+double lval_to_num(lval* v);       // Number or Boolean, 0 for any other type
+char*  lval_to_str(lval* v);       // Symbol, String or Error text, owned by v, NULL otherwise
+int    lval_count(lval* v);        // Children of an expression, 0 for any other type
+lval*  lval_child(lval* v, int i); // Owned by v, NULL if out of range
+
+void lval_print(lval* v);
+void lval_println(lval* v);
+
+#endif
@@ -1,5 +1,30 @@
 #include "mpc.h"
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#if !defined(MPC_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MPC_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/*
+** The few globals below are written while parsing, so each thread gets its own
+** copy wherever the compiler can do that, letting threads parse concurrently
+*/
+
+#if defined(__GNUC__)
+#define MPC_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define MPC_THREAD_LOCAL __declspec(thread)
+#else
+#define MPC_THREAD_LOCAL
+#endif
+
 /*
 ** State Type
 */
@@ -43,9 +68,8 @@ static mpc_state_t mpc_state_new(void) {
 ** The final mode is Pipe. This is the difficult
 ** one. As we assume pipes cannot be seeked - and
 ** only support a single character lookahead at
-** any point, when the input is marked for a
-** potential backtracking we start buffering any
-** input.
+** any point, everything read is kept in a buffer
+** for as long as a mark might still rewind to it.
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
@@ -55,12 +79,24 @@ static mpc_state_t mpc_state_new(void) {
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
 **
+** Whole files given by name are instead mapped
+** into memory where possible (Mmap) and scanned
+** just like a String, only bounded by length
+** rather than a terminating null. Otherwise they
+** are read in large blocks into a String.
+**
+** A Borrow is scanned the same way, but over a
+** buffer owned by the caller, so nothing is
+** copied and nothing is freed afterwards.
+**
 */
 
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3,
+  MPC_INPUT_BORROW = 4
 };
 
 enum {
@@ -68,12 +104,41 @@ enum {
 };
 
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_ARENA_MIN     = 16384,
+  MPC_INPUT_ARENA_LARGE   = 1024,
+  MPC_INPUT_ARENA_CLASSES = MPC_INPUT_ARENA_LARGE / 8 + 2
+};
+
+enum {
+  MPC_INPUT_BLOCK_SIZE = 65536
 };
 
+typedef struct mpc_block_t {
+  struct mpc_block_t *next;
+  size_t size;
+  size_t used;
+} mpc_block_t;
+
+typedef struct {
+  long allocs;
+  long reuses;
+  long blocks;
+  long fallbacks;
+} mpc_arena_stats_t;
+
+static MPC_THREAD_LOCAL mpc_arena_stats_t mpc_arena_stats;
+
 typedef struct {
-  char mem[64];
-} mpc_mem_t;
+  mpc_parser_t *p;
+  long pos;
+  char mode;
+  char ok;
+  char last;
+  mpc_state_t state;
+  mpc_ast_t *output;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+} mpc_memo_t;
 
 typedef struct {
 
@@ -82,7 +147,11 @@ typedef struct {
   mpc_state_t state;
 
   char *string;
+  long length;
   char *buffer;
+  long buffer_start;
+  long buffer_num;
+  long buffer_slots;
   FILE *file;
 
   int suppress;
@@ -94,9 +163,12 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  int memo_num;
+  int memo_slots;
+  mpc_memo_t *memo;
+
+  mpc_block_t *arena;
+  void *arena_free[MPC_INPUT_ARENA_CLASSES];
 
 } mpc_input_t;
 
@@ -110,9 +182,13 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
   i->state = mpc_state_new();
 
-  i->string = malloc(strlen(string) + 1);
+  i->length = strlen(string);
+  i->string = malloc(i->length + 1);
   strcpy(i->string, string);
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
 
   i->suppress = 0;
@@ -123,8 +199,12 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+
+  i->arena = NULL;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
 
   return i;
 }
@@ -142,7 +222,11 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
+  i->length = strlen(i->string);
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
 
   i->suppress = 0;
@@ -153,8 +237,12 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+
+  i->arena = NULL;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
 
   return i;
 
@@ -171,7 +259,11 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = pipe;
 
   i->suppress = 0;
@@ -182,8 +274,12 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+
+  i->arena = NULL;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
 
   return i;
 
@@ -199,7 +295,11 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
 
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = file;
 
   i->suppress = 0;
@@ -210,48 +310,202 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+
+  i->arena = NULL;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
 
   return i;
 }
 
-static void mpc_input_delete(mpc_input_t *i) {
+static mpc_input_t *mpc_input_new_buffer(const char *filename, int type, char *string, long length) {
 
-  free(i->filename);
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
 
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  i->type = type;
+  i->state = mpc_state_new();
 
-  free(i->marks);
-  free(i->lasts);
-  free(i);
+  i->string = string;
+  i->length = length;
+  i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
+  i->file = NULL;
+
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+
+  i->arena = NULL;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
+
+  return i;
+}
+
+static mpc_input_t *mpc_input_new_mmap(const char *filename) {
+
+#if defined(_WIN32)
+  (void)filename;
+  return NULL;
+#else
+  int fd;
+  void *map;
+  struct stat st;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) { return NULL; }
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) { return NULL; }
+
+  return mpc_input_new_buffer(filename, MPC_INPUT_MMAP, map, st.st_size);
+#endif
+}
+
+static mpc_input_t *mpc_input_new_read(const char *filename, FILE *file) {
+
+  size_t n, length = 0, slots = MPC_INPUT_BLOCK_SIZE;
+  char *string = malloc(slots + 1);
+
+  while ((n = fread(string + length, 1, slots - length, file)) > 0) {
+    length += n;
+    if (length == slots) {
+      slots = slots * 2;
+      string = realloc(string, slots + 1);
+    }
+  }
+
+  string[length] = '\0';
+  return mpc_input_new_buffer(filename, MPC_INPUT_STRING, string, length);
+}
+
+/*
+** Everything allocated while parsing comes from
+** a per input arena of blocks, each allocation
+** prefixed with its size. Freeing the most recent
+** allocation of a block gives the space back,
+** anything else is put on a free list for its
+** size and handed out again by the next request
+** of that size. The whole arena is reclaimed at
+** once when the parse ends.
+**
+** Large allocations, and anything which must
+** outlive the parse, go through `malloc` and are
+** copied out with `mpc_export` respectively.
+*/
+
+static size_t mpc_arena_size(size_t n) {
+  if (n == 0) { n = 1; }
+  return sizeof(size_t) + ((n + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1));
+}
+
+static size_t mpc_arena_class(size_t n) {
+  return mpc_arena_size(n) / sizeof(size_t);
+}
+
+static char *mpc_block_data(mpc_block_t *b) {
+  return (char*)(b + 1);
+}
+
+static mpc_block_t *mpc_block_find(mpc_input_t *i, void *p) {
+  mpc_block_t *b;
+  for (b = i->arena; b; b = b->next) {
+    if ((char*)p >  mpc_block_data(b)
+    &&  (char*)p <  mpc_block_data(b) + b->used) { return b; }
+  }
+  return NULL;
+}
+
+static size_t mpc_block_alloc_size(void *p) {
+  return ((size_t*)p)[-1];
+}
+
+static int mpc_block_alloc_last(mpc_block_t *b, void *p) {
+  return (char*)p - sizeof(size_t) + mpc_arena_size(mpc_block_alloc_size(p))
+    == mpc_block_data(b) + b->used;
 }
 
-static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+static void mpc_input_arena_reset(mpc_input_t *i) {
+
+  mpc_block_t *b;
+
+  if (i->arena == NULL) { return; }
+
+  while (i->arena->next) {
+    b = i->arena->next;
+    i->arena->next = b->next;
+    free(b);
+  }
+
+  i->arena->used = 0;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
+}
+
+static void mpc_input_arena_delete(mpc_input_t *i) {
+  mpc_block_t *b;
+  while (i->arena) {
+    b = i->arena;
+    i->arena = b->next;
+    free(b);
+  }
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
+
+  size_t m = mpc_arena_size(n);
+  size_t size;
+  mpc_block_t *b = i->arena;
   char *p;
 
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  if (n > MPC_INPUT_ARENA_LARGE) {
+    mpc_arena_stats.fallbacks++;
+    return malloc(n);
+  }
 
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  p = i->arena_free[mpc_arena_class(n)];
+  if (p) {
+    i->arena_free[mpc_arena_class(n)] = *(void**)p;
+    ((size_t*)p)[-1] = n;
+    mpc_arena_stats.allocs++;
+    mpc_arena_stats.reuses++;
+    return p;
+  }
+
+  if (b == NULL || b->used + m > b->size) {
+    size = b ? b->size * 2 : MPC_INPUT_ARENA_MIN;
+    b = malloc(sizeof(mpc_block_t) + size);
+    b->next = i->arena;
+    b->size = size;
+    b->used = 0;
+    i->arena = b;
+    mpc_arena_stats.blocks++;
+  }
+
+  p = mpc_block_data(b) + b->used;
+  *(size_t*)p = n;
+  b->used += m;
+  mpc_arena_stats.allocs++;
 
-  return malloc(n);
+  return p + sizeof(size_t);
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -261,37 +515,93 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
-  if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  mpc_block_t *b = mpc_block_find(i, p);
+  if (b == NULL) { free(p); return; }
+  if (mpc_block_alloc_last(b, p)) {
+    b->used -= mpc_arena_size(mpc_block_alloc_size(p));
+  } else {
+    *(void**)p = i->arena_free[mpc_arena_class(mpc_block_alloc_size(p))];
+    i->arena_free[mpc_arena_class(mpc_block_alloc_size(p))] = p;
+  }
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
   char *q = NULL;
+  size_t o;
+  mpc_block_t *b = mpc_block_find(i, p);
+
+  if (b == NULL) { return realloc(p, n); }
+
+  o = mpc_block_alloc_size(p);
 
-  if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  if (n <= MPC_INPUT_ARENA_LARGE && mpc_arena_class(n) == mpc_arena_class(o)) {
+    ((size_t*)p)[-1] = n;
+    return p;
+  }
 
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
-    mpc_free(i, p);
-    return q;
+  if (n <= MPC_INPUT_ARENA_LARGE && mpc_block_alloc_last(b, p)
+  &&  b->used - mpc_arena_size(o) + mpc_arena_size(n) <= b->size) {
+    b->used = b->used - mpc_arena_size(o) + mpc_arena_size(n);
+    ((size_t*)p)[-1] = n;
+    return p;
   }
 
-  return p;
+  q = mpc_malloc(i, n);
+  memcpy(q, p, o < n ? o : n);
+  mpc_free(i, p);
+  return q;
 }
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
-  if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  if (mpc_block_find(i, p) == NULL) { return p; }
+  q = malloc(mpc_block_alloc_size(p));
+  memcpy(q, p, mpc_block_alloc_size(p));
   mpc_free(i, p);
   return q;
 }
 
+static void mpc_input_memo_clear(mpc_input_t *i) {
+
+  int j;
+
+  for (j = 0; j < i->memo_slots; j++) {
+    if (i->memo[j].p == NULL) { continue; }
+    if (i->memo[j].output) { mpc_ast_delete(i->memo[j].output); }
+    if (i->memo[j].error)  { mpc_err_delete(i->memo[j].error); }
+    if (i->memo[j].merged) { mpc_err_delete(i->memo[j].merged); }
+    i->memo[j].p = NULL;
+  }
+  i->memo_num = 0;
+}
+
+static void mpc_input_delete(mpc_input_t *i) {
+
+  long k;
+
+  free(i->filename);
+
+  mpc_input_memo_clear(i);
+  free(i->memo);
+
+  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+#if !defined(_WIN32)
+  if (i->type == MPC_INPUT_MMAP) { munmap(i->string, i->length); }
+#endif
+  if (i->type == MPC_INPUT_PIPE) {
+    for (k = i->buffer_num - 1; k >= i->state.pos - i->buffer_start; k--) {
+      ungetc(i->buffer[k], i->file);
+    }
+    free(i->buffer);
+  }
+
+  mpc_input_arena_delete(i);
+  free(i->marks);
+  free(i->lasts);
+  free(i);
+}
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -313,14 +623,9 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
-  int j;
 
   if (i->backtrack < 1) { return; }
 
@@ -335,14 +640,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    for (j = strlen(i->buffer) - 1; j >= 0; j--)
-      ungetc(i->buffer[j], i->file);
-
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
@@ -359,12 +656,58 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
+/*
+** Every character read from a pipe is appended
+** to the buffer, which holds the input from
+** position `buffer_start` onwards. Reads behind
+** the end of the buffer come straight from it so
+** rewinding is just a matter of restoring state.
+**
+** When the buffer fills, anything before both the
+** earliest mark and the cursor can never be read
+** again, so it is dropped first. The buffer only
+** doubles if that frees less than half of it,
+** keeping appends amortised constant time.
+*/
+
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+  return i->state.pos < i->buffer_start + i->buffer_num;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+  return i->buffer[i->state.pos - i->buffer_start];
+}
+
+static void mpc_input_buffer_push(mpc_input_t *i, char c) {
+
+  long keep, drop;
+
+  if (i->buffer_num == i->buffer_slots) {
+
+    keep = i->state.pos;
+    if (i->marks_num > 0 && i->marks[0].pos < keep) { keep = i->marks[0].pos; }
+    drop = keep - i->buffer_start;
+
+    if (drop > 0 && drop >= i->buffer_slots / 2) {
+      memmove(i->buffer, i->buffer + drop, i->buffer_num - drop);
+      i->buffer_start += drop;
+      i->buffer_num -= drop;
+    } else {
+      i->buffer_slots = i->buffer_slots ? i->buffer_slots * 2 : MPC_INPUT_BLOCK_SIZE;
+      i->buffer = realloc(i->buffer, i->buffer_slots);
+    }
+  }
+
+  i->buffer[i->buffer_num++] = c;
+}
+
+static char mpc_input_pipe_getc(mpc_input_t *i) {
+  int c;
+  if (mpc_input_buffer_in_range(i)) { return mpc_input_buffer_get(i); }
+  c = getc(i->file);
+  if (c == EOF) { return '\0'; }
+  mpc_input_buffer_push(i, c);
+  return c;
 }
 
 static char mpc_input_getc(mpc_input_t *i) {
@@ -374,18 +717,10 @@ static char mpc_input_getc(mpc_input_t *i) {
   switch (i->type) {
 
     case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_MMAP:
+    case MPC_INPUT_BORROW: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) { c = getc(i->file); return c; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+    case MPC_INPUT_PIPE: return mpc_input_pipe_getc(i);
 
     default: return c;
   }
@@ -397,6 +732,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
 
   switch (i->type) {
     case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_MMAP:
+    case MPC_INPUT_BORROW: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE:
 
       c = fgetc(i->file);
@@ -405,23 +742,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
       fseek(i->file, -1, SEEK_CUR);
       return c;
 
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+    case MPC_INPUT_PIPE: return mpc_input_pipe_getc(i);
 
     default: return c;
   }
@@ -437,30 +758,14 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
   switch (i->type) {
     case MPC_INPUT_STRING: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) { ungetc(c, i->file); break; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
     default: { break; }
   }
+  (void) c;
   return 0;
 }
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
 
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -479,6 +784,22 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   return 1;
 }
 
+static void mpc_input_consume(mpc_input_t *i, const char *s, long n) {
+
+  const char *p = s, *e = s + n, *nl;
+
+  if (n == 0) { return; }
+
+  while ((nl = memchr(p, '\n', e - p))) {
+    i->state.row++;
+    p = nl + 1;
+  }
+
+  i->state.col = p == s ? i->state.col + n : e - p;
+  i->state.pos += n;
+  i->last = s[n-1];
+}
+
 static int mpc_input_any(mpc_input_t *i, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
@@ -601,7 +922,7 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
+static MPC_THREAD_LOCAL char char_unescape_buffer[4];
 
 static const char *mpc_err_char_unescape(char c) {
 
@@ -862,6 +1183,7 @@ static mpc_err_t *mpc_err_count(mpc_input_t *i, mpc_err_t *x, int n) {
   mpc_err_t *y;
   int digits = n/10 + 1;
   char *prefix;
+  if (x == NULL) { return NULL; }
   prefix = mpc_malloc(i, digits + strlen(" of ") + 1);
   sprintf(prefix, "%i of ", n);
   y = mpc_err_repeat(i, x, prefix);
@@ -914,7 +1236,10 @@ enum {
   MPC_TYPE_CHECK_WITH = 26,
 
   MPC_TYPE_SOI        = 27,
-  MPC_TYPE_EOI        = 28
+  MPC_TYPE_EOI        = 28,
+
+  MPC_TYPE_DFA        = 29,
+  MPC_TYPE_MEMO       = 30
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -932,8 +1257,12 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_with_t f; void *d; ch
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; unsigned char *jump; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { char until; char num; unsigned char bytes[6]; } mpc_dfa_skip_t;
+typedef struct { char *re; int num; int *trans; char *accept; mpc_dfa_skip_t *skip; } mpc_pdata_dfa_t;
+typedef struct { long lookups; long hits; long entries; long bytes; } mpc_memo_stats_t;
+typedef struct { mpc_parser_t *x; mpc_memo_stats_t *stats; } mpc_pdata_memo_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -953,6 +1282,8 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_memo_t memo;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -1032,84 +1363,614 @@ static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   d(mpc_export(i, x));
 }
 
+/*
+** Byte Scanning
+**
+** Runs of bytes which all belong to (or all lie
+** outside of) a small set are measured in bulk,
+** sixteen bytes at a time with SSE2 or thirty two
+** with AVX2, picked by a check of the running CPU
+** on first use. Building with `MPC_NO_SIMD`, or
+** for any other target, uses the scalar loop.
+*/
+
 enum {
-  MPC_PARSE_STACK_MIN = 4
+  MPC_SCAN_MAX = 6
 };
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+typedef long (*mpc_scan_t)(const unsigned char *s, long n, const unsigned char *set, int k, int until);
+
+static long mpc_scan_scalar(const unsigned char *s, long n, const unsigned char *set, int k, int until) {
+  long j;
+  int q, in;
+  for (j = 0; j < n; j++) {
+    in = 0;
+    for (q = 0; q < k; q++) { in |= s[j] == set[q]; }
+    if (in == until) { return j; }
+  }
+  return n;
+}
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+#if defined(MPC_SIMD_X86)
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+__attribute__((target("sse2")))
+static long mpc_scan_sse2(const unsigned char *s, long n, const unsigned char *set, int k, int until) {
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  long j = 0;
+  int q;
+  unsigned int mask;
+  __m128i x, eq, v[MPC_SCAN_MAX];
 
-  if (depth == MPC_MAX_RECURSION_DEPTH)
-  {
-    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  for (q = 0; q < k; q++) { v[q] = _mm_set1_epi8((char)set[q]); }
+
+  for (; j + 16 <= n; j += 16) {
+    x = _mm_loadu_si128((const __m128i*)(s + j));
+    eq = _mm_setzero_si128();
+    for (q = 0; q < k; q++) { eq = _mm_or_si128(eq, _mm_cmpeq_epi8(x, v[q])); }
+    mask = (unsigned int)_mm_movemask_epi8(eq);
+    if (!until) { mask = ~mask & 0xFFFF; }
+    if (mask) { return j + __builtin_ctz(mask); }
   }
 
-  switch (p->type) {
+  return j + mpc_scan_scalar(s + j, n - j, set, k, until);
+}
 
-    /* Basic Parsers */
+__attribute__((target("avx2")))
+static long mpc_scan_avx2(const unsigned char *s, long n, const unsigned char *set, int k, int until) {
 
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
-    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+  long j = 0;
+  int q;
+  unsigned int mask;
+  __m256i x, eq, v[MPC_SCAN_MAX];
 
-    /* Other parsers */
+  for (q = 0; q < k; q++) { v[q] = _mm256_set1_epi8((char)set[q]); }
 
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+  for (; j + 32 <= n; j += 32) {
+    x = _mm256_loadu_si256((const __m256i*)(s + j));
+    eq = _mm256_setzero_si256();
+    for (q = 0; q < k; q++) { eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(x, v[q])); }
+    mask = (unsigned int)_mm256_movemask_epi8(eq);
+    if (!until) { mask = ~mask; }
+    if (mask) { return j + __builtin_ctz(mask); }
+  }
 
-    /* Application Parsers */
+  return j + mpc_scan_sse2(s + j, n - j, set, k, until);
+}
 
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
+#endif
 
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
+static long mpc_scan_select(const unsigned char *s, long n, const unsigned char *set, int k, int until);
+
+static MPC_THREAD_LOCAL mpc_scan_t mpc_scan = mpc_scan_select;
+
+static long mpc_scan_select(const unsigned char *s, long n, const unsigned char *set, int k, int until) {
+#if defined(MPC_SIMD_X86)
+  __builtin_cpu_init();
+  if      (__builtin_cpu_supports("avx2")) { mpc_scan = mpc_scan_avx2; }
+  else if (__builtin_cpu_supports("sse2")) { mpc_scan = mpc_scan_sse2; }
+  else                                     { mpc_scan = mpc_scan_scalar; }
+#else
+  mpc_scan = mpc_scan_scalar;
+#endif
+  return mpc_scan(s, n, set, k, until);
+}
+
+/*
+** Compiled regular expressions are run as a
+** plain table walk. Each state has 256 entries
+** giving the next state for a byte, with state
+** zero meaning there is no way forward. The
+** longest accepted prefix is the match.
+**
+** String input is scanned directly. For files
+** and pipes the scan is done once with a mark
+** so that the input can be rewound and the
+** matched prefix consumed for real.
+**
+** States which loop back to themselves on all
+** but a few bytes (comment and string bodies),
+** or on only a few bytes (whitespace), have the
+** rest of the loop skipped with `mpc_scan`.
+*/
+
+static void mpc_dfa_expected(mpc_pdata_dfa_t *d, int s, char *buffer) {
+
+  int c, n = 0;
+  char set[256];
+  const int *trans = d->trans + s * 256;
+
+  for (c = 1; c < 256; c++) { if (trans[c]) { set[n++] = (char)c; } }
+  set[n] = '\0';
+
+  if (n == 0) { strcpy(buffer, "end of match"); return; }
+  if (n == 1) { sprintf(buffer, "'%c'", set[0]); return; }
+  if (n == 255) { strcpy(buffer, "any character"); return; }
+
+  if (n < 128) { sprintf(buffer, "one of '%s'", set); return; }
+
+  n = 0;
+  for (c = 1; c < 256; c++) { if (!trans[c]) { set[n++] = (char)c; } }
+  set[n] = '\0';
+  sprintf(buffer, "none of '%s'", set);
+}
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_pdata_dfa_t *d, mpc_result_t *r) {
+
+  int s = 1, t;
+  long n = 0, m, last = d->accept[1] ? 0 : -1;
+  char c;
+  char expected[600];
+  mpc_err_t *err = NULL;
+  const unsigned char *str;
+
+  if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP || i->type == MPC_INPUT_BORROW) {
+
+    m = i->length - i->state.pos;
+    str = (const unsigned char*)i->string + i->state.pos;
+    while (n < m && str[n] && (t = d->trans[s * 256 + str[n]])) {
+      s = t; n++;
+      if (d->skip[s].num) {
+        n += mpc_scan(str + n, m - n, d->skip[s].bytes, d->skip[s].num, d->skip[s].until);
       }
+      if (d->accept[s]) { last = n; }
+    }
 
-    case MPC_TYPE_CHECK:
-      if (mpc_parse_run(i, p->data.check.x, r, e, depth+1)) {
-        if (p->data.check.f(&r->output)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
+    if (last < 0) {
+      if (!i->suppress) {
+        mpc_state_t state = i->state;
+        char prev = i->last;
+        mpc_input_consume(i, (const char*)str, n);
+        mpc_dfa_expected(d, s, expected);
+        err = mpc_err_new(i, expected);
+        i->state = state;
+        i->last = prev;
       }
+      r->error = err;
+      return 0;
+    }
 
-    case MPC_TYPE_CHECK_WITH:
-      if (mpc_parse_run(i, p->data.check_with.x, r, e, depth+1)) {
+    r->output = mpc_malloc(i, last + 1);
+    memcpy(r->output, str, last);
+    ((char*)r->output)[last] = '\0';
+    mpc_input_consume(i, (const char*)str, last);
+    return 1;
+  }
+
+  mpc_input_backtrack_enable(i);
+  mpc_input_mark(i);
+
+  while (!mpc_input_terminated(i)) {
+    c = mpc_input_getc(i);
+    t = d->trans[s * 256 + (unsigned char)c];
+    if (!t) { mpc_input_failure(i, c); break; }
+    mpc_input_success(i, c, NULL);
+    s = t; n++;
+    if (d->accept[s]) { last = n; }
+  }
+
+  if (last < 0 && !i->suppress) {
+    mpc_dfa_expected(d, s, expected);
+    err = mpc_err_new(i, expected);
+  }
+
+  mpc_input_rewind(i);
+  mpc_input_backtrack_disable(i);
+
+  if (last < 0) { r->error = err; return 0; }
+
+  r->output = mpc_malloc(i, last + 1);
+  for (m = 0; m < last; m++) {
+    c = mpc_input_getc(i);
+    mpc_input_success(i, c, NULL);
+    ((char*)r->output)[m] = c;
+  }
+  ((char*)r->output)[last] = '\0';
+  return 1;
+}
+
+/*
+** Packrat Memoization
+**
+** Parsers wrapped with `mpc_packrat` remember
+** their result at each input position, so with
+** heavy backtracking nothing is parsed twice and
+** parse time stays linear in the input size.
+**
+** Results are cached in an open addressing table
+** on the input keyed by parser, position and mode
+** (whether errors are suppressed). A success keeps
+** the output, which must be an `mpc_ast_t` as with
+** `mpca` grammars, and hands the same nodes out on
+** every hit, counting references in `shared` so no
+** tree is ever copied whole. A failure keeps its
+** error. Both keep any errors merged along the way
+** and the input state after them. Pipes can not
+** seek back to a cached state so are not cached.
+*/
+
+enum {
+  MPC_MEMO_SLOTS_MIN = 256
+};
+
+static mpc_ast_t *mpc_memo_share(mpc_ast_t *a) {
+  if (a != NULL) { a->shared++; }
+  return a;
+}
+
+static mpc_err_t *mpc_memo_err_copy(mpc_err_t *x, long *bytes) {
+
+  int j;
+  mpc_err_t *y;
+
+  if (x == NULL) { return NULL; }
+
+  y = malloc(sizeof(mpc_err_t));
+  y->state = x->state;
+  y->received = x->received;
+  y->filename = malloc(strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = malloc(strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->expected_num = x->expected_num;
+  y->expected = malloc(sizeof(char*) * x->expected_num);
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+    *bytes += strlen(x->expected[j]) + 1;
+  }
+
+  *bytes += sizeof(mpc_err_t) + strlen(x->filename) + 1 + sizeof(char*) * x->expected_num;
+  return y;
+}
+
+static unsigned long mpc_memo_hash(mpc_parser_t *p, long pos, char mode) {
+  return ((unsigned long)p >> 4) * 2654435761UL + (unsigned long)pos * 4 + mode;
+}
+
+static mpc_memo_t *mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, long pos, char mode) {
+
+  unsigned long j;
+  mpc_memo_t *m;
+
+  if (i->memo == NULL) { return NULL; }
+
+  j = mpc_memo_hash(p, pos, mode) & (i->memo_slots - 1);
+  while (1) {
+    m = &i->memo[j];
+    if (m->p == NULL) { return m; }
+    if (m->p == p && m->pos == pos && m->mode == mode) { return m; }
+    j = (j + 1) & (i->memo_slots - 1);
+  }
+}
+
+static void mpc_memo_grow(mpc_input_t *i) {
+
+  int j, slots = i->memo_slots;
+  mpc_memo_t *memo = i->memo;
+  unsigned long k;
+
+  i->memo_slots = slots ? slots * 2 : MPC_MEMO_SLOTS_MIN;
+  i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+
+  for (j = 0; j < slots; j++) {
+    if (memo[j].p == NULL) { continue; }
+    k = mpc_memo_hash(memo[j].p, memo[j].pos, memo[j].mode) & (i->memo_slots - 1);
+    while (i->memo[k].p) { k = (k + 1) & (i->memo_slots - 1); }
+    i->memo[k] = memo[j];
+  }
+
+  free(memo);
+}
+
+/*
+** Parse Stack
+**
+** Rather than recursing on the C stack the parser
+** graph is walked with an explicit stack of small
+** frames kept on the heap, so deeply nested input
+** is only limited by memory and the configurable
+** `mpc_set_max_depth`. A frame is entered once and
+** then resumed every time one of its children
+** finishes, until it produces its own result.
+*/
+
+#ifndef MPC_MAX_RECURSION_DEPTH
+#define MPC_MAX_RECURSION_DEPTH 4000000
+#endif
+
+static int mpc_parse_depth_max = MPC_MAX_RECURSION_DEPTH;
+
+void mpc_set_max_depth(int depth) {
+  mpc_parse_depth_max = depth;
+}
+
+enum {
+  MPC_PARSE_FAILURE = 0,
+  MPC_PARSE_SUCCESS = 1,
+  MPC_PARSE_CALL    = 2
+};
+
+enum {
+  MPC_PARSE_STACK_MIN  = 4,
+  MPC_PARSE_FRAMES_MIN = 64
+};
+
+/*
+** `j` counts children run so far and `results`
+** holds their outputs. `e` is the frame whose
+** `ke` collects errors for this one, or -1 for
+** the caller's. `k` and `pos` are used by `or`
+** and packrat parsers to remember what they did.
+*/
+
+typedef struct {
+  mpc_parser_t *p;
+  int j;
+  int k;
+  int e;
+  mpc_result_t *results;
+  mpc_err_t *ke;
+  long pos;
+} mpc_frame_t;
+
+typedef struct {
+  int num;
+  int slots;
+  mpc_frame_t *frames;
+} mpc_stack_t;
+
+static void mpc_stack_push(mpc_stack_t *s, mpc_parser_t *p, int e) {
+
+  mpc_frame_t *f;
+
+  if (s->num == s->slots) {
+    s->slots = s->slots * 2;
+    s->frames = realloc(s->frames, sizeof(mpc_frame_t) * s->slots);
+  }
+
+  f = &s->frames[s->num++];
+  f->p = p;
+  f->j = 0;
+  f->k = -1;
+  f->e = e;
+  f->results = NULL;
+  f->ke = NULL;
+  f->pos = 0;
+}
+
+static mpc_err_t **mpc_stack_err(mpc_stack_t *s, mpc_err_t **e, int ei) {
+  return ei < 0 ? e : &s->frames[ei].ke;
+}
+
+/*
+** Entries of the `or` jump table built by
+** `mpc_optimise`. An entry below 0x80 is the
+** only alternative which can match that next
+** character. Otherwise the low bits give the
+** first alternative worth trying in order, or
+** the entry is `MPC_OR_JUMP_NONE` if none can.
+*/
+
+enum {
+  MPC_OR_JUMP_MAX     = 0x7F,
+  MPC_OR_JUMP_ORDERED = 0x80,
+  MPC_OR_JUMP_NONE    = 0xFF
+};
+
+#define MPC_SUCCESS(x) r->output = x; return MPC_PARSE_SUCCESS
+#define MPC_FAILURE(x) r->error = x; return MPC_PARSE_FAILURE
+#define MPC_PRIMITIVE(x) \
+  if (x) { MPC_SUCCESS(r->output); } \
+  else { MPC_FAILURE(NULL); }
+#define MPC_CALL(x, e) mpc_stack_push(s, x, e); return MPC_PARSE_CALL
+
+static int mpc_parse_enter(mpc_input_t *i, mpc_stack_t *s, mpc_result_t *r, mpc_err_t **e) {
+
+  int k, top = s->num - 1;
+  long bytes = 0;
+  mpc_frame_t *f = &s->frames[top];
+  mpc_parser_t *p = f->p;
+  mpc_err_t **fe;
+  mpc_memo_t *m;
+
+  if (s->num > mpc_parse_depth_max) {
+    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  }
+
+  switch (p->type) {
+
+    /* Basic Parsers */
+
+    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
+    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
+    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
+    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
+    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
+    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+    case MPC_TYPE_DFA:     return mpc_parse_dfa(i, &p->data.dfa, r);
+
+    /* Other parsers */
+
+    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
+    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
+    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+
+    /* Application Parsers */
+
+    case MPC_TYPE_APPLY:      MPC_CALL(p->data.apply.x, f->e);
+    case MPC_TYPE_APPLY_TO:   MPC_CALL(p->data.apply_to.x, f->e);
+    case MPC_TYPE_CHECK:      MPC_CALL(p->data.check.x, f->e);
+    case MPC_TYPE_CHECK_WITH: MPC_CALL(p->data.check_with.x, f->e);
+
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_enable(i);
+      MPC_CALL(p->data.expect.x, f->e);
+
+    case MPC_TYPE_PREDICT:
+      mpc_input_backtrack_disable(i);
+      MPC_CALL(p->data.predict.x, f->e);
+
+    /* Optional Parsers */
+
+    case MPC_TYPE_NOT:
+      mpc_input_mark(i);
+      mpc_input_suppress_enable(i);
+      MPC_CALL(p->data.not.x, f->e);
+
+    case MPC_TYPE_MAYBE:
+      MPC_CALL(p->data.not.x, f->e);
+
+    /* Repeat Parsers */
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      f->results = mpc_malloc(i, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+      f->results[0].output = NULL;
+      MPC_CALL(p->data.repeat.x, f->e);
+
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.n <= 0) {
+        r->output = NULL;
+        MPC_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, 0, &r->output));
+      }
+      f->results = mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n);
+      MPC_CALL(p->data.repeat.x, f->e);
+
+    /* Combinatory Parsers */
+
+    case MPC_TYPE_OR:
+
+      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+
+      /*
+      ** Use the jump table to skip alternatives
+      ** which cannot start with the next character.
+      ** This needs backtracking so that a failed
+      ** alternative leaves the input untouched.
+      */
+
+      if (p->data.or.jump && i->backtrack > 0 && !mpc_input_terminated(i)) {
+
+        k = p->data.or.jump[(unsigned char)mpc_input_peekc(i)];
+
+        /* Without errors skipped alternatives are unobservable */
+        if (i->suppress) {
+          if (k == MPC_OR_JUMP_NONE) { MPC_FAILURE(NULL); }
+          f->j = k & MPC_OR_JUMP_MAX;
+        }
+
+        /* Otherwise only jump when a single alternative can match */
+        else if (!(k & MPC_OR_JUMP_ORDERED)) {
+          f->j = -1;
+          f->k = k;
+          MPC_CALL(p->data.or.xs[k], top);
+        }
+
+      }
+
+      MPC_CALL(p->data.or.xs[f->j], f->e);
+
+    case MPC_TYPE_AND:
+
+      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+
+      f->results = mpc_malloc(i, sizeof(mpc_result_t) * p->data.and.n);
+      mpc_input_mark(i);
+      MPC_CALL(p->data.and.xs[0], f->e);
+
+    /* Packrat Parsers */
+
+    case MPC_TYPE_MEMO:
+
+      if (i->backtrack < 1) {
+        MPC_CALL(p->data.memo.x, f->e);
+      }
+
+      f->pos = i->state.pos;
+      f->k = i->state.term | (i->suppress ? 2 : 0);
+      p->data.memo.stats->lookups++;
+      m = mpc_memo_find(i, p, f->pos, f->k);
+
+      if (m == NULL || m->p == NULL) {
+        MPC_CALL(p->data.memo.x, top);
+      }
+
+      p->data.memo.stats->hits++;
+      i->state = m->state;
+      i->last = m->last;
+      if (i->type == MPC_INPUT_FILE) { fseek(i->file, i->state.pos, SEEK_SET); }
+
+      fe = mpc_stack_err(s, e, f->e);
+      *fe = mpc_err_merge(i, *fe, mpc_memo_err_copy(m->merged, &bytes));
+
+      if (m->ok) {
+        MPC_SUCCESS(mpc_memo_share(m->output));
+      } else {
+        MPC_FAILURE(mpc_memo_err_copy(m->error, &bytes));
+      }
+
+    /* End */
+
+    default:
+
+      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+  }
+
+  return MPC_PARSE_FAILURE;
+
+}
+
+static int mpc_parse_leave(mpc_input_t *i, mpc_stack_t *s, int x, mpc_result_t *r, mpc_err_t **e) {
+
+  int k;
+  long bytes = 0;
+  mpc_frame_t *f = &s->frames[s->num - 1];
+  mpc_parser_t *p = f->p;
+  mpc_err_t **fe = mpc_stack_err(s, e, f->e);
+  mpc_memo_t *m;
+
+  switch (p->type) {
+
+    /* Application Parsers */
+
+    case MPC_TYPE_APPLY:
+      if (x) {
+        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
+      } else {
+        MPC_FAILURE(r->error);
+      }
+
+    case MPC_TYPE_APPLY_TO:
+      if (x) {
+        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
+      } else {
+        MPC_FAILURE(r->error);
+      }
+
+    case MPC_TYPE_CHECK:
+      if (x) {
+        if (p->data.check.f(&r->output)) {
+          MPC_SUCCESS(r->output);
+        } else {
+          mpc_parse_dtor(i, p->data.check.dx, r->output);
+          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
+        }
+      } else {
+        MPC_FAILURE(r->error);
+      }
+
+    case MPC_TYPE_CHECK_WITH:
+      if (x) {
         if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
           MPC_SUCCESS(r->output);
         } else {
@@ -1121,22 +1982,18 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       }
 
     case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e, depth+1)) {
-        mpc_input_suppress_disable(i);
+      mpc_input_suppress_disable(i);
+      if (x) {
         MPC_SUCCESS(r->output);
       } else {
-        mpc_input_suppress_disable(i);
         MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
       }
 
     case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e, depth+1)) {
-        mpc_input_backtrack_enable(i);
+      mpc_input_backtrack_enable(i);
+      if (x) {
         MPC_SUCCESS(r->output);
       } else {
-        mpc_input_backtrack_enable(i);
         MPC_FAILURE(r->error);
       }
 
@@ -1145,9 +2002,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     /* TODO: Update Not Error Message */
 
     case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
+      if (x) {
         mpc_input_rewind(i);
         mpc_input_suppress_disable(i);
         mpc_parse_dtor(i, p->data.not.dx, r->output);
@@ -1159,135 +2014,130 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       }
 
     case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
+      if (x) {
         MPC_SUCCESS(r->output);
       } else {
-        *e = mpc_err_merge(i, *e, r->error);
+        *fe = mpc_err_merge(i, *fe, r->error);
         MPC_SUCCESS(p->data.not.lf());
       }
 
     /* Repeat Parsers */
 
     case MPC_TYPE_MANY:
-
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
-
-      *e = mpc_err_merge(i, *e, results[j].error);
-
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-
     case MPC_TYPE_MANY1:
 
-      results = results_stk;
-
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+      if (x) {
+        if (f->j >= MPC_PARSE_STACK_MIN && (f->j & (f->j - 1)) == 0) {
+          f->results = mpc_realloc(i, f->results, sizeof(mpc_result_t) * f->j * 2);
         }
+        f->results[f->j++] = *r;
+        MPC_CALL(p->data.repeat.x, f->e);
       }
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-
-        *e = mpc_err_merge(i, *e, results[j].error);
-
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+        mpc_free(i, f->results);
+        MPC_FAILURE(mpc_err_many1(i, r->error));
       }
 
-    case MPC_TYPE_COUNT:
+      *fe = mpc_err_merge(i, *fe, r->error);
+      r->output = mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+      mpc_free(i, f->results);
+      return MPC_PARSE_SUCCESS;
 
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+    case MPC_TYPE_COUNT:
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
+      if (x) {
+        f->results[f->j++] = *r;
+        if (f->j < p->data.repeat.n) { MPC_CALL(p->data.repeat.x, f->e); }
+        r->output = mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+        mpc_free(i, f->results);
+        return MPC_PARSE_SUCCESS;
       }
 
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      for (k = 0; k < f->j; k++) {
+        mpc_parse_dtor(i, p->data.repeat.dx, f->results[k].output);
       }
+      mpc_free(i, f->results);
+      MPC_FAILURE(mpc_err_count(i, r->error, p->data.repeat.n));
 
     /* Combinatory Parsers */
 
     case MPC_TYPE_OR:
 
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
-
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
-
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e, depth+1)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      if (x) {
+        if (f->j < 0) {
+          *fe = mpc_err_merge(i, *fe, f->ke);
         } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
+          mpc_err_delete_internal(i, f->ke);
         }
+        f->ke = NULL;
+        MPC_SUCCESS(r->output);
       }
 
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      /* The jumped to alternative failed so collect the errors of the others in order */
+      if (f->j < 0) {
+        f->ke = mpc_err_merge(i, f->ke, r->error);
+        f->j = 0;
+      } else {
+        *fe = mpc_err_merge(i, *fe, r->error);
+        f->j++;
+      }
 
-    case MPC_TYPE_AND:
+      if (f->j == f->k) {
+        *fe = mpc_err_merge(i, *fe, f->ke);
+        f->ke = NULL;
+        f->j++;
+      }
 
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+      if (f->j < p->data.or.n) { MPC_CALL(p->data.or.xs[f->j], f->e); }
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      MPC_FAILURE(NULL);
 
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e, depth+1)) {
-          mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
-          }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        }
+    case MPC_TYPE_AND:
+
+      if (x) {
+        f->results[f->j++] = *r;
+        if (f->j < p->data.and.n) { MPC_CALL(p->data.and.xs[f->j], f->e); }
+        mpc_input_unmark(i);
+        r->output = mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)f->results);
+        mpc_free(i, f->results);
+        return MPC_PARSE_SUCCESS;
       }
-      mpc_input_unmark(i);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+
+      mpc_input_rewind(i);
+      for (k = 0; k < f->j; k++) {
+        mpc_parse_dtor(i, p->data.and.dxs[k], f->results[k].output);
+      }
+      mpc_free(i, f->results);
+      MPC_FAILURE(r->error);
+
+    /* Packrat Parsers */
+
+    case MPC_TYPE_MEMO:
+
+      if (f->k < 0) { return x; }
+
+      if ((i->memo_num + 1) * 2 > i->memo_slots) { mpc_memo_grow(i); }
+
+      m = mpc_memo_find(i, p, f->pos, f->k);
+      m->p = p;
+      m->pos = f->pos;
+      m->mode = f->k;
+      m->ok = x;
+      m->last = i->last;
+      m->state = i->state;
+      m->output = x ? mpc_memo_share(r->output) : NULL;
+      m->error = x ? NULL : mpc_memo_err_copy(r->error, &bytes);
+      m->merged = mpc_memo_err_copy(f->ke, &bytes);
+      i->memo_num++;
+
+      *fe = mpc_err_merge(i, *fe, f->ke);
+      f->ke = NULL;
+
+      p->data.memo.stats->entries++;
+      p->data.memo.stats->bytes += sizeof(mpc_memo_t) + bytes;
+
+      return x;
 
     /* End */
 
@@ -1296,25 +2146,74 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
   }
 
-  return 0;
+  return MPC_PARSE_FAILURE;
 
 }
 
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
+#undef MPC_CALL
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+
+  int x;
+  mpc_stack_t s;
+
+  s.num = 0;
+  s.slots = MPC_PARSE_FRAMES_MIN;
+  s.frames = malloc(sizeof(mpc_frame_t) * s.slots);
+
+  mpc_stack_push(&s, p, -1);
+  x = mpc_parse_enter(i, &s, r, e);
+
+  while (1) {
+    if (x == MPC_PARSE_CALL) {
+      x = mpc_parse_enter(i, &s, r, e);
+    } else {
+      s.num--;
+      if (s.num == 0) { break; }
+      x = mpc_parse_leave(i, &s, x, r, e);
+    }
+  }
+
+  free(s.frames);
+  return x;
+}
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
+  mpc_err_t *e = NULL;
+
+  /*
+  ** Errors are only needed when the parse fails so
+  ** first parse with them suppressed, which builds
+  ** no error objects at all. On failure rewind and
+  ** parse again to collect the full error message.
+  */
+
+  mpc_input_mark(i);
+  mpc_input_suppress_enable(i);
+  x = mpc_parse_run(i, p, r, &e);
+  mpc_input_suppress_disable(i);
+  if (x) {
+    mpc_input_unmark(i);
+    r->output = mpc_export(i, r->output);
+    mpc_input_arena_reset(i);
+    return x;
+  }
+  mpc_input_rewind(i);
+
+  e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e, 0);
+  x = mpc_parse_run(i, p, r, &e);
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
   } else {
     r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
   }
+  mpc_input_arena_reset(i);
   return x;
 }
 
@@ -1334,6 +2233,14 @@ int mpc_nparse(const char *filename, const char *string, size_t length, mpc_pars
   return x;
 }
 
+int mpc_nparse_borrow(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_buffer(filename, MPC_INPUT_BORROW, (char*)string, length);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
@@ -1352,18 +2259,100 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
 
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
 
-  FILE *f = fopen(filename, "rb");
+  FILE *f;
   int res;
+  mpc_input_t *i = mpc_input_new_mmap(filename);
 
-  if (f == NULL) {
+  if (i == NULL) {
+
+    f = fopen(filename, "rb");
+
+    if (f == NULL) {
+      r->output = NULL;
+      r->error = mpc_err_file(filename, "Unable to open file!");
+      return 0;
+    }
+
+    i = mpc_input_new_read(filename, f);
+    fclose(f);
+  }
+
+  res = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return res;
+}
+
+/*
+** Streams
+**
+** A stream keeps one input open across many
+** parses, each picking up where the last one
+** finished. This lets a caller consume a large
+** input one top level item at a time, without
+** ever holding more than a single item's worth
+** of output.
+**
+** Named files are mapped where possible and
+** otherwise read through like a pipe rather
+** than loaded whole.
+*/
+
+struct mpc_stream_t {
+  char *filename;
+  FILE *file;
+  mpc_input_t *input;
+};
+
+static mpc_stream_t *mpc_stream_new(const char *filename) {
+  mpc_stream_t *s = malloc(sizeof(mpc_stream_t));
+  s->filename = malloc(strlen(filename) + 1);
+  strcpy(s->filename, filename);
+  s->file = NULL;
+  s->input = NULL;
+  return s;
+}
+
+mpc_stream_t *mpc_stream_pipe(const char *filename, FILE *pipe) {
+  mpc_stream_t *s = mpc_stream_new(filename);
+  s->input = mpc_input_new_pipe(filename, pipe);
+  return s;
+}
+
+mpc_stream_t *mpc_stream_contents(const char *filename) {
+
+  mpc_stream_t *s = mpc_stream_new(filename);
+
+  s->input = mpc_input_new_mmap(filename);
+  if (s->input) { return s; }
+
+  s->file = fopen(filename, "rb");
+  if (s->file) { s->input = mpc_input_new_pipe(filename, s->file); }
+
+  return s;
+}
+
+int mpc_stream_next(mpc_stream_t *s, mpc_parser_t *p, mpc_result_t *r) {
+
+  if (s->input == NULL) {
     r->output = NULL;
-    r->error = mpc_err_file(filename, "Unable to open file!");
+    r->error = mpc_err_file(s->filename, "Unable to open file!");
     return 0;
   }
 
-  res = mpc_parse_file(filename, f, p, r);
-  fclose(f);
-  return res;
+  /* Nothing before the current position is read again */
+  mpc_input_memo_clear(s->input);
+  return mpc_parse_input(s->input, p, r);
+}
+
+int mpc_stream_end(mpc_stream_t *s) {
+  return s->input && mpc_input_terminated(s->input);
+}
+
+void mpc_stream_delete(mpc_stream_t *s) {
+  if (s->input) { mpc_input_delete(s->input); }
+  if (s->file) { fclose(s->file); }
+  free(s->filename);
+  free(s);
 }
 
 /*
@@ -1379,6 +2368,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  free(p->data.or.jump);
 
 }
 
@@ -1411,6 +2401,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
 
+    case MPC_TYPE_MEMO:
+      mpc_undefine_unretained(p->data.memo.x, 0);
+      free(p->data.memo.stats);
+      break;
+
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
       mpc_undefine_unretained(p->data.not.x, 0);
@@ -1440,6 +2435,13 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
       free(p->data.check_with.e);
       break;
 
+    case MPC_TYPE_DFA:
+      free(p->data.dfa.re);
+      free(p->data.dfa.trans);
+      free(p->data.dfa.accept);
+      free(p->data.dfa.skip);
+      break;
+
     default: break;
   }
 
@@ -1519,6 +2521,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
 
+    case MPC_TYPE_MEMO:
+      p->data.memo.x = mpc_copy(a->data.memo.x);
+      p->data.memo.stats = calloc(1, sizeof(mpc_memo_stats_t));
+      break;
+
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
       p->data.not.x = mpc_copy(a->data.not.x);
@@ -1541,6 +2548,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      if (a->data.or.jump) {
+        p->data.or.jump = malloc(256);
+        memcpy(p->data.or.jump, a->data.or.jump, 256);
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1564,6 +2575,17 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.check_with.e, a->data.check_with.e);
       break;
 
+    case MPC_TYPE_DFA:
+      p->data.dfa.re = malloc(strlen(a->data.dfa.re)+1);
+      strcpy(p->data.dfa.re, a->data.dfa.re);
+      p->data.dfa.trans = malloc(sizeof(int) * 256 * a->data.dfa.num);
+      memcpy(p->data.dfa.trans, a->data.dfa.trans, sizeof(int) * 256 * a->data.dfa.num);
+      p->data.dfa.accept = malloc(a->data.dfa.num);
+      memcpy(p->data.dfa.accept, a->data.dfa.accept, a->data.dfa.num);
+      p->data.dfa.skip = malloc(sizeof(mpc_dfa_skip_t) * a->data.dfa.num);
+      memcpy(p->data.dfa.skip, a->data.dfa.skip, sizeof(mpc_dfa_skip_t) * a->data.dfa.num);
+      break;
+
     default: break;
   }
 
@@ -1874,6 +2896,14 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_packrat(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.stats = calloc(1, sizeof(mpc_memo_stats_t));
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -2006,7 +3036,7 @@ mpc_parser_t *mpc_boundary(void) { return mpc_expect(mpc_anchor(mpc_boundary_anc
 mpc_parser_t *mpc_boundary_newline(void) { return mpc_expect(mpc_anchor(mpc_boundary_newline_anchor), "start of newline"); }
 
 mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
-mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
+mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_re("\\s*"), "spaces"); }
 mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
 
 mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
@@ -2216,137 +3246,649 @@ static mpc_parser_t *mpc_re_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_escape(mpc_val_t *x, void* data) {
+static mpc_val_t *mpcf_re_escape(mpc_val_t *x, void* data) {
+
+  int mode = *((int*)data);
+  char *s = x;
+  mpc_parser_t *p;
+
+  /* Any Character */
+  if (s[0] == '.') {
+    free(s);
+    if (mode & MPC_RE_DOTALL) {
+      return mpc_any();
+    } else {
+      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
+    }
+  }
+
+  /* Start of Input */
+  if (s[0] == '^') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()), mpc_lift(mpcf_ctor_str), free);
+    } else {
+      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    }
+  }
+
+  /* End of Input */
+  if (s[0] == '$') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_or(2,
+        mpc_newline(),
+        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    } else {
+      return mpc_or(2,
+        mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
+        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    }
+  }
+
+  /* Regex Escape */
+  if (s[0] == '\\') {
+    p = mpc_re_escape_char(s[1]);
+    p = (p == NULL) ? mpc_char(s[1]) : p;
+    free(s);
+    return p;
+  }
+
+  /* Regex Standard */
+  p = mpc_char(s[0]);
+  free(s);
+  return p;
+}
+
+static const char *mpc_re_range_escape_char(char c) {
+  switch (c) {
+    case '-': return "-";
+    case 'a': return "\a";
+    case 'f': return "\f";
+    case 'n': return "\n";
+    case 'r': return "\r";
+    case 't': return "\t";
+    case 'v': return "\v";
+    case 'b': return "\b";
+    case 'd': return "0123456789";
+    case 's': return " \f\n\r\t\v";
+    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    default: return NULL;
+  }
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+
+  mpc_parser_t *out;
+  size_t i, j;
+  size_t start, end;
+  const char *tmp = NULL;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range = calloc(1,1);
+
+  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  if (s[0] == '^' &&
+      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+
+  for (i = comp; i < strlen(s); i++){
+
+    /* Regex Range Escape */
+    if (s[i] == '\\') {
+      tmp = mpc_re_range_escape_char(s[i+1]);
+      if (tmp != NULL) {
+        range = realloc(range, strlen(range) + strlen(tmp) + 1);
+        strcat(range, tmp);
+      } else {
+        range = realloc(range, strlen(range) + 1 + 1);
+        range[strlen(range) + 1] = '\0';
+        range[strlen(range) + 0] = s[i+1];
+      }
+      i++;
+    }
+
+    /* Regex Range...Range */
+    else if (s[i] == '-') {
+      if (s[i+1] == '\0' || i == 0) {
+          range = realloc(range, strlen(range) + strlen("-") + 1);
+          strcat(range, "-");
+      } else {
+        start = s[i-1]+1;
+        end = s[i+1]-1;
+        for (j = start; j <= end; j++) {
+          range = realloc(range, strlen(range) + 1 + 1 + 1);
+          range[strlen(range) + 1] = '\0';
+          range[strlen(range) + 0] = (char)j;
+        }
+      }
+    }
+
+    /* Regex Range Normal */
+    else {
+      range = realloc(range, strlen(range) + 1 + 1);
+      range[strlen(range) + 1] = '\0';
+      range[strlen(range) + 0] = s[i];
+    }
+
+  }
+
+  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+
+  free(x);
+  free(range);
+
+  return out;
+}
+
+/*
+** Regular Expression DFAs
+*/
+
+/*
+** Building a regex out of combinators is
+** neat, but matching one then walks a deep
+** tree of `and`, `or` and `many` parsers with
+** a mark and rewind at every step.
+**
+** So before doing that we try to compile the
+** regex to a DFA over bytes instead. The regex
+** is parsed once more by hand (following the
+** grammar above exactly), the positions of the
+** leaves are numbered, `followpos` is computed
+** and then the usual subset construction gives
+** a table that can be run in a tight loop.
+**
+** A DFA finds the longest match, while the
+** combinators are greedy and never backtrack
+** into a repetition. These agree only when each
+** character can be matched by one position at
+** any point - so we check for that, and for a
+** few other things (nullable repetitions, an
+** empty alternative before a non-empty one). If
+** the check fails, or the regex uses anchors,
+** boundaries or negated escapes which have no
+** DFA equivalent, we fall back to combinators.
+*/
+
+enum {
+  MPC_RE_DFA_MAX_POS    = 255,
+  MPC_RE_DFA_MAX_STATES = 1024,
+  MPC_RE_DFA_MAX_COUNT  = 64
+};
+
+enum {
+  MPC_RE_NODE_SET   = 0,
+  MPC_RE_NODE_EMPTY = 1,
+  MPC_RE_NODE_CAT   = 2,
+  MPC_RE_NODE_ALT   = 3,
+  MPC_RE_NODE_STAR  = 4,
+  MPC_RE_NODE_PLUS  = 5,
+  MPC_RE_NODE_MAYBE = 6
+};
+
+typedef struct { unsigned char b[32]; } mpc_re_bits_t;
+
+typedef struct mpc_re_node_t {
+  int type;
+  int pos;
+  int nullable;
+  mpc_re_bits_t set;
+  mpc_re_bits_t first;
+  mpc_re_bits_t last;
+  struct mpc_re_node_t *x;
+  struct mpc_re_node_t *y;
+} mpc_re_node_t;
+
+typedef struct {
+  const char *s;
+  int mode;
+  int npos;
+  mpc_re_node_t *leaves[MPC_RE_DFA_MAX_POS];
+  mpc_re_bits_t follow[MPC_RE_DFA_MAX_POS];
+} mpc_re_dfa_st_t;
+
+static int mpc_re_bits_get(const mpc_re_bits_t *b, int i) { return (b->b[i >> 3] >> (i & 7)) & 1; }
+static void mpc_re_bits_set(mpc_re_bits_t *b, int i) { b->b[i >> 3] |= (unsigned char)(1 << (i & 7)); }
+
+static void mpc_re_bits_or(mpc_re_bits_t *b, const mpc_re_bits_t *c) {
+  int i;
+  for (i = 0; i < 32; i++) { b->b[i] |= c->b[i]; }
+}
+
+static int mpc_re_bits_overlap(const mpc_re_bits_t *b, const mpc_re_bits_t *c) {
+  int i;
+  for (i = 0; i < 32; i++) { if (b->b[i] & c->b[i]) { return 1; } }
+  return 0;
+}
+
+static int mpc_re_bits_empty(const mpc_re_bits_t *b) {
+  int i;
+  for (i = 0; i < 32; i++) { if (b->b[i]) { return 0; } }
+  return 1;
+}
+
+static mpc_re_node_t *mpc_re_node_new(int type, mpc_re_node_t *x, mpc_re_node_t *y) {
+  mpc_re_node_t *n = calloc(1, sizeof(mpc_re_node_t));
+  n->type = type;
+  n->x = x;
+  n->y = y;
+  return n;
+}
+
+static mpc_re_node_t *mpc_re_node_chars(const char *cs) {
+  mpc_re_node_t *n = mpc_re_node_new(MPC_RE_NODE_SET, NULL, NULL);
+  while (*cs) { mpc_re_bits_set(&n->set, (unsigned char)*cs); cs++; }
+  return n;
+}
+
+static void mpc_re_node_delete(mpc_re_node_t *n) {
+  if (n == NULL) { return; }
+  mpc_re_node_delete(n->x);
+  mpc_re_node_delete(n->y);
+  free(n);
+}
+
+static mpc_re_node_t *mpc_re_node_copy(mpc_re_node_t *n) {
+  mpc_re_node_t *m;
+  if (n == NULL) { return NULL; }
+  m = malloc(sizeof(mpc_re_node_t));
+  memcpy(m, n, sizeof(mpc_re_node_t));
+  m->x = mpc_re_node_copy(n->x);
+  m->y = mpc_re_node_copy(n->y);
+  return m;
+}
+
+static mpc_re_node_t *mpc_re_dfa_regex(mpc_re_dfa_st_t *st);
+
+/* Mirrors `mpcf_re_range`, returning NULL where it would build a failing parser */
+static mpc_re_node_t *mpc_re_dfa_range(const char *s, size_t len) {
+
+  mpc_re_node_t *n;
+  size_t i;
+  int j, comp = s[0] == '^' ? 1 : 0;
+  const char *tmp;
+
+  if (len == 0 || (comp && len == 1)) { return NULL; }
+  for (i = 0; i < len; i++) { if ((unsigned char)s[i] >= 0x80) { return NULL; } }
+
+  n = mpc_re_node_new(MPC_RE_NODE_SET, NULL, NULL);
+
+  for (i = comp; i < len; i++) {
+    if (s[i] == '\\') {
+      tmp = mpc_re_range_escape_char(s[i+1]);
+      if (tmp != NULL) {
+        while (*tmp) { mpc_re_bits_set(&n->set, (unsigned char)*tmp); tmp++; }
+      } else {
+        mpc_re_bits_set(&n->set, (unsigned char)s[i+1]);
+      }
+      i++;
+    } else if (s[i] == '-') {
+      if (i + 1 == len || i == 0) {
+        mpc_re_bits_set(&n->set, '-');
+      } else {
+        for (j = s[i-1]+1; j <= s[i+1]-1; j++) { mpc_re_bits_set(&n->set, j); }
+      }
+    } else {
+      mpc_re_bits_set(&n->set, (unsigned char)s[i]);
+    }
+  }
+
+  if (comp) {
+    for (i = 0; i < 32; i++) { n->set.b[i] = (unsigned char)~n->set.b[i]; }
+  }
+  n->set.b[0] &= 0xFE;
+
+  return n;
+}
+
+static mpc_re_node_t *mpc_re_dfa_base(mpc_re_dfa_st_t *st) {
+
+  mpc_re_node_t *n;
+  const char *start;
+  char c = *st->s;
+
+  if (c == '(') {
+    st->s++;
+    n = mpc_re_dfa_regex(st);
+    if (n == NULL) { return NULL; }
+    if (*st->s != ')') { mpc_re_node_delete(n); return NULL; }
+    st->s++;
+    return n;
+  }
+
+  if (c == '[') {
+    start = ++st->s;
+    while (*st->s && *st->s != ']') {
+      if (*st->s == '\\') {
+        if (st->s[1] == '\0') { return NULL; }
+        st->s++;
+      }
+      st->s++;
+    }
+    if (*st->s != ']') { return NULL; }
+    st->s++;
+    return mpc_re_dfa_range(start, st->s - start - 1);
+  }
+
+  if (c == '\\') {
+    c = st->s[1];
+    if (c == '\0') { return NULL; }
+    st->s += 2;
+    switch (c) {
+      case 'a': return mpc_re_node_chars("\a");
+      case 'f': return mpc_re_node_chars("\f");
+      case 'n': return mpc_re_node_chars("\n");
+      case 'r': return mpc_re_node_chars("\r");
+      case 't': return mpc_re_node_chars("\t");
+      case 'v': return mpc_re_node_chars("\v");
+      case 'd': return mpc_re_node_chars("0123456789");
+      case 's': return mpc_re_node_chars(" \f\n\r\t\v");
+      case 'w': return mpc_re_node_chars(
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+      case 'b': case 'B': case 'A': case 'Z':
+      case 'D': case 'S': case 'W':
+        return NULL;
+      default:
+        n = mpc_re_node_new(MPC_RE_NODE_SET, NULL, NULL);
+        mpc_re_bits_set(&n->set, (unsigned char)c);
+        return n;
+    }
+  }
+
+  if (c == '\0' || c == ')' || c == '|' || c == '^' || c == '$') { return NULL; }
+
+  st->s++;
+  n = mpc_re_node_new(MPC_RE_NODE_SET, NULL, NULL);
+
+  if (c == '.') {
+    memset(n->set.b, 0xFF, sizeof(n->set.b));
+    n->set.b[0] &= 0xFE;
+    if (!(st->mode & MPC_RE_DOTALL)) { n->set.b['\n' >> 3] &= (unsigned char)~(1 << ('\n' & 7)); }
+    return n;
+  }
+
+  mpc_re_bits_set(&n->set, (unsigned char)c);
+  return n;
+}
+
+static mpc_re_node_t *mpc_re_dfa_factor(mpc_re_dfa_st_t *st) {
+
+  int j, num;
+  char *end;
+  mpc_re_node_t *n, *m;
+
+  n = mpc_re_dfa_base(st);
+  if (n == NULL) { return NULL; }
+
+  switch (*st->s) {
+    case '*': st->s++; return mpc_re_node_new(MPC_RE_NODE_STAR, n, NULL);
+    case '+': st->s++; return mpc_re_node_new(MPC_RE_NODE_PLUS, n, NULL);
+    case '?': st->s++; return mpc_re_node_new(MPC_RE_NODE_MAYBE, n, NULL);
+    case '{':
+      if (!isdigit((unsigned char)st->s[1])) { mpc_re_node_delete(n); return NULL; }
+      num = (int)strtol(st->s + 1, &end, 10);
+      if (*end != '}' || num < 1 || num > MPC_RE_DFA_MAX_COUNT) { mpc_re_node_delete(n); return NULL; }
+      st->s = end + 1;
+      m = n;
+      for (j = 1; j < num; j++) {
+        m = mpc_re_node_new(MPC_RE_NODE_CAT, m, mpc_re_node_copy(n));
+      }
+      return m;
+    default: return n;
+  }
+}
+
+static mpc_re_node_t *mpc_re_dfa_term(mpc_re_dfa_st_t *st) {
+
+  mpc_re_node_t *n = mpc_re_node_new(MPC_RE_NODE_EMPTY, NULL, NULL);
+  mpc_re_node_t *f;
+
+  while (*st->s && *st->s != ')' && *st->s != '|') {
+    f = mpc_re_dfa_factor(st);
+    if (f == NULL) { mpc_re_node_delete(n); return NULL; }
+    if (n->type == MPC_RE_NODE_EMPTY) {
+      free(n);
+      n = f;
+    } else {
+      n = mpc_re_node_new(MPC_RE_NODE_CAT, n, f);
+    }
+  }
+
+  return n;
+}
+
+static mpc_re_node_t *mpc_re_dfa_regex(mpc_re_dfa_st_t *st) {
+
+  mpc_re_node_t *t, *r;
+
+  t = mpc_re_dfa_term(st);
+  if (t == NULL || *st->s != '|') { return t; }
+
+  st->s++;
+  r = mpc_re_dfa_regex(st);
+  if (r == NULL) { mpc_re_node_delete(t); return NULL; }
+  return mpc_re_node_new(MPC_RE_NODE_ALT, t, r);
+}
+
+/* Computes `nullable`, `firstpos`, `lastpos` and `followpos`, failing on constructs the DFA can't mirror */
+static int mpc_re_dfa_analyse(mpc_re_dfa_st_t *st, mpc_re_node_t *n) {
+
+  int p;
+  mpc_re_node_t *x = n->x, *y = n->y;
+
+  switch (n->type) {
+
+    case MPC_RE_NODE_SET:
+      if (mpc_re_bits_empty(&n->set)) { return 0; }
+      if (st->npos == MPC_RE_DFA_MAX_POS) { return 0; }
+      n->pos = st->npos++;
+      st->leaves[n->pos] = n;
+      memset(&st->follow[n->pos], 0, sizeof(mpc_re_bits_t));
+      mpc_re_bits_set(&n->first, n->pos);
+      mpc_re_bits_set(&n->last, n->pos);
+      n->nullable = 0;
+      return 1;
+
+    case MPC_RE_NODE_EMPTY:
+      n->nullable = 1;
+      return 1;
+
+    case MPC_RE_NODE_CAT:
+      if (!mpc_re_dfa_analyse(st, x) || !mpc_re_dfa_analyse(st, y)) { return 0; }
+      for (p = 0; p < st->npos; p++) {
+        if (mpc_re_bits_get(&x->last, p)) { mpc_re_bits_or(&st->follow[p], &y->first); }
+      }
+      n->nullable = x->nullable && y->nullable;
+      n->first = x->first;
+      if (x->nullable) { mpc_re_bits_or(&n->first, &y->first); }
+      n->last = y->last;
+      if (y->nullable) { mpc_re_bits_or(&n->last, &x->last); }
+      return 1;
+
+    case MPC_RE_NODE_ALT:
+      if (!mpc_re_dfa_analyse(st, x) || !mpc_re_dfa_analyse(st, y)) { return 0; }
+      if (x->nullable) { return 0; }
+      n->nullable = y->nullable;
+      n->first = x->first; mpc_re_bits_or(&n->first, &y->first);
+      n->last = x->last; mpc_re_bits_or(&n->last, &y->last);
+      return 1;
+
+    case MPC_RE_NODE_STAR:
+    case MPC_RE_NODE_PLUS:
+    case MPC_RE_NODE_MAYBE:
+      if (!mpc_re_dfa_analyse(st, x) || x->nullable) { return 0; }
+      if (n->type != MPC_RE_NODE_MAYBE) {
+        for (p = 0; p < st->npos; p++) {
+          if (mpc_re_bits_get(&x->last, p)) { mpc_re_bits_or(&st->follow[p], &x->first); }
+        }
+      }
+      n->nullable = n->type != MPC_RE_NODE_PLUS;
+      n->first = x->first;
+      n->last = x->last;
+      return 1;
+
+    default: return 0;
+  }
+}
+
+static int mpc_re_dfa_deterministic(mpc_re_dfa_st_t *st, const mpc_re_bits_t *ps) {
+  int p;
+  mpc_re_bits_t seen;
+  memset(&seen, 0, sizeof(seen));
+  for (p = 0; p < st->npos; p++) {
+    if (!mpc_re_bits_get(ps, p)) { continue; }
+    if (mpc_re_bits_overlap(&seen, &st->leaves[p]->set)) { return 0; }
+    mpc_re_bits_or(&seen, &st->leaves[p]->set);
+  }
+  return 1;
+}
+
+static mpc_dfa_skip_t *mpc_re_dfa_skip(const int *trans, int num) {
+
+  int s, c, loop, exit;
+  mpc_dfa_skip_t *skip = calloc(num, sizeof(mpc_dfa_skip_t));
+
+  for (s = 1; s < num; s++) {
+
+    loop = 0;
+    for (c = 1; c < 256; c++) { loop += trans[s * 256 + c] == s; }
+    exit = 256 - loop;
+
+    if (loop == 0) { continue; }
+
+    if (loop <= MPC_SCAN_MAX) {
+      skip[s].until = 0;
+      for (c = 1; c < 256; c++) {
+        if (trans[s * 256 + c] == s) { skip[s].bytes[(int)skip[s].num++] = (unsigned char)c; }
+      }
+    } else if (exit <= MPC_SCAN_MAX) {
+      skip[s].until = 1;
+      for (c = 0; c < 256; c++) {
+        if (c == 0 || trans[s * 256 + c] != s) { skip[s].bytes[(int)skip[s].num++] = (unsigned char)c; }
+      }
+    }
+  }
+
+  return skip;
+}
+
+static mpc_parser_t *mpc_re_dfa(const char *re, int mode) {
 
-  int mode = *((int*)data);
-  char *s = x;
-  mpc_parser_t *p;
+  int j, c, k, p, s, num = 0, slots = 16;
+  int end, classes_num;
+  int classes[256], targets[512];
+  unsigned char members[256];
+  mpc_re_bits_t *states;
+  mpc_re_bits_t next;
+  mpc_re_dfa_st_t *st;
+  mpc_re_node_t *root;
+  mpc_parser_t *out;
+  int *trans;
+  char *accept;
 
-  /* Any Character */
-  if (s[0] == '.') {
-    free(s);
-    if (mode & MPC_RE_DOTALL) {
-      return mpc_any();
-    } else {
-      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
-    }
+  st = malloc(sizeof(mpc_re_dfa_st_t));
+  st->s = re;
+  st->mode = mode;
+  st->npos = 0;
+
+  root = mpc_re_dfa_regex(st);
+  if (root == NULL || *st->s != '\0' || !mpc_re_dfa_analyse(st, root)) {
+    mpc_re_node_delete(root); free(st); return NULL;
   }
 
-  /* Start of Input */
-  if (s[0] == '^') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()), mpc_lift(mpcf_ctor_str), free);
-    } else {
-      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
-    }
+  /* Matches end where the end marker can follow */
+  if (st->npos == MPC_RE_DFA_MAX_POS) { mpc_re_node_delete(root); free(st); return NULL; }
+  end = st->npos;
+
+  if (!mpc_re_dfa_deterministic(st, &root->first)) { mpc_re_node_delete(root); free(st); return NULL; }
+  for (p = 0; p < st->npos; p++) {
+    if (!mpc_re_dfa_deterministic(st, &st->follow[p])) { mpc_re_node_delete(root); free(st); return NULL; }
+  }
+  for (p = 0; p < st->npos; p++) {
+    if (mpc_re_bits_get(&root->last, p)) { mpc_re_bits_set(&st->follow[p], end); }
   }
 
-  /* End of Input */
-  if (s[0] == '$') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_or(2,
-        mpc_newline(),
-        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
-    } else {
-      return mpc_or(2,
-        mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
-        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+  /* Bytes found in exactly the same leaves always lead to the same state, so group them,
+     splitting every group by whether each leaf contains its bytes */
+  classes_num = 1;
+  for (c = 1; c < 256; c++) { classes[c] = 0; }
+  for (p = 0; p < st->npos; p++) {
+    for (k = 0; k < classes_num * 2; k++) { targets[k] = -1; }
+    j = 0;
+    for (c = 1; c < 256; c++) {
+      k = classes[c] * 2 + mpc_re_bits_get(&st->leaves[p]->set, c);
+      if (targets[k] < 0) { targets[k] = j++; }
+      classes[c] = targets[k];
     }
+    classes_num = j;
   }
+  for (c = 255; c > 0; c--) { members[classes[c]] = (unsigned char)c; }
 
-  /* Regex Escape */
-  if (s[0] == '\\') {
-    p = mpc_re_escape_char(s[1]);
-    p = (p == NULL) ? mpc_char(s[1]) : p;
-    free(s);
-    return p;
-  }
+  /* Subset construction - state zero is the dead state and state one the start */
+  states = malloc(sizeof(mpc_re_bits_t) * slots);
+  trans = calloc(slots * 256, sizeof(int));
+  accept = calloc(slots, 1);
 
-  /* Regex Standard */
-  p = mpc_char(s[0]);
-  free(s);
-  return p;
-}
+  memset(&states[0], 0, sizeof(mpc_re_bits_t));
+  states[1] = root->first;
+  if (root->nullable) { mpc_re_bits_set(&states[1], end); }
+  num = 2;
 
-static const char *mpc_re_range_escape_char(char c) {
-  switch (c) {
-    case '-': return "-";
-    case 'a': return "\a";
-    case 'f': return "\f";
-    case 'n': return "\n";
-    case 'r': return "\r";
-    case 't': return "\t";
-    case 'v': return "\v";
-    case 'b': return "\b";
-    case 'd': return "0123456789";
-    case 's': return " \f\n\r\t\v";
-    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
-    default: return NULL;
-  }
-}
+  for (s = 1; s < num; s++) {
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+    accept[s] = (char)mpc_re_bits_get(&states[s], end);
 
-  mpc_parser_t *out;
-  size_t i, j;
-  size_t start, end;
-  const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
+    for (k = 0; k < classes_num; k++) {
 
-  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
-  if (s[0] == '^' &&
-      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+      c = members[k];
+      targets[k] = 0;
 
-  for (i = comp; i < strlen(s); i++){
+      memset(&next, 0, sizeof(next));
+      for (p = 0; p < st->npos; p++) {
+        if (mpc_re_bits_get(&states[s], p) && mpc_re_bits_get(&st->leaves[p]->set, c)) {
+          mpc_re_bits_or(&next, &st->follow[p]);
+        }
+      }
+      if (mpc_re_bits_empty(&next)) { continue; }
 
-    /* Regex Range Escape */
-    if (s[i] == '\\') {
-      tmp = mpc_re_range_escape_char(s[i+1]);
-      if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
-      } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];
+      for (j = 1; j < num; j++) {
+        if (memcmp(&states[j], &next, sizeof(next)) == 0) { break; }
       }
-      i++;
-    }
 
-    /* Regex Range...Range */
-    else if (s[i] == '-') {
-      if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
-      } else {
-        start = s[i-1]+1;
-        end = s[i+1]-1;
-        for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = (char)j;
+      if (j == num) {
+        if (num == MPC_RE_DFA_MAX_STATES) {
+          free(states); free(trans); free(accept);
+          mpc_re_node_delete(root); free(st);
+          return NULL;
+        }
+        if (num == slots) {
+          slots = slots * 2;
+          states = realloc(states, sizeof(mpc_re_bits_t) * slots);
+          trans = realloc(trans, sizeof(int) * 256 * slots);
+          memset(trans + num * 256, 0, sizeof(int) * 256 * (slots - num));
+          accept = realloc(accept, slots);
         }
+        states[num++] = next;
       }
-    }
 
-    /* Regex Range Normal */
-    else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
+      targets[k] = j;
     }
 
+    for (c = 1; c < 256; c++) { trans[s * 256 + c] = targets[classes[c]]; }
   }
 
-  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
-
-  free(x);
-  free(range);
-
+  free(states);
+  mpc_re_node_delete(root);
+  free(st);
+
+  out = mpc_undefined();
+  out->type = MPC_TYPE_DFA;
+  out->data.dfa.re = malloc(strlen(re) + 1);
+  strcpy(out->data.dfa.re, re);
+  out->data.dfa.num = num;
+  out->data.dfa.trans = realloc(trans, sizeof(int) * 256 * num);
+  out->data.dfa.accept = realloc(accept, num);
+  out->data.dfa.skip = mpc_re_dfa_skip(out->data.dfa.trans, num);
   return out;
 }
 
@@ -2361,6 +3903,18 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode) {
   mpc_result_t r;
   mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
 
+  mpc_parser_t *dfa = mpc_re_dfa(re, mode);
+  if (dfa != NULL) { return dfa; }
+
+  /* Lone anchors are common in grammars, build what the compiler below would without it */
+  if ((re[0] == '^' || re[0] == '$') && re[1] == '\0') {
+    char *anchor = malloc(2);
+    strcpy(anchor, re);
+    dfa = mpc_and(2, mpcf_strfold, mpc_lift(mpcf_ctor_str), mpcf_re_escape(anchor, &mode), free);
+    mpc_optimise(dfa);
+    return dfa;
+  }
+
   Regex  = mpc_new("regex");
   Term   = mpc_new("term");
   Factor = mpc_new("factor");
@@ -2769,6 +4323,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_print_unretained(p->data.memo.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2806,6 +4361,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     printf("->?");
   }
 
+  if (p->type == MPC_TYPE_DFA) { printf("/%s/", p->data.dfa.re); }
+
 }
 
 void mpc_print(mpc_parser_t *p) {
@@ -2883,11 +4440,39 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 ** AST
 */
 
+/*
+** Nodes output by packrat parsers are also held
+** by their memo, which `shared` counts. A shared
+** node is copied before it is changed, sharing its
+** children in turn, and only the last reference
+** to a node deletes it.
+*/
+
+static mpc_ast_t *mpc_ast_unshare(mpc_ast_t *a) {
+
+  int i;
+  mpc_ast_t *c;
+
+  if (a == NULL || a->shared == 0) { return a; }
+  a->shared--;
+
+  c = mpc_ast_new(a->tag, a->contents);
+  c->state = a->state;
+  c->children_num = a->children_num;
+  c->children = malloc(sizeof(mpc_ast_t*) * a->children_num);
+  for (i = 0; i < a->children_num; i++) {
+    c->children[i] = a->children[i];
+    c->children[i]->shared++;
+  }
+  return c;
+}
+
 void mpc_ast_delete(mpc_ast_t *a) {
 
   int i;
 
   if (a == NULL) { return; }
+  if (a->shared) { a->shared--; return; }
 
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
@@ -2921,6 +4506,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
   a->children_num = 0;
   a->children = NULL;
+  a->shared = 0;
   return a;
 
 }
@@ -2972,6 +4558,7 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+  r = mpc_ast_unshare(r);
   r->children_num++;
   r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
   r->children[r->children_num-1] = a;
@@ -2980,6 +4567,7 @@ mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  a = mpc_ast_unshare(a);
   a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
   memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, strlen(t));
@@ -2989,6 +4577,7 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  a = mpc_ast_unshare(a);
   a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
   memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, (strlen(t)-1));
@@ -2996,6 +4585,7 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  a = mpc_ast_unshare(a);
   a->tag = realloc(a->tag, strlen(t) + 1);
   strcpy(a->tag, t);
   return a;
@@ -3003,6 +4593,7 @@ mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
 
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
   if (a == NULL) { return a; }
+  a = mpc_ast_unshare(a);
   a->state = s;
   return a;
 }
@@ -3226,6 +4817,9 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
 
     if (as[i] == NULL) { continue; }
 
+    /* Its node is about to be taken apart */
+    as[i] = mpc_ast_unshare(as[i]);
+
     if        (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
@@ -3661,8 +5255,17 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_PACKRAT) { stmt->grammar = mpc_packrat(stmt->grammar); }
+    mpc_optimise(stmt->grammar);
+    stmt->grammar = mpc_define(left, stmt->grammar);
+    stmts++;
+  }
+
+  /* Rules can refer forward, so FIRST sets are only complete once all are defined */
+  stmts = x;
+  while(*stmts) {
+    stmt = *stmts;
     mpc_optimise(stmt->grammar);
-    mpc_define(left, stmt->grammar);
     free(stmt->ident);
     free(stmt->name);
     free(stmt);
@@ -3855,6 +5458,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { return 1 + mpc_nodecount_unretained(p->data.memo.x, 0); }
 
   if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
@@ -3886,10 +5490,253 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
 
 }
 
+static int mpc_memo_stats_total(mpc_parser_t *p, mpc_memo_stats_t *t, mpc_parser_t ***seen, int *seen_num) {
+
+  int i, total = 0;
+
+  if (p->retained) {
+    for (i = 0; i < *seen_num; i++) {
+      if ((*seen)[i] == p) { return 0; }
+    }
+    (*seen_num)++;
+    *seen = realloc(*seen, sizeof(mpc_parser_t*) * (*seen_num));
+    (*seen)[(*seen_num)-1] = p;
+  }
+
+  if (p->type == MPC_TYPE_MEMO) {
+    t->lookups += p->data.memo.stats->lookups;
+    t->hits    += p->data.memo.stats->hits;
+    t->entries += p->data.memo.stats->entries;
+    t->bytes   += p->data.memo.stats->bytes;
+    return 1 + mpc_memo_stats_total(p->data.memo.x, t, seen, seen_num);
+  }
+
+  if (p->type == MPC_TYPE_EXPECT)     { return mpc_memo_stats_total(p->data.expect.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_APPLY)      { return mpc_memo_stats_total(p->data.apply.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { return mpc_memo_stats_total(p->data.apply_to.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_PREDICT)    { return mpc_memo_stats_total(p->data.predict.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_CHECK)      { return mpc_memo_stats_total(p->data.check.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { return mpc_memo_stats_total(p->data.check_with.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_NOT)        { return mpc_memo_stats_total(p->data.not.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_MAYBE)      { return mpc_memo_stats_total(p->data.not.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_MANY)       { return mpc_memo_stats_total(p->data.repeat.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_MANY1)      { return mpc_memo_stats_total(p->data.repeat.x, t, seen, seen_num); }
+  if (p->type == MPC_TYPE_COUNT)      { return mpc_memo_stats_total(p->data.repeat.x, t, seen, seen_num); }
+
+  if (p->type == MPC_TYPE_OR) {
+    for(i = 0; i < p->data.or.n; i++) {
+      total += mpc_memo_stats_total(p->data.or.xs[i], t, seen, seen_num);
+    }
+  }
+
+  if (p->type == MPC_TYPE_AND) {
+    for(i = 0; i < p->data.and.n; i++) {
+      total += mpc_memo_stats_total(p->data.and.xs[i], t, seen, seen_num);
+    }
+  }
+
+  return total;
+}
+
 void mpc_stats(mpc_parser_t* p) {
+
+  int memos, seen_num = 0;
+  mpc_parser_t **seen = NULL;
+  mpc_memo_stats_t t;
+
+  memset(&t, 0, sizeof(mpc_memo_stats_t));
+  memos = mpc_memo_stats_total(p, &t, &seen, &seen_num);
+  free(seen);
+
   printf("Stats\n");
   printf("=====\n");
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+  printf("Arena Allocations: %li\n", mpc_arena_stats.allocs);
+  printf("Arena Reuses: %li\n", mpc_arena_stats.reuses);
+  printf("Arena Blocks: %li\n", mpc_arena_stats.blocks);
+  printf("Arena Fallbacks: %li\n", mpc_arena_stats.fallbacks);
+
+  if (memos == 0) { return; }
+
+  printf("Packrat Parsers: %i\n", memos);
+  printf("Packrat Lookups: %li\n", t.lookups);
+  printf("Packrat Hits: %li (%.1f%%)\n", t.hits,
+    t.lookups ? 100.0 * t.hits / t.lookups : 0.0);
+  printf("Packrat Entries: %li\n", t.entries);
+  printf("Packrat Memory: %li bytes\n", t.bytes);
+}
+
+/*
+** FIRST Sets
+**
+** The FIRST set of a parser is the set of
+** characters it can consume first, along with
+** whether it can succeed without consuming any
+** input at all. Sets are conservative: anything
+** unknown (undefined or recursive parsers, user
+** conditions) is assumed to match everything.
+**
+** With these each `or` gets a 256 entry table
+** from the next character to the alternatives
+** which could possibly match it.
+*/
+
+enum {
+  MPC_FIRST_DEPTH_MAX = 64
+};
+
+static int mpc_first_all(unsigned char *set) {
+  memset(set, 0xFF, 32);
+  return 1;
+}
+
+static void mpc_first_add(unsigned char *set, int c) {
+  set[(unsigned char)c / 8] |= 1 << ((unsigned char)c % 8);
+}
+
+static int mpc_first_has(const unsigned char *set, int c) {
+  return set[(unsigned char)c / 8] & (1 << ((unsigned char)c % 8));
+}
+
+static int mpc_first_run(mpc_parser_t *p, unsigned char *set, mpc_parser_t **stack, int depth) {
+
+  int j, c;
+  const char *x;
+
+  if (depth == MPC_FIRST_DEPTH_MAX) { return mpc_first_all(set); }
+  for (j = 0; j < depth; j++) {
+    if (stack[j] == p) { return mpc_first_all(set); }
+  }
+  stack[depth] = p;
+
+  switch (p->type) {
+
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+    case MPC_TYPE_NOT:
+      return 1;
+
+    case MPC_TYPE_FAIL:
+      return 0;
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SATISFY:
+      mpc_first_all(set);
+      return 0;
+
+    case MPC_TYPE_SINGLE:
+      mpc_first_add(set, p->data.single.x);
+      return 0;
+
+    case MPC_TYPE_RANGE:
+      for (c = 1; c < 256; c++) {
+        if ((char)c >= p->data.range.x && (char)c <= p->data.range.y) { mpc_first_add(set, c); }
+      }
+      return 0;
+
+    case MPC_TYPE_ONEOF:
+      for (x = p->data.string.x; *x; x++) { mpc_first_add(set, *x); }
+      return 0;
+
+    case MPC_TYPE_NONEOF:
+      for (c = 1; c < 256; c++) {
+        if (strchr(p->data.string.x, c) == NULL) { mpc_first_add(set, c); }
+      }
+      return 0;
+
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return 1; }
+      mpc_first_add(set, p->data.string.x[0]);
+      return 0;
+
+    case MPC_TYPE_DFA:
+      for (c = 1; c < 256; c++) {
+        if (p->data.dfa.trans[256 + c]) { mpc_first_add(set, c); }
+      }
+      return p->data.dfa.accept[1];
+
+    case MPC_TYPE_EXPECT:     return mpc_first_run(p->data.expect.x, set, stack, depth+1);
+    case MPC_TYPE_APPLY:      return mpc_first_run(p->data.apply.x, set, stack, depth+1);
+    case MPC_TYPE_APPLY_TO:   return mpc_first_run(p->data.apply_to.x, set, stack, depth+1);
+    case MPC_TYPE_CHECK:      return mpc_first_run(p->data.check.x, set, stack, depth+1);
+    case MPC_TYPE_CHECK_WITH: return mpc_first_run(p->data.check_with.x, set, stack, depth+1);
+    case MPC_TYPE_PREDICT:    return mpc_first_run(p->data.predict.x, set, stack, depth+1);
+    case MPC_TYPE_MEMO:       return mpc_first_run(p->data.memo.x, set, stack, depth+1);
+    case MPC_TYPE_MANY1:      return mpc_first_run(p->data.repeat.x, set, stack, depth+1);
+
+    case MPC_TYPE_MAYBE:
+      mpc_first_run(p->data.not.x, set, stack, depth+1);
+      return 1;
+
+    case MPC_TYPE_MANY:
+      mpc_first_run(p->data.repeat.x, set, stack, depth+1);
+      return 1;
+
+    case MPC_TYPE_COUNT:
+      return mpc_first_run(p->data.repeat.x, set, stack, depth+1) || p->data.repeat.n == 0;
+
+    case MPC_TYPE_OR:
+      c = 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        c = mpc_first_run(p->data.or.xs[j], set, stack, depth+1) || c;
+      }
+      return c || p->data.or.n == 0;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_first_run(p->data.and.xs[j], set, stack, depth+1)) { return 0; }
+      }
+      return 1;
+
+    default:
+      return mpc_first_all(set);
+  }
+
+}
+
+static unsigned char *mpc_first_jump(mpc_parser_t *p) {
+
+  int j, c, useful = 0;
+  unsigned char *jump, *sets;
+  int *nullable;
+  mpc_parser_t *stack[MPC_FIRST_DEPTH_MAX];
+
+  if (p->data.or.n < 2 || p->data.or.n > MPC_OR_JUMP_MAX) { return NULL; }
+
+  sets = calloc(p->data.or.n, 32);
+  nullable = malloc(sizeof(int) * p->data.or.n);
+  for (j = 0; j < p->data.or.n; j++) {
+    stack[0] = p;
+    nullable[j] = mpc_first_run(p->data.or.xs[j], sets + j * 32, stack, 1);
+  }
+
+  jump = malloc(256);
+  jump[0] = MPC_OR_JUMP_ORDERED;
+
+  for (c = 1; c < 256; c++) {
+    jump[c] = MPC_OR_JUMP_NONE;
+    for (j = 0; j < p->data.or.n; j++) {
+      if (!nullable[j] && !mpc_first_has(sets + j * 32, c)) { continue; }
+      if (jump[c] == MPC_OR_JUMP_NONE) {
+        jump[c] = nullable[j] ? (j | MPC_OR_JUMP_ORDERED) : j;
+      } else {
+        jump[c] |= MPC_OR_JUMP_ORDERED;
+        break;
+      }
+    }
+    if (jump[c] != MPC_OR_JUMP_ORDERED) { useful = 1; }
+  }
+
+  free(sets);
+  free(nullable);
+
+  if (!useful) { free(jump); return NULL; }
+  return jump;
 }
 
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
@@ -3907,6 +5754,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)       { mpc_optimise_unretained(p->data.memo.x, 0); }
   if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
@@ -3938,7 +5786,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.jump); free(t->name); free(t);
       continue;
     }
 
@@ -3952,7 +5800,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.jump); free(t->name); free(t);
       continue;
     }
 
@@ -4055,8 +5903,14 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
 
-    return;
+    break;
+
+  }
 
+  /* Build `or` jump table */
+  if (p->type == MPC_TYPE_OR) {
+    free(p->data.or.jump);
+    p->data.or.jump = mpc_first_jump(p);
   }
 
 }
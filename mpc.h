@@ -67,10 +67,24 @@ typedef struct mpc_parser_t mpc_parser_t;
 
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
+int mpc_nparse_borrow(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Streams
+*/
+
+struct mpc_stream_t;
+typedef struct mpc_stream_t mpc_stream_t;
+
+mpc_stream_t *mpc_stream_pipe(const char *filename, FILE *pipe);
+mpc_stream_t *mpc_stream_contents(const char *filename);
+int mpc_stream_next(mpc_stream_t *s, mpc_parser_t *p, mpc_result_t *r);
+int mpc_stream_end(mpc_stream_t *s);
+void mpc_stream_delete(mpc_stream_t *s);
+
 /*
 ** Function Types
 */
@@ -148,6 +162,17 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+/*
+** Packrat parsers remember their result at each
+** position. It must be an `mpc_ast_t`, as output
+** by `mpca` parsers and grammars, whose nodes the
+** memo shares until the parse is done: `shared`
+** counts the extra references to a node and the
+** `mpc_ast` functions copy shared nodes they change.
+*/
+
+mpc_parser_t *mpc_packrat(mpc_parser_t *a);
+
 /*
 ** Common Parsers
 */
@@ -287,6 +312,7 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int shared;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -354,7 +380,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4  /* Every rule is wrapped in `mpc_packrat` */
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -372,6 +399,7 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 void mpc_print(mpc_parser_t *p);
 void mpc_optimise(mpc_parser_t *p);
 void mpc_stats(mpc_parser_t *p);
+void mpc_set_max_depth(int depth);
 
 int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
   int(*tester)(const void*, const void*),
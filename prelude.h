@@ -0,0 +1,243 @@
+// Generated from prelude.lsp by the command in the README, do not edit
+
+static char prelude_lsp[] =
+	";;;\n"
+	";;; LSP STANDARD LIBRARY\n"
+	";;;\n"
+	"\n"
+	";;; Atoms\n"
+	"(def {nil} {})\n"
+	"\n"
+	";;; Functions\n"
+	"\n"
+	"; Function definition (also implemented as part of core, redefined here)\n"
+	"(def {fun} (lambda {formals body} {\n"
+	"\tdef (head formals) (lambda (tail formals) body)\n"
+	"}))\n"
+	"\n"
+	"; Function composition\n"
+	"(fun {comp f g x} {f (g x)})\n"
+	"\n"
+	"; Argument swap\n"
+	"(fun {flip f a b} {f b a})\n"
+	"\n"
+	"; Currying / uncurrying\n"
+	"(fun {unpack f args} {eval (join (list f) args)})\n"
+	"(fun {pack f & args} {f args})\n"
+	"(def {curry} unpack)\n"
+	"(def {uncurry} pack)\n"
+	"\n"
+	"; Open new scope\n"
+	"(fun {let b} {\n"
+	"\t((lambda {_} b) ())\n"
+	"})\n"
+	"\n"
+	";;; Logical functions \n"
+	"\n"
+	"; Aliases from builtins\n"
+	"(fun {not x}   {!  x})\n"
+	"(fun {or  x y} {|| x y})\n"
+	"(fun {and x y} {&& x y})\n"
+	"\n"
+	";;; Conditionals / Flow control\n"
+	"\n"
+	"; Evaluate several expressions in sequence\n"
+	"(fun {do & commands} {\n"
+	"\tif (== commands nil)\n"
+	"\t\t{nil}\n"
+	"\t\t{last commands}\n"
+	"})\n"
+	"\n"
+	"; Case selection\n"
+	"; select\n"
+	"; \t{condition value}\n"
+	";   ...\n"
+	"; \t{condition value}\n"
+	"; \t{otherwise value}\n"
+	"(fun {select & cases} {\n"
+	"\tif (== cases nil)\n"
+	"\t\t{error \"No selection match\"}\n"
+	"\t\t{if (frst (frst cases)) {scnd (frst cases)} {unpack select (tail cases)}}\n"
+	"})\n"
+	"\n"
+	"; More traditional switch statement\n"
+	"(fun {case x & cases} {\n"
+	"\tif (== cases nil)\n"
+	"\t\t{error \"No case match\"}\n"
+	"\t\t{if (== x (frst (frst cases)))\n"
+	"\t\t\t{scnd (frst cases)}\n"
+	"\t\t\t{unpack case (join (list x) (tail cases))}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; default case\n"
+	"(def {otherwise} true)\n"
+	"\n"
+	";;; Lists\n"
+	"\n"
+	"; Lists and lazy sequences alike, a sequence from range, range-from or iterate stays one through\n"
+	"; map, filter, take, take-while, drop and drop-while, its values are only computed as it is read\n"
+	"\n"
+	"; Element selection\n"
+	"(fun {frst l} {eval (head l)})\n"
+	"(fun {scnd l} {eval (head (tail l))})\n"
+	"(fun {thrd l} {eval (head (tail (tail l)))})\n"
+	"(fun {nth n l} {\n"
+	"\tif (== n 0) {frst l} {nth (- n 1) (tail l)}\n"
+	"})\n"
+	"(fun {last l} {nth (- (len l) 1) l})\n"
+	"\n"
+	"; Take first n elements\n"
+	"(fun {take n l} {\n"
+	"\tif (is-seq l)\n"
+	"\t\t{seq-take n l}\n"
+	"\t\t{if (== n 0)\n"
+	"\t\t\t{nil}\n"
+	"\t\t\t{join (head l) (take (- n 1) (tail l))}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Drop first n elements\n"
+	"(fun {drop n l} {\n"
+	"\tif (is-seq l)\n"
+	"\t\t{seq-drop n l}\n"
+	"\t\t{if (== n 0)\n"
+	"\t\t\t{l}\n"
+	"\t\t\t{drop (- n 1) (tail l)}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Split at n\n"
+	"(fun {split n l} {list (take n l) (drop n l)})\n"
+	"\n"
+	"; Take elements while a condition is met\n"
+	"(fun {take-while f l} {\n"
+	"\tif (is-seq l)\n"
+	"\t\t{seq-take-while f l}\n"
+	"\t\t{if (not (unpack f (head l)))\n"
+	"\t\t\t{nil}\n"
+	"\t\t\t{join (head l) (take-while f (tail l))}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Drop elements while a condition is met\n"
+	"(fun {drop-while f l} {\n"
+	"\tif (is-seq l)\n"
+	"\t\t{seq-drop-while f l}\n"
+	"\t\t{if (not (unpack f (head l)))\n"
+	"\t\t\t{nil}\n"
+	"\t\t\t{drop-while f (tail l)}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Reverse list\n"
+	"(fun {reverse l} {\n"
+	"\tif (== l nil) \n"
+	"\t\t{nil}\n"
+	"\t\t{join (reverse (tail l)) (head l)}\n"
+	"})\n"
+	"\n"
+	"; Element membership\n"
+	"(fun {elem x l} {\n"
+	"\tif (== l nil)\n"
+	"\t\t{false}\n"
+	"\t\t{if (== x (frst l)) {true} {elem x (tail l)}}\n"
+	"})\n"
+	"; Reimplementation using foldl\n"
+	"; (fun {elem x l} {\n"
+	";     foldl (lambda {z y} {or z (== x y)}) false l\n"
+	"; })\n"
+	"\n"
+	"; Find element in list of pairs\n"
+	"(fun {lookup x l} {\n"
+	"\tif (== l nil)\n"
+	"\t\t{error \"No element found\"}\n"
+	"\t\t{do\n"
+	"\t\t\t(= {key} (frst (frst l)))\n"
+	"\t\t\t(= {val} (scnd (frst l)))\n"
+	"\t\t\t(if (== key x) {val} {lookup x (tail l)})\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Zip two lists into a list of pairs\n"
+	"(fun {zip l1 l2} {\n"
+	"\tif (or (== l1 nil) (== l2 nil))\n"
+	"\t\t{nil}\n"
+	"\t\t{join (list (join (head l1) (head l2))) (zip (tail l1) (tail l2))}\n"
+	"})\n"
+	"\n"
+	"; Unzip a list of pairs into two lists\n"
+	"(fun {unzip l} {\n"
+	"\tif (== l nil)\n"
+	"\t\t{{nil nil}}\n"
+	"\t\t{do\n"
+	"\t\t\t(= {x} (frst l))\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Apply function to each element of a list\n"
+	"(fun {map f l} {\n"
+	"\tif (is-seq l)\n"
+	"\t\t{seq-map f l}\n"
+	"\t\t{if (== l nil)\n"
+	"\t\t\t{nil}\n"
+	"\t\t\t{join (list (f (frst l))) (map f (tail l))}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Apply filter to list\n"
+	"(fun {filter f l} {\n"
+	"\tif (is-seq l)\n"
+	"\t\t{seq-filter f l}\n"
+	"\t\t{if (== l nil)\n"
+	"\t\t\t{nil}\n"
+	"\t\t\t{join (if (f (frst l)) {head l} {nil}) (filter f (tail l))}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Fold left, a sequence is read one value at a time\n"
+	"(fun {foldl f z l} {\n"
+	"\tif (is-seq l)\n"
+	"\t\t{gen-foldl f z l}\n"
+	"\t\t{if (== l nil)\n"
+	"\t\t\t{z}\n"
+	"\t\t\t{foldl f (f z (frst l)) (tail l)}\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Fold right\n"
+	"(fun {foldr f z l} {\n"
+	"\tif (== l nil)\n"
+	"\t\t{z}\n"
+	"\t\t{f (frst l) (foldr f z (tail l))}\n"
+	"})\n"
+	"\n"
+	"; Basic folds\n"
+	"(fun {sum l}     {foldl + 0 l})\n"
+	"(fun {product l} {foldl * 1 l})\n"
+	"\n"
+	";;; Math\n"
+	"\n"
+	"; Minimum of arguments\n"
+	"(fun {min & xs} {\n"
+	"\tif (== (tail xs) nil)\n"
+	"\t\t{frst xs}\n"
+	"\t\t{do\n"
+	"\t\t\t(= {rest} (unpack min (tail xs)))\n"
+	"\t\t\t(= {item} (frst xs))\n"
+	"\t\t\t(if (< item rest) {item} {rest})\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	"; Maximum of arguments\n"
+	"(fun {max & xs} {\n"
+	"\tif (== (tail xs) nil)\n"
+	"\t\t{frst xs}\n"
+	"\t\t{do\n"
+	"\t\t\t(= {rest} (unpack max (tail xs)))\n"
+	"\t\t\t(= {item} (frst xs))\n"
+	"\t\t\t(if (> item rest) {item} {rest})\n"
+	"\t\t}\n"
+	"})\n"
+	"\n"
+	;
@@ -72,6 +72,9 @@
 
 ;;; Lists
 
+; Lists and lazy sequences alike, a sequence from range, range-from or iterate stays one through
+; map, filter, take, take-while, drop and drop-while, its values are only computed as it is read
+
 ; Element selection
 (fun {frst l} {eval (head l)})
 (fun {scnd l} {eval (head (tail l))})
@@ -83,16 +86,22 @@
 
 ; Take first n elements
 (fun {take n l} {
-	if (== n 0)
-		{nil}
-		{join (head l) (take (- n 1) (tail l))}
+	if (is-seq l)
+		{seq-take n l}
+		{if (== n 0)
+			{nil}
+			{join (head l) (take (- n 1) (tail l))}
+		}
 })
 
 ; Drop first n elements
 (fun {drop n l} {
-	if (== n 0)
-		{l}
-		{drop (- n 1) (tail l)}
+	if (is-seq l)
+		{seq-drop n l}
+		{if (== n 0)
+			{l}
+			{drop (- n 1) (tail l)}
+		}
 })
 
 ; Split at n
@@ -100,16 +109,22 @@
 
 ; Take elements while a condition is met
 (fun {take-while f l} {
-	if (not (unpack f (head l)))
-		{nil}
-		{join (head l) (take-while f (tail l))}
+	if (is-seq l)
+		{seq-take-while f l}
+		{if (not (unpack f (head l)))
+			{nil}
+			{join (head l) (take-while f (tail l))}
+		}
 })
 
 ; Drop elements while a condition is met
 (fun {drop-while f l} {
-	if (not (unpack f (head l)))
-		{nil}
-		{drop-while f (tail l)}
+	if (is-seq l)
+		{seq-drop-while f l}
+		{if (not (unpack f (head l)))
+			{nil}
+			{drop-while f (tail l)}
+		}
 })
 
 ; Reverse list
@@ -159,23 +174,32 @@
 
 ; Apply function to each element of a list
 (fun {map f l} {
-	if (== l nil)
-		{nil}
-		{join (list (f (frst l))) (map f (tail l))}
+	if (is-seq l)
+		{seq-map f l}
+		{if (== l nil)
+			{nil}
+			{join (list (f (frst l))) (map f (tail l))}
+		}
 })
 
 ; Apply filter to list
 (fun {filter f l} {
-	if (== l nil)
-		{nil}
-		{join (if (f (frst l)) {head l} {nil}) (filter f (tail l))}
+	if (is-seq l)
+		{seq-filter f l}
+		{if (== l nil)
+			{nil}
+			{join (if (f (frst l)) {head l} {nil}) (filter f (tail l))}
+		}
 })
 
-; Fold left
+; Fold left, a sequence is read one value at a time
 (fun {foldl f z l} {
-	if (== l nil)
-		{z}
-		{foldl f (f z (frst l)) (tail l)}
+	if (is-seq l)
+		{gen-foldl f z l}
+		{if (== l nil)
+			{z}
+			{foldl f (f z (frst l)) (tail l)}
+		}
 })
 
 ; Fold right
@@ -0,0 +1,250 @@
+// Differential test of the Lsp grammar, built from combinators in lsp.c, against the same
+// grammar given to mpca_lang: both must accept the same input with the same AST, or reject it
+// with the same error. Inputs are fuzzed REPL lines and the prelude, which are also split into
+// top level expressions by lsp_form_length, as batch mode does, to check it splits them where
+// the grammar does
+//
+//     gcc -std=c99 -Wall -O2 -I. tests/test_grammar.c mpc.c -lm -pthread -o test_grammar && ./test_grammar
+//
+// Every failed check is printed, and the exit status is 1 if any failed
+
+// lsp.c is compiled in, for the parsers that lsp_state holds
+#include "lsp.c"
+
+#define GRAMMAR \
+	"number  : /-?[0-9]+(\\.[0-9]*)?/ ;" \
+	"symbol  : /[a-zA-Z0-9_+\\-*\\/%\\\\=<>!|&]+/ ;" \
+	"string  : /\"(\\\\.|[^\"\\\\])*\"/s ;" \
+	"comment : /;[^\\r\\n]*/ ;" \
+	"sexpr   : '(' <expr>* ')' ;" \
+	"qexpr   : '{' <expr>* '}' ;" \
+	"expr    : <number>  | <symbol> | <string>" \
+	"        | <comment> | <sexpr>  | <qexpr> ;" \
+	"form    : // (<expr> | /$/) ;" \
+	"lsp     : /^/ <expr>* /$/ ;"
+
+#define LINES 3000
+
+int checks, failures;
+
+void check(int ok, char* fmt, ...) {
+	// Count a check, printing what it was about if it failed
+	checks++;
+	if (ok) { return; }
+	failures++;
+	va_list va;
+	va_start(va, fmt);
+	printf("FAIL: ");
+	vprintf(fmt, va);
+	printf("\n");
+	va_end(va);
+}
+
+unsigned long rng = 12345;
+
+int rand_below(int n) {
+	// Same sequence on every system, so a failure can be reproduced
+	rng = rng * 6364136223846793005UL + 1442695040888963407UL;
+	return (int)((rng >> 33) % n);
+}
+
+void rand_append(char* s, char* alphabet, int min, int max) {
+	// Append between min and max characters of alphabet to s
+	int len = min + rand_below(max - min + 1), n = strlen(alphabet);
+	s += strlen(s);
+	for (int i = 0; i < len; i++) { s[i] = alphabet[rand_below(n)]; }
+	s[len] = '\0';
+}
+
+void fuzz_line(char* s) {
+	// A line of tokens, mostly well formed, then sometimes broken by an edit
+	char open[16];
+	int depth = 0;
+	s[0] = '\0';
+	int tokens = rand_below(16);
+	for (int i = 0; i < tokens; i++) {
+		switch (rand_below(9)) {
+			case 0:
+				if (rand_below(2)) { strcat(s, "-"); }
+				rand_append(s, "0123456789", 1, 4);
+				if (rand_below(3) == 0) { strcat(s, "."); rand_append(s, "0123456789", 0, 3); }
+				break;
+			case 1: rand_append(s, "abcxyz_+-*/%\\=<>!|&09", 1, 6); break;
+			case 2: strcat(s, rand_below(2) ? "true" : "false"); break;
+			case 3:
+				strcat(s, "\"");
+				rand_append(s, "ab (){};\\\"\n", 0, 8);
+				if (s[strlen(s) - 1] == '\\') { strcat(s, "\\"); }
+				strcat(s, "\"");
+				break;
+			case 4: strcat(s, ";"); rand_append(s, "ab (){}\"", 0, 8); strcat(s, "\n"); break;
+			case 5:
+				if (depth < 16) {
+					open[depth] = rand_below(2) ? ')' : '}';
+					strcat(s, open[depth++] == ')' ? "(" : "{");
+				}
+				break;
+			case 6: if (depth) { strncat(s, &open[--depth], 1); } break;
+			case 7: strcat(s, rand_below(2) ? "(+ 1 2)" : "{head {x y}}"); break;
+			case 8: if (rand_below(4) == 0) { rand_append(s, "#.,'`", 1, 1); } break;
+		}
+		rand_append(s, " \t\n", rand_below(4) ? 1 : 0, 2);
+	}
+	while (depth && rand_below(8)) { strncat(s, &open[--depth], 1); }
+
+	int len = strlen(s);
+	if (len && rand_below(4) == 0) {
+		int at = rand_below(len);
+		if (rand_below(2)) { memmove(s + at, s + at + 1, len - at); }
+		else { s[at] = "(){}\";#\\- "[rand_below(11)]; }
+	}
+}
+
+int same_result(int ok_a, mpc_result_t* a, int ok_b, mpc_result_t* b) {
+	// Compare two parse results, then delete them
+	int same = ok_a == ok_b;
+	if (same && ok_a) { same = mpc_ast_eq(a->output, b->output); }
+	if (same && !ok_a) {
+		char* ea = mpc_err_string(a->error);
+		char* eb = mpc_err_string(b->error);
+		same = strcmp(ea, eb) == 0;
+		free(ea);
+		free(eb);
+	}
+	if (ok_a) { mpc_ast_delete(a->output); } else { mpc_err_delete(a->error); }
+	if (ok_b) { mpc_ast_delete(b->output); } else { mpc_err_delete(b->error); }
+	return same;
+}
+
+int compare(char* rule, mpc_parser_t* a, mpc_parser_t* b, char* input) {
+	// Parse input with both, returns whether it was accepted
+	mpc_result_t ra, rb;
+	int ok_a = mpc_parse("<stdin>", input, a, &ra);
+	int ok_b = mpc_parse("<stdin>", input, b, &rb);
+	check(same_result(ok_a, &ra, ok_b, &rb), "%s parses \"%s\" differently", rule, input);
+	return ok_a;
+}
+
+int top_exprs(mpc_parser_t* lsp, char* input, mpc_ast_t** out, mpc_ast_t** keep, int* n) {
+	// Parse input whole and append its top level expressions, comments left out, to out. The
+	// tree is added to keep, to be deleted by the caller. Returns 0 if it does not parse
+	mpc_result_t r;
+	if (!mpc_parse("<stdin>", input, lsp, &r)) {
+		mpc_err_delete(r.error);
+		return 0;
+	}
+	mpc_ast_t* t = r.output;
+	*keep = t;
+	for (int i = 0; i < t->children_num; i++) {
+		char* tag = t->children[i]->tag;
+		if (strcmp(tag, "regex") != 0 && !strstr(tag, "comment")) { out[(*n)++] = t->children[i]; }
+	}
+	return 1;
+}
+
+void compare_forms(mpc_parser_t* lsp, char* input) {
+	// Evaluating the pieces lsp_form_length splits input into one by one must read the same
+	// expressions as the whole of it, or fail likewise
+	static mpc_ast_t* whole[4096];
+	static mpc_ast_t* split[4096];
+	static mpc_ast_t* trees[4096];
+	int n_whole = 0, n_split = 0, n_trees = 0;
+	int ok_whole = top_exprs(lsp, input, whole, &trees[n_trees], &n_whole);
+	n_trees += ok_whole;
+
+	size_t len = strlen(input), pos = 0, n;
+	int ok_split = 1;
+	while ((n = lsp_form_length(input + pos, len - pos, 1))) {
+		char next = input[pos + n];
+		input[pos + n] = '\0';
+		int ok = top_exprs(lsp, input + pos, split, &trees[n_trees], &n_split);
+		n_trees += ok;
+		ok_split = ok_split && ok;
+		input[pos + n] = next;
+		pos += n;
+	}
+
+	int same = ok_whole == ok_split && (!ok_whole || n_whole == n_split);
+	for (int i = 0; same && ok_whole && i < n_whole; i++) { same = mpc_ast_eq(whole[i], split[i]); }
+	check(same, "\"%s\" is read differently split into expressions", input);
+
+	// A block read may end anywhere, which must never split off a different first expression
+	size_t first = lsp_form_length(input, len, 1);
+	for (size_t k = 0; k < len; k++) {
+		n = lsp_form_length(input, k, 0);
+		check(n == 0 || n == first, "the first %zu bytes of \"%s\" split off %zu, not %zu",
+			k, input, n, first);
+	}
+
+	for (int i = 0; i < n_trees; i++) { mpc_ast_delete(trees[i]); }
+}
+
+char* form_cases[] = {
+	"; a comment with a \" in it\n(+ 1 2)",
+	"\"a \\\" b\" x",
+	"\"\\\\\" \"x\"",
+	"a\\b c\\ (d\\)",
+	"(x \"\\\" ;\"\n y) z",
+	"x;c\ny{1 2}\"s\"(3)",
+	"{\"}\" ; )\n}",
+	"-1.5(head {a})",
+	")",
+	"(unclosed \"str",
+};
+
+int main(void) {
+	lsp_state* state = calloc(1, sizeof(lsp_state));
+	grammar_new(state);
+
+	mpc_parser_t* Number  = mpc_new("number");
+	mpc_parser_t* Symbol  = mpc_new("symbol");
+	mpc_parser_t* String  = mpc_new("string");
+	mpc_parser_t* Comment = mpc_new("comment");
+	mpc_parser_t* Sexpr   = mpc_new("sexpr");
+	mpc_parser_t* Qexpr   = mpc_new("qexpr");
+	mpc_parser_t* Expr    = mpc_new("expr");
+	mpc_parser_t* Form    = mpc_new("form");
+	mpc_parser_t* Lsp     = mpc_new("lsp");
+	mpc_err_t* err = mpca_lang(MPCA_LANG_DEFAULT, GRAMMAR,
+		Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Form, Lsp, NULL);
+	if (err) {
+		mpc_err_print(err);
+		return 1;
+	}
+
+	// A REPL line is parsed whole by lsp, a script one form at a time
+	char line[1024];
+	int accepted = 0;
+	for (int i = 0; i < LINES; i++) {
+		fuzz_line(line);
+		accepted += compare("lsp", state->lsp, Lsp, line);
+		compare("form", state->form, Form, line);
+	}
+	check(accepted > LINES / 4 && accepted < LINES * 3 / 4,
+		"%d fuzzed lines of %d were accepted, too few of one kind to compare", accepted, LINES);
+
+	check(compare("lsp", state->lsp, Lsp, prelude_lsp), "the prelude did not parse");
+
+	// The same lines and the prelude split into expressions
+	rng = 12345;
+	for (int i = 0; i < LINES; i++) {
+		fuzz_line(line);
+		compare_forms(state->lsp, line);
+	}
+	for (size_t i = 0; i < sizeof(form_cases) / sizeof(form_cases[0]); i++) {
+		strcpy(line, form_cases[i]);
+		compare_forms(state->lsp, line);
+	}
+	char* prelude = malloc(sizeof(prelude_lsp));
+	memcpy(prelude, prelude_lsp, sizeof(prelude_lsp));
+	compare_forms(state->lsp, prelude);
+	free(prelude);
+
+	mpc_cleanup(9, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Form, Lsp);
+	mpc_cleanup(9, state->number, state->symbol, state->string, state->comment,
+		state->sexpr, state->qexpr, state->expr, state->form, state->lsp);
+	free(state);
+
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,575 @@
+// Regression tests for the parts of mpc changed for Lsp
+//
+//     gcc -std=c99 -Wall -O2 -I. tests/test_mpc.c mpc.c -lm -o test_mpc && ./test_mpc
+//
+// Build it with -DMPC_NO_SIMD as well to check the scalar scans
+// Every failed check is printed, and the exit status is 1 if any failed
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <regex.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mpc.h"
+
+int checks, failures;
+
+void check(int ok, char* fmt, ...) {
+	// Count a check, printing what it was about if it failed
+	checks++;
+	if (ok) { return; }
+	failures++;
+	va_list va;
+	va_start(va, fmt);
+	printf("FAIL: ");
+	vprintf(fmt, va);
+	printf("\n");
+	va_end(va);
+}
+
+double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+unsigned long rng = 12345;
+
+int rand_below(int n) {
+	// Same sequence on every system, so a failure can be reproduced
+	rng = rng * 6364136223846793005UL + 1442695040888963407UL;
+	return (int)((rng >> 33) % n);
+}
+
+void rand_string(char* s, char* alphabet, int max) {
+	int len = rand_below(max + 1), n = strlen(alphabet);
+	for (int i = 0; i < len; i++) { s[i] = alphabet[rand_below(n)]; }
+	s[len] = '\0';
+}
+
+// Regular expressions
+
+// Regexes without ambiguity are compiled to DFAs, which must match exactly what the POSIX
+// leftmost-longest matcher does at the start of the input, as greedy and longest matching agree
+// for them. Each is run over random strings of characters it cares about
+
+char* regex_cases[][2] = {
+	{ "[a-z]+",                   "abz09 " },
+	{ "-?[0-9]+(\\.[0-9]*)?",     "-0129.a" },
+	{ "\"(\\\\.|[^\"\\\\])*\"",   "\"\\ab" },
+	{ "[a-zA-Z0-9_+*/%=<>!|&-]+", "aZ9_+*/%=<>!|&- ()" },
+	{ ";[^\r\n]*",                ";ab\r\n" },
+	{ "ab|cd",                    "abcd" },
+	{ "(ab)*c",                   "abc" },
+	{ "a{3}b",                    "ab" },
+	{ "[^ab]x?",                  "abx" },
+	{ "(a|b)(c|d)*e?",            "abcde" },
+	{ "x*y",                      "xy" },
+	{ "[a-zA-Z_][a-zA-Z0-9_]*",   "a_Z9 " },
+};
+
+void test_regex(void) {
+	char s[64];
+	for (size_t c = 0; c < sizeof(regex_cases) / sizeof(regex_cases[0]); c++) {
+		char* re = regex_cases[c][0];
+		mpc_parser_t* p = mpc_re(re);
+
+		char anchored[128];
+		snprintf(anchored, sizeof(anchored), "^(%s)", re);
+		regex_t posix;
+		if (regcomp(&posix, anchored, REG_EXTENDED) != 0) {
+			check(0, "regcomp /%s/", re);
+			mpc_delete(p);
+			continue;
+		}
+
+		for (int k = 0; k < 3000; k++) {
+			rand_string(s, regex_cases[c][1], 12);
+			regmatch_t m[1];
+			int matched = regexec(&posix, s, 1, m, 0) == 0;
+
+			mpc_result_t r;
+			if (mpc_parse("<test>", s, p, &r)) {
+				int len = strlen(r.output);
+				check(matched && len == (int)m[0].rm_eo,
+					"/%s/ on \"%s\" matched %d characters, POSIX %d", re, s, len,
+					matched ? (int)m[0].rm_eo : -1);
+				free(r.output);
+			} else {
+				check(!matched, "/%s/ on \"%s\" failed, POSIX matched %d characters", re, s,
+					(int)m[0].rm_eo);
+				mpc_err_delete(r.error);
+			}
+		}
+
+		regfree(&posix);
+		mpc_delete(p);
+	}
+}
+
+// FIRST sets
+
+// mpc_optimise gives alternatives of mpc_or a table from the next character to those that can
+// start with it, which must not change what the ordered choice parses nor its error messages.
+// The same grammar is built twice, optimised and not, with alternatives that share their first
+// characters, a keyword that is also a prefix of symbols, recursion and a nullable alternative
+
+mpc_parser_t* tok(mpc_parser_t* p, char* tag) { return mpca_tag(mpc_apply(p, mpcf_str_ast), tag); }
+
+mpc_parser_t* first_grammar(mpc_parser_t** expr) {
+	*expr = mpc_new("expr");
+	mpc_define(*expr, mpca_or(7,
+		tok(mpc_re("-?[0-9]+"), "number"),
+		tok(mpc_string("let"), "let"),
+		tok(mpc_re("[a-z+-]+"), "symbol"),
+		tok(mpc_re(" +"), "space"),
+		mpca_tag(mpca_and(3, tok(mpc_char('('), "char"), mpca_many(*expr), tok(mpc_char(')'), "char")),
+			"list"),
+		mpca_tag(mpca_and(2, tok(mpc_char('\''), "char"), *expr), "quote"),
+		mpca_tag(mpca_and(3, tok(mpc_char('['), "char"), mpca_maybe(*expr), tok(mpc_char(']'), "char")),
+			"option")));
+
+	// Only the last alternative of the first one may match nothing
+	return mpca_total(mpca_and(2,
+		mpca_or(3, tok(mpc_re("-?[0-9]+"), "number"), tok(mpc_string("let"), "let"),
+			mpca_maybe(tok(mpc_char('!'), "char"))),
+		mpca_many(*expr)));
+}
+
+int ast_eq(mpc_ast_t* a, mpc_ast_t* b) {
+	// Parsers output NULL when they matched nothing
+	return a && b ? mpc_ast_eq(a, b) : a == b;
+}
+
+void test_first(void) {
+	mpc_parser_t *plain_expr, *fast_expr;
+	mpc_parser_t* plain = first_grammar(&plain_expr);
+	mpc_parser_t* fast = first_grammar(&fast_expr);
+	mpc_optimise(fast_expr);
+	mpc_optimise(fast);
+
+	char s[64];
+	for (int k = 0; k < 20000; k++) {
+		rand_string(s, "0123-letsx+ ()'[]!", 14);
+		mpc_result_t a, b;
+		int ok_a = mpc_parse("<test>", s, plain, &a);
+		int ok_b = mpc_parse("<test>", s, fast, &b);
+
+		if (ok_a && ok_b) {
+			check(ast_eq(a.output, b.output), "\"%s\" parsed differently once optimised", s);
+		} else if (!ok_a && !ok_b) {
+			char* err_a = mpc_err_string(a.error);
+			char* err_b = mpc_err_string(b.error);
+			check(strcmp(err_a, err_b) == 0, "\"%s\" failed with \"%s\" once optimised, not \"%s\"",
+				s, err_b, err_a);
+			free(err_a);
+			free(err_b);
+		} else {
+			check(0, "\"%s\" %s once optimised", s, ok_b ? "parsed" : "failed");
+		}
+
+		if (ok_a) { mpc_ast_delete(a.output); } else { mpc_err_delete(a.error); }
+		if (ok_b) { mpc_ast_delete(b.output); } else { mpc_err_delete(b.error); }
+	}
+
+	mpc_delete(plain);
+	mpc_delete(fast);
+	mpc_cleanup(2, plain_expr, fast_expr);
+}
+
+// Packrat
+
+// Packrat parsing must take time linear in the input, even for input nested thousands deep and
+// for a grammar that takes exponential time without it, and must parse the same trees and fail
+// with the same errors as without it
+
+#define PACKRAT_SECONDS 1.0
+
+char* nested(int depth, char* open, char* middle, char* close) {
+	// open repeated depth times, then middle, then close repeated depth times
+	size_t lo = strlen(open), lm = strlen(middle), lc = strlen(close);
+	char* s = malloc(depth * (lo + lc) + lm + 1);
+	char* t = s;
+	for (int i = 0; i < depth; i++, t += lo) { memcpy(t, open, lo); }
+	memcpy(t, middle, lm);
+	t += lm;
+	for (int i = 0; i < depth; i++, t += lc) { memcpy(t, close, lc); }
+	*t = '\0';
+	return s;
+}
+
+void packrat_time(char* grammar, char* input, char* what, mpc_ast_t* expected) {
+	// Parse input within PACKRAT_SECONDS, into the same tree as expected unless it is NULL
+	mpc_parser_t *s = mpc_new("s"), *a = mpc_new("a");
+	mpc_err_t* err = mpca_lang(MPCA_LANG_PACKRAT, grammar, s, a, NULL);
+	check(err == NULL, "%s: the grammar was rejected", what);
+	if (err) {
+		mpc_err_delete(err);
+		return;
+	}
+
+	mpc_result_t r;
+	double t = now();
+	int ok = mpc_parse("<test>", input, s, &r);
+	t = now() - t;
+	check(ok, "%s: failed to parse", what);
+	check(t < PACKRAT_SECONDS, "%s: took %.2fs", what, t);
+	if (ok) {
+		check(!expected || mpc_ast_eq(r.output, expected), "%s: parsed a different tree", what);
+		mpc_ast_delete(r.output);
+	} else {
+		mpc_err_delete(r.error);
+	}
+	mpc_cleanup(2, s, a);
+}
+
+void test_packrat(void) {
+	// Nested deep, against the tree parsed without packrat
+	char* deep = nested(4000, "(", "x", ")");
+	mpc_parser_t *s = mpc_new("s"), *a = mpc_new("a");
+	mpca_lang(MPCA_LANG_DEFAULT, "s : '(' <s>* ')' | /[a-z]+/ ; a : 'a' ;", s, a, NULL);
+	mpc_result_t r;
+	int ok = mpc_parse("<test>", deep, s, &r);
+	check(ok, "nesting 4000 deep failed to parse without packrat");
+	packrat_time("s : '(' <s>* ')' | /[a-z]+/ ; a : 'a' ;", deep, "nesting 4000 deep",
+		ok ? r.output : NULL);
+	if (ok) { mpc_ast_delete(r.output); } else { mpc_err_delete(r.error); }
+	mpc_cleanup(2, s, a);
+	free(deep);
+
+	// Every level parses <a> twice, each time reusing the same memoized subtree
+	char* backtrack = nested(2000, "(", "zy", ")y");
+	packrat_time("s : <a> 'x' | <a> 'y' ; a : '(' <s> ')' | 'z' ;", backtrack,
+		"backtracking 2000 deep", NULL);
+	free(backtrack);
+
+	// Alternatives sharing prefixes, on random input
+	char* grammar =
+		"s : <a>* ;"
+		"a : <b> '(' <a>* ')' | <b> '[' <a> ']' | <b> '.' <b> | <b> ;"
+		"b : /[a-z]+/ | '(' <a> ')' ;";
+	mpc_parser_t *ps = mpc_new("s"), *pa = mpc_new("a"), *pb = mpc_new("b");
+	mpc_parser_t *rs = mpc_new("s"), *ra = mpc_new("a"), *rb = mpc_new("b");
+	mpca_lang(MPCA_LANG_DEFAULT, grammar, ps, pa, pb, NULL);
+	mpca_lang(MPCA_LANG_PACKRAT, grammar, rs, ra, rb, NULL);
+	mpc_parser_t* plain = mpca_total(ps);
+	mpc_parser_t* packrat = mpca_total(rs);
+
+	char input[64];
+	for (int k = 0; k < 20000; k++) {
+		rand_string(input, "ab ()[].", 16);
+		mpc_result_t x, y;
+		int ok_x = mpc_parse("<test>", input, plain, &x);
+		int ok_y = mpc_parse("<test>", input, packrat, &y);
+
+		if (ok_x && ok_y) {
+			check(ast_eq(x.output, y.output), "\"%s\" parsed differently with packrat", input);
+		} else if (!ok_x && !ok_y) {
+			char* err_x = mpc_err_string(x.error);
+			char* err_y = mpc_err_string(y.error);
+			check(strcmp(err_x, err_y) == 0, "\"%s\" failed with \"%s\" with packrat, not \"%s\"",
+				input, err_y, err_x);
+			free(err_x);
+			free(err_y);
+		} else {
+			check(0, "\"%s\" %s with packrat", input, ok_y ? "parsed" : "failed");
+		}
+
+		if (ok_x) { mpc_ast_delete(x.output); } else { mpc_err_delete(x.error); }
+		if (ok_y) { mpc_ast_delete(y.output); } else { mpc_err_delete(y.error); }
+	}
+
+	mpc_delete(plain);
+	mpc_delete(packrat);
+	mpc_cleanup(6, ps, pa, pb, rs, ra, rb);
+}
+
+// Parse stack
+
+// Parsers run on a stack of their own on the heap, so nesting is only limited by
+// mpc_set_max_depth, past which a parse fails with an error instead of overflowing the C stack
+
+#define DEPTH_DEFAULT 4000000  // MPC_MAX_RECURSION_DEPTH
+
+int depth_parse(mpc_parser_t* p, char* input, char** error) {
+	// Parse input, returns whether it did and if not the error message unless error is NULL
+	mpc_result_t r;
+	if (mpc_parse("<test>", input, p, &r)) {
+		mpc_ast_delete(r.output);
+		return 1;
+	}
+	if (error) { *error = mpc_err_string(r.error); }
+	mpc_err_delete(r.error);
+	return 0;
+}
+
+void test_depth(void) {
+	mpc_parser_t *s = mpc_new("s"), *a = mpc_new("a");
+	mpca_lang(MPCA_LANG_DEFAULT, "s : '(' <s>* ')' | /[a-z]+/ ; a : 'a' ;", s, a, NULL);
+
+	char* deep = nested(100000, "(", "x", ")");
+	check(depth_parse(s, deep, NULL), "nesting 100000 deep failed to parse");
+	free(deep);
+
+	// Failing deep down unwinds every frame
+	char* unclosed = nested(50000, "(", "x", "");
+	char* error = NULL;
+	check(!depth_parse(s, unclosed, &error), "nesting 50000 deep without closing parsed");
+	check(error && strstr(error, "at end of input"), "unclosed nesting failed with \"%s\"", error);
+	free(error);
+	free(unclosed);
+
+	mpc_set_max_depth(1000);
+	char* shallow = nested(10, "(", "x", ")");
+	check(depth_parse(s, shallow, NULL), "nesting 10 deep failed with a maximum depth of 1000");
+	free(shallow);
+
+	deep = nested(1000, "(", "x", ")");
+	error = NULL;
+	check(!depth_parse(s, deep, &error), "nesting 1000 deep parsed with a maximum depth of 1000");
+	check(error && strstr(error, "Maximum recursion depth exceeded!"),
+		"nesting past the maximum depth failed with \"%s\"", error);
+	free(error);
+	free(deep);
+	mpc_set_max_depth(DEPTH_DEFAULT);
+
+	mpc_cleanup(2, s, a);
+}
+
+// Arena
+
+// Results made while parsing live in an arena of the input, except those over 1KB, and are
+// copied out of it when they outlive the parse. Folds growing strings of every size, partial
+// results freed by a failed alternative and stream items parsed one after another must all
+// come out intact
+
+void test_arena(void) {
+	// A word followed by '!', or else everything, which the first alternative wasted a copy of
+	mpc_parser_t* word = mpc_or(2,
+		mpc_and(2, mpcf_fst_free, mpc_many1(mpcf_strfold, mpc_alpha()), mpc_char('!'), free),
+		mpc_many(mpcf_strfold, mpc_any()));
+
+	char* input = malloc(5001);
+	for (int len = 0; len <= 5000; len += len < 300 ? 1 : 97) {
+		for (int i = 0; i < len; i++) { input[i] = 'a' + rand_below(26); }
+		int bang = len > 1 && rand_below(2);
+		if (bang) { input[len-1] = '!'; }
+		input[len] = '\0';
+
+		mpc_result_t r;
+		if (mpc_parse("<test>", input, word, &r)) {
+			char* expected = bang ? strndup(input, len - 1) : strdup(input);
+			check(r.output && strcmp(r.output, expected) == 0, "a word %d long came out wrong", len);
+			free(expected);
+			free(r.output);
+		} else {
+			check(0, "a word %d long failed to parse", len);
+			mpc_err_delete(r.error);
+		}
+	}
+	free(input);
+	mpc_delete(word);
+
+	// Stream items, the arena being reset after each
+	FILE* f = tmpfile();
+	if (!f) {
+		check(0, "tmpfile");
+		return;
+	}
+	int lens[200];
+	for (int k = 0; k < 200; k++) {
+		lens[k] = 1 + rand_below(k % 10 == 0 ? 3000 : 50);
+		for (int i = 0; i < lens[k]; i++) { fputc('a' + (k + i) % 26, f); }
+		fputc(';', f);
+	}
+	rewind(f);
+
+	mpc_parser_t* item = mpc_and(2, mpcf_fst_free,
+		mpc_many1(mpcf_strfold, mpc_alpha()), mpc_char(';'), free);
+	mpc_stream_t* stream = mpc_stream_pipe("<test>", f);
+	for (int k = 0; k < 200; k++) {
+		mpc_result_t r;
+		if (!mpc_stream_next(stream, item, &r)) {
+			check(0, "stream item %d failed to parse", k);
+			mpc_err_delete(r.error);
+			break;
+		}
+		int ok = (int)strlen(r.output) == lens[k];
+		for (int i = 0; ok && i < lens[k]; i++) { ok = ((char*)r.output)[i] == 'a' + (k + i) % 26; }
+		check(ok, "stream item %d came out wrong", k);
+		free(r.output);
+	}
+	check(mpc_stream_end(stream), "the stream did not end after its items");
+	mpc_stream_delete(stream);
+	mpc_delete(item);
+	fclose(f);
+}
+
+// Bulk scans
+
+// Whitespace, comment bodies and string bodies are skipped many bytes at a time, with SIMD
+// unless built with MPC_NO_SIMD. Runs of every length up to 100, starting at every alignment
+// and including bytes over 127, must end where a loop over single characters ends them, and
+// whitespace must leave the row and column of what follows right
+
+#define SCAN_MAX 100
+
+int scan_ws(char c)      { return c && strchr(" \f\n\r\t\v", c); }
+int scan_comment(char c) { return c && c != '\r' && c != '\n'; }
+
+int scan_string(char* s) {
+	// Length of the string literal s starts with, -1 if there is none
+	if (s[0] != '"') { return -1; }
+	int i = 1;
+	while (s[i] && s[i] != '"') {
+		if (s[i] == '\\') {
+			if (!s[i+1]) { return -1; }
+			i++;
+		}
+		i++;
+	}
+	return s[i] == '"' ? i + 1 : -1;
+}
+
+void scan_body(char* s, int len, char* alphabet, int high) {
+	// Random characters from alphabet, some over 127 if high
+	int n = strlen(alphabet);
+	for (int i = 0; i < len; i++) {
+		s[i] = high && rand_below(4) == 0 ? (char)(128 + rand_below(128)) : alphabet[rand_below(n)];
+	}
+}
+
+int scan_match(mpc_parser_t* p, char* s, int len) {
+	// Length p matched at the start of s, -1 if it failed
+	mpc_result_t r;
+	if (!mpc_nparse_borrow("<test>", s, len, p, &r)) {
+		mpc_err_delete(r.error);
+		return -1;
+	}
+	int n = strlen(r.output);
+	free(r.output);
+	return n;
+}
+
+void test_scan(void) {
+	mpc_parser_t* ws = mpc_and(2, mpcf_snd_free, mpc_whitespaces(), mpc_state(), free);
+	mpc_parser_t* comment = mpc_re(";[^\r\n]*");
+	mpc_parser_t* string = mpc_re_mode("\"(\\\\.|[^\"\\\\])*\"", MPC_RE_DOTALL);
+
+	// Room for any alignment of the longest input
+	char buffer[64 + 2 * SCAN_MAX + 8];
+	for (int align = 0; align < 64; align++) {
+		char* s = buffer + align;
+		for (int len = 0; len <= SCAN_MAX; len++) {
+			// Whitespace, then something else or nothing
+			scan_body(s, len, " \f\n\r\t\v", 0);
+			int total = len + rand_below(2);
+			if (total > len) { s[len] = 'x'; }
+			s[total] = '\0';
+
+			int row = 0, col = 0;
+			for (int i = 0; i < len; i++) {
+				if (s[i] == '\n') { row++; col = 0; } else { col++; }
+			}
+			mpc_result_t r;
+			if (mpc_nparse_borrow("<test>", s, total, ws, &r)) {
+				mpc_state_t* st = r.output;
+				check(st->pos == len && st->row == row && st->col == col,
+					"whitespace %d long at alignment %d ended at %ld:%ld:%ld, not %d:%d:%d",
+					len, align, st->pos, st->row, st->col, len, row, col);
+				free(st);
+			} else {
+				check(0, "whitespace %d long at alignment %d failed", len, align);
+				mpc_err_delete(r.error);
+			}
+
+			// A comment, ended by a newline, a carriage return or the end of input
+			s[0] = ';';
+			scan_body(s + 1, len, "ab; \t\"\\", 1);
+			total = len + 1;
+			int end = rand_below(3);
+			if (end < 2) { s[total++] = end ? '\n' : '\r'; }
+			s[total] = '\0';
+			int expected = 1;
+			while (scan_comment(s[expected])) { expected++; }
+			int n = scan_match(comment, s, total);
+			check(n == expected, "a comment %d long at alignment %d matched %d, not %d",
+				len, align, n, expected);
+
+			// A string with escapes, closed or not, as Lsp reads them with any character escaped
+			s[0] = '"';
+			scan_body(s + 1, len, "ab ;\\\n", 1);
+			total = len + 1;
+			if (rand_below(4)) { s[total++] = '"'; }
+			s[total] = '\0';
+			expected = scan_string(s);
+			n = scan_match(string, s, total);
+			check(n == expected, "a string %d long at alignment %d matched %d, not %d",
+				len, align, n, expected);
+		}
+	}
+
+	mpc_delete(ws);
+	mpc_delete(comment);
+	mpc_delete(string);
+}
+
+// Whole files
+
+// mpc_parse_contents maps regular files and reads anything else, a pipe here, both into a buffer
+// of the file's whole length. A NUL byte ends the input for every parser, bulk scans included,
+// so a comment running into one must end there and leave nothing to parse, either way
+
+int contents_parse(char* filename, mpc_parser_t* p) {
+	mpc_result_t r;
+	if (!mpc_parse_contents(filename, p, &r)) {
+		mpc_err_delete(r.error);
+		return 0;
+	}
+	free(r.output);
+	return 1;
+}
+
+void test_contents(void) {
+	char data[80];
+	int len = snprintf(data, sizeof(data), ";%040d\n", 0);
+	data[20] = '\0';
+	mpc_parser_t* p = mpc_and(2, mpcf_all_free,
+		mpc_re_mode(";[^\r\n]*", MPC_RE_DEFAULT), mpc_eoi(), free);
+
+	char path[] = "/tmp/test_mpcXXXXXX";
+	int fd = mkstemp(path);
+	check(fd >= 0 && write(fd, data, len) == len, "could not write %s", path);
+	if (fd >= 0) { close(fd); }
+	check(contents_parse(path, p), "a mapped file did not end at its NUL byte");
+	remove(path);
+
+#ifdef __linux__
+	int fds[2];
+	check(pipe(fds) == 0 && write(fds[1], data, len) == len, "could not write a pipe");
+	close(fds[1]);
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fds[0]);
+	check(contents_parse(path, p), "a file read did not end at its NUL byte");
+	close(fds[0]);
+#endif
+
+	mpc_delete(p);
+}
+
+int main(void) {
+	test_regex();
+	test_first();
+	test_packrat();
+	test_depth();
+	test_arena();
+	test_scan();
+	test_contents();
+
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+;;; Test helpers
+
+; Value of a test that passed, a failed one evaluates to an error which gets printed
+(def {test_passed} ())
+
+; Sum of the first n numbers, taking longer the larger n is
+(fun {slow n} {foldl + 0 (take n (range-from 0))})
+
+;;; pmap
+
+(if (!= (pmap (lambda {x} {* x x}) {1 2 3 4}) {1 4 9 16})
+	{error "pmap should map each item in order"}
+	{test_passed})
+
+(if (!= (pmap (lambda {x} {x}) {}) {})
+	{error "pmap of an empty list should be empty"}
+	{test_passed})
+
+(if (!= (pmap (lambda {x} {* 2 x}) (range 5000)) (map (lambda {x} {* 2 x}) (range 5000)))
+	{error "pmap of a long list should equal map"}
+	{test_passed})
+
+(if (!= (pmap (lambda {x} {slow (- 2000 (* 100 x))}) (range 20))
+		(map (lambda {x} {slow (- 2000 (* 100 x))}) (range 20)))
+	{error "pmap should keep the order of items taking different times"}
+	{test_passed})
+
+(if (!= (pmap (lambda {x} {pmap (lambda {y} {* x y}) {1 2 3}}) {1 2 3}) {{1 2 3} {2 4 6} {3 6 9}})
+	{error "pmap inside pmap should run its tasks too"}
+	{test_passed})
+
+(fun {scale k xs} {pmap (lambda {x} {* k x}) xs})
+(if (!= (scale 3 {1 2 3}) {3 6 9})
+	{error "pmap tasks should see the local variables of the caller"}
+	{test_passed})
+
+;;; pfilter
+
+(if (!= (pfilter (lambda {x} {== 0 (% x 3)}) (range 20)) {0 3 6 9 12 15 18})
+	{error "pfilter should keep matching items in order"}
+	{test_passed})
+
+(if (!= (pfilter (lambda {x} {> (slow x) 1000}) (range 100))
+		(filter (lambda {x} {> (slow x) 1000}) (range 100)))
+	{error "pfilter should equal filter"}
+	{test_passed})
+
+;;; preduce
+
+(if (!= (preduce + 0 (range 10001)) 50005000)
+	{error "preduce should fold every item"}
+	{test_passed})
+
+(if (!= (preduce + 7 {}) 7)
+	{error "preduce of an empty list should be its initial value"}
+	{test_passed})
+
+(if (!= (preduce join {} (pmap (lambda {x} {list x}) (range 1000))) (range 1000))
+	{error "preduce should fold ranges in order"}
+	{test_passed})
+
+;;; Channels
+
+; Send the numbers from lo up to hi on a channel, then return hi
+(fun {produce c lo hi} {if (< lo hi) {do (send c lo) (produce c (+ lo 1) hi)} {hi}})
+
+; Sum of the next n values received
+(fun {drain c n acc} {if (== n 0) {acc} {drain c (- n 1) (+ acc (recv c))}})
+
+(def {c} (chan 2))
+(send c 1)
+(send c 2)
+(if (!= (list (recv c) (recv c)) {1 2})
+	{error "a channel should give values in the order they were sent"}
+	{test_passed})
+
+(def {c} (chan 4))
+(def {f} (spawn {produce c 0 100}))
+(if (!= (list (drain c 100 0) (await f)) {4950 100})
+	{error "a future should pass every value through a channel smaller than them"}
+	{test_passed})
+
+(def {c} (chan 8))
+(def {fs} (map (lambda {k} {spawn {produce c (* k 25) (* (+ k 1) 25)}}) {0 1 2 3}))
+(if (!= (list (drain c 100 0) (map await fs)) {4950 {25 50 75 100}})
+	{error "a channel should take values from several futures"}
+	{test_passed})
+
+; Answer n values received on a with each plus one on b
+(fun {pong a b n} {if (== n 0) {n} {do (send b (+ 1 (recv a))) (pong a b (- n 1))}})
+(fun {ping a b n acc} {if (== n 0) {acc} {do (send a n) (ping a b (- n 1) (+ acc (recv b)))}})
+(def {a} (chan 1))
+(def {b} (chan 1))
+(def {f} (spawn {pong a b 50}))
+(if (!= (list (ping a b 50 0) (await f)) {1325 0})
+	{error "two tasks should take turns through channels of one value"}
+	{test_passed})
+
+(def {c} (chan 3))
+(send c {1 {2 3}})
+(send c "s")
+(close c)
+(if (!= (list (recv c) (recv c)) {{1 {2 3}} "s"})
+	{error "a closed channel should still give the values left in it"}
+	{test_passed})
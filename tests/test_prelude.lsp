@@ -6,16 +6,96 @@
 ; - assertions
 ; - better introspection/namespacing (e.g. I want code to be able to execute all tests)
 
+; Value of a test that passed, a failed one evaluates to an error which gets printed
+(def {test_passed} ())
+
 ;;; Atoms
-if (!= nil {})
+(if (!= nil {})
 	{error "nil atom should equal empty list {}"}
-	{test_passed}
+	{test_passed})
 
 ;;; Functions
 
 ;;; Conditionals / Flow control
 
 ;;; Lists
+(if (!= (take 3 (map (lambda {x} {* x x}) (range-from 1))) {1 4 9})
+	{error "take of a lazy map should be the first values mapped"}
+	{test_passed})
+
+(if (!= (take 4 (iterate (lambda {x} {* x 2}) 1)) {1 2 4 8})
+	{error "iterate should apply its function to the previous value"}
+	{test_passed})
+
+(if (!= (take-while (lambda {x} {< x 5}) (filter (lambda {x} {== 0 (% x 2)}) (range-from 0)))
+		{0 2 4})
+	{error "take-while should end an endless sequence"}
+	{test_passed})
+
+(if (!= (drop-while (lambda {x} {< x 3}) (drop 1 (range 6))) {3 4 5})
+	{error "drop and drop-while should skip the first values"}
+	{test_passed})
+
+(if (!= (foldl + 0 (take 100000 (map (lambda {x} {* 2 x}) (range-from 0)))) 9999900000)
+	{error "foldl should read a lazy sequence in one pass"}
+	{test_passed})
+
+(if (!= (list (head (range 3)) (len (range 2 5)) (tail (range 3))) {{0} 3 {1 2}})
+	{error "functions expecting a list should get the values of a sequence"}
+	{test_passed})
+
+(def {evens} (filter (lambda {x} {== 0 (% x 2)}) (range 10)))
+(if (|| (!= (take 2 evens) {0 2}) (!= (take 3 evens) {0 2 4}))
+	{error "a sequence should be read from its start every time"}
+	{test_passed})
 
 ;;; Math
 
+
+;;; Generators
+
+; Yield the numbers from n up, without end
+(fun {nat n} {do (yield n) (nat (+ n 1))})
+
+; Generator of the numbers from n down to 1
+(fun {countdown n} {gen {countdown-loop n}})
+(fun {countdown-loop n} {if (== n 0) {()} {do (yield n) (countdown-loop (- n 1))}})
+
+; Generator of the values of another one doubled, pulled from inside its own expression
+(fun {doubled src} {gen {doubled-loop (next src) src}})
+(fun {doubled-loop v src} {
+	if (== v {}) {()} {do (yield (* 2 (frst v))) (doubled-loop (next src) src)}
+})
+
+(def {g} (countdown 2))
+(if (!= (list (next g) (next g) (next g) (next g)) {{2} {1} {} {}})
+	{error "next should give each value in a list, then an empty one after the last"}
+	{test_passed})
+
+(if (!= (gen-list (gen-take 5 (gen {nat 0}))) {0 1 2 3 4})
+	{error "gen-take should end an endless generator"}
+	{test_passed})
+
+(def {g1} (countdown 3))
+(def {g2} (countdown 3))
+(if (!= (list (next g1) (next g2) (next g1) (next g2)) {{3} {3} {2} {2}})
+	{error "generators should be suspended independently of each other"}
+	{test_passed})
+
+(if (!= (gen-list (doubled (countdown 3))) {6 4 2})
+	{error "a generator should be able to pull from another"}
+	{test_passed})
+
+(if (!= (gen-foldl + 0 (gen-filter (lambda {x} {== 0 (% x 2)})
+		(gen-map (lambda {x} {* x 3}) (gen-range 0 10)))) 60)
+	{error "gen-map and gen-filter should chain over gen-range"}
+	{test_passed})
+
+(if (!= (gen-foldl + 0 (gen-range 0 1000000)) 499999500000)
+	{error "gen-foldl should read a long gen-range"}
+	{test_passed})
+
+(if (!= (list (gen-list (gen-map (lambda {x} {* x x}) {1 2 3})) (gen-list (gen-range 5 2)))
+		{{1 4 9} {}})
+	{error "generator functions should take lists, and an empty range should be empty"}
+	{test_passed})
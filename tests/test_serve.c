@@ -0,0 +1,223 @@
+// Test of lsp --serve, run on a thread of the test over a pool of 4 threads: clients of their own
+// print from pmap, pfilter and futures at the same time, and each must get back what its own
+// requests printed, in its responses, while nothing is written to the server's stdout. A client
+// shutting down its side after its requests must still get their responses
+//
+//     gcc -std=c99 -Wall -O2 -I. tests/test_serve.c lsp.c mpc.c -lm -pthread -o test_serve && ./test_serve
+//
+// Every failed check is printed, and the exit status is 1 if any failed. The server is only
+// available on Linux
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "lsp.h"
+
+#define CLIENTS 4
+#define ROUNDS 5
+
+int checks, failures;
+
+void check(int ok, char* fmt, ...) {
+	// Count a check, printing what it was about if it failed
+	checks++;
+	if (ok) { return; }
+	failures++;
+	va_list va;
+	va_start(va, fmt);
+	printf("FAIL: ");
+	vprintf(fmt, va);
+	printf("\n");
+	va_end(va);
+}
+
+char path[64];
+
+int full(int fd, char* buf, size_t len, int writing) {
+	// Send or receive exactly len bytes, returns 0 if the connection broke
+	while (len > 0) {
+		ssize_t n = writing ? write(fd, buf, len) : read(fd, buf, len);
+		if (n <= 0) { return 0; }
+		buf += n;
+		len -= n;
+	}
+	return 1;
+}
+
+int client_connect(void) {
+	// Connect to the server, waiting for it to listen, returns -1 if it never does
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	struct timespec wait = { 0, 10000000 };
+	for (int i = 0; i < 500; i++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) { return -1; }
+		if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) { return fd; }
+		close(fd);
+		nanosleep(&wait, NULL);
+	}
+	return -1;
+}
+
+int request_send(int fd, char* expr) {
+	size_t len = strlen(expr);
+	unsigned char header[4] = { len >> 24, len >> 16, len >> 8, len };
+	return full(fd, (char*)header, 4, 1) && full(fd, expr, len, 1);
+}
+
+char* response_recv(int fd) {
+	// Response as a string, NULL if the connection broke
+	unsigned char h[4];
+	if (!full(fd, (char*)h, 4, 0)) { return NULL; }
+	size_t n = (size_t)h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3];
+	char* response = malloc(n + 1);
+	if (!full(fd, response, n, 0)) {
+		free(response);
+		return NULL;
+	}
+	response[n] = '\0';
+	return response;
+}
+
+typedef struct {
+	int id;
+	char* responses[ROUNDS][3];
+} client;
+
+void* client_run(void* arg) {
+	// Requests printing lines naming the client, from pmap, pfilter and a future
+	client* c = arg;
+	char requests[3][256];
+	snprintf(requests[0], sizeof(requests[0]),
+		"(pmap (lambda {x} {do (sum (range 2000)) (print %d x)}) (range 8))", c->id);
+	snprintf(requests[1], sizeof(requests[1]),
+		"(pfilter (lambda {x} {do (sum (range 2000)) (print %d x) (> x 3)}) (range 8))", c->id);
+	snprintf(requests[2], sizeof(requests[2]),
+		"(await (spawn {do (print %d 0) (pmap (lambda {x} {print %d (+ x 1)}) (range 7)) 1}))",
+		c->id, c->id);
+
+	int fd = client_connect();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (int i = 0; i < 3; i++) {
+			c->responses[r][i] = fd >= 0 && request_send(fd, requests[i]) ? response_recv(fd) : NULL;
+		}
+	}
+	if (fd >= 0) { close(fd); }
+	return NULL;
+}
+
+void check_printed(client* c, int r, int i, char* result) {
+	// The response must be a line "id x" for each x from 0 to 7 in any order, then the result
+	char* response = c->responses[r][i];
+	if (!response) {
+		check(0, "client %d got no response to request %d", c->id, i);
+		return;
+	}
+	int seen[8] = {0}, lines = 0, ok = 1;
+	char* s = response;
+	char* end;
+	while ((end = strchr(s, '\n'))) {
+		int id, x;
+		if (sscanf(s, "%d %d", &id, &x) != 2 || id != c->id || x < 0 || x > 7 || seen[x]++) {
+			ok = 0;
+		}
+		lines++;
+		s = end + 1;
+	}
+	check(ok && lines == 8 && strcmp(s, result) == 0,
+		"client %d got \"%s\" for request %d", c->id, response, i);
+}
+
+// Responses to a client that shuts down its side right after sending, then whether the server
+// closed the connection after them
+char* half_responses[2];
+int half_closed;
+
+void half_run(void) {
+	int fd = client_connect();
+	if (fd < 0) { return; }
+	if (request_send(fd, "(+ 1 2)") && request_send(fd, "do (print 4) 5")
+		&& shutdown(fd, SHUT_WR) == 0) {
+		half_responses[0] = response_recv(fd);
+		half_responses[1] = response_recv(fd);
+		char c;
+		half_closed = read(fd, &c, 1) == 0;
+	}
+	close(fd);
+}
+
+void* server_run(void* arg) {
+	lsp_serve(arg, path);
+	return NULL;
+}
+
+int main(void) {
+	// Thread count is read once, when the pool is made
+	setenv("LSP_THREADS", "4", 1);
+	lsp_state* state = lsp_new(NULL);
+	snprintf(path, sizeof(path), "/tmp/test_serve%d.sock", (int)getpid());
+
+	// The server's stdout goes into a file for the time being, which must stay empty
+	FILE* printed = tmpfile();
+	fflush(stdout);
+	int saved = dup(1);
+	dup2(fileno(printed), 1);
+
+	pthread_t server;
+	pthread_create(&server, NULL, server_run, state);
+
+	client clients[CLIENTS];
+	pthread_t threads[CLIENTS];
+	for (int i = 0; i < CLIENTS; i++) {
+		memset(&clients[i], 0, sizeof(client));
+		clients[i].id = i + 1;
+		pthread_create(&threads[i], NULL, client_run, &clients[i]);
+	}
+	for (int i = 0; i < CLIENTS; i++) { pthread_join(threads[i], NULL); }
+	half_run();
+
+	// Only sent once a request was answered, so that the server catches it
+	kill(getpid(), SIGTERM);
+	pthread_join(server, NULL);
+
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+	fseek(printed, 0, SEEK_END);
+	check(ftell(printed) == 0, "the server wrote %ld bytes to stdout", ftell(printed));
+	fclose(printed);
+
+	for (int i = 0; i < CLIENTS; i++) {
+		for (int r = 0; r < ROUNDS; r++) {
+			check_printed(&clients[i], r, 0, "{() () () () () () () ()}");
+			check_printed(&clients[i], r, 1, "{4 5 6 7}");
+			check_printed(&clients[i], r, 2, "1");
+			for (int j = 0; j < 3; j++) { free(clients[i].responses[r][j]); }
+		}
+	}
+
+	char* half[2] = { "3", "4\n5" };
+	for (int i = 0; i < 2; i++) {
+		check(half_responses[i] && strcmp(half_responses[i], half[i]) == 0,
+			"a client done sending got \"%s\" for request %d, not \"%s\"",
+			half_responses[i] ? half_responses[i] : "nothing", i, half[i]);
+		free(half_responses[i]);
+	}
+	check(half_closed, "the connection of a client done sending stayed open after its responses");
+
+	lsp_delete(state);
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}